@@ -9,7 +9,7 @@ set link_debug_flags=/DEBUG:FULL
 set link_release_flags=/LTCG /RELEASE
 
 set cl_defines=/DTIMER
-set cl_flags_common=/nologo /FC /I..\src\ /arch:AVX2 /Oi /W4
+set cl_flags_common=/nologo /FC /I..\src\ /Oi /W4
 
 set link_flags_common=/MANIFEST:EMBED /INCREMENTAL:NO
 
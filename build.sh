@@ -0,0 +1,30 @@
+#!/bin/sh
+
+build_dir=build
+
+cc_debug_flags="-g -DDEBUG -O0"
+cc_release_flags="-g -DNDEBUG -O2 -ffast-math"
+
+cc_defines="-DTIMER"
+cc_flags_common="-I../src/ -Wall -Wextra -Wno-unused-function -Wno-unknown-pragmas -Wno-cast-function-type"
+
+link_flags_common="-lm -pthread"
+
+if [ "$1" = "release" ]; then
+    cc_flags="$cc_flags_common $cc_defines $cc_release_flags"
+else
+    cc_flags="$cc_flags_common $cc_defines $cc_debug_flags"
+fi
+
+cc=${CC:-cc}
+
+mkdir -p "$build_dir"
+
+cd "$build_dir" || exit 1
+
+$cc $cc_flags ../src/read_speed_test.c -o read_speed_test $link_flags_common || exit 1
+$cc $cc_flags ../src/count_lines.c     -o count_lines     $link_flags_common || exit 1
+$cc $cc_flags ../src/find_line.c       -o find_line       $link_flags_common || exit 1
+$cc $cc_flags ../src/hash_file.c       -o hash_file       $link_flags_common || exit 1
+$cc $cc_flags ../src/find_dup_files.c  -o find_dup_files  $link_flags_common || exit 1
+$cc $cc_flags ../src/1brc.c            -o 1brc            $link_flags_common || exit 1
@@ -16,7 +16,8 @@ static void
 print_about(const char **argv)
 {
 	printf("Invalid usage\n"
-		"%s: file\n", argv[0]);
+		"%s: [options] file results_file\n"
+		BLOCK_READER_OPTIONS_HELP, argv[0]);
 }
 
 typedef struct record {
@@ -28,13 +29,25 @@ typedef struct record {
 	char key[100];
 } record_t;
 
+typedef struct
+{
+	record_t *records;
+	XXH64_state_t *hash_state;
+
+	u64 file_size;
+
+	char *leftover_buffer;
+	size_t leftover_capacity;
+	size_t leftover_block_size;
+} parse_context_t;
+
 inline static void
 update_record(record_t *record, f32 temp)
 {
 	record->count += 1;
 	record->sum   += temp;
-	record->min    = min(record->min, temp);
-	record->max    = max(record->max, temp);
+	record->min    = MIN(record->min, temp);
+	record->max    = MAX(record->max, temp);
 }
 
 inline static f64
@@ -76,7 +89,7 @@ compare_record_t(const void *a, const void *b)
 	record_t const *aa = a;
 	record_t const *bb = b;
 
-	return (int) sz_order(aa->key, KEY_SIZE, bb->key, KEY_SIZE);
+	return (int) sz_order_serial(aa->key, KEY_SIZE, bb->key, KEY_SIZE);
 }
 
 size_t
@@ -92,7 +105,7 @@ handle_block(char const * const start, size_t length,
 
 	for (;;)
 	{
-		sz_cptr_t semicolon = sz_find_byte_avx2(current_pos, working_len, semicolon_str);
+		sz_cptr_t semicolon = simd.find_byte(current_pos, working_len, semicolon_str);
 
 		if (semicolon == NULL)
 		{
@@ -108,7 +121,7 @@ handle_block(char const * const start, size_t length,
 
 		working_len -= 1;
 
-		sz_cptr_t key_start = sz_rfind_byte_avx2(current_pos, semicolon - current_pos, newline_str);
+		sz_cptr_t key_start = simd.rfind_byte(current_pos, semicolon - current_pos, newline_str);
 
 		if (key_start == NULL)
 		{
@@ -116,7 +129,7 @@ handle_block(char const * const start, size_t length,
 		}
 
 		char key[KEY_SIZE] = {0};
-		sz_copy_avx2(key, key_start, semicolon - current_pos);
+		simd.copy(key, key_start, semicolon - current_pos);
 
 		current_pos = semicolon + 1;
 
@@ -165,7 +178,7 @@ handle_block(char const * const start, size_t length,
 
 		if (record->key[0] == 0)
 		{
-			sz_copy_avx2(record->key, key, KEY_SIZE);
+			simd.copy(record->key, key, KEY_SIZE);
 		}
 
 		// printf("Updating %s\n", record->key);
@@ -173,22 +186,66 @@ handle_block(char const * const start, size_t length,
 
 	size_t leftover_size = 0;
 
-	sz_cptr_t last_newline = sz_rfind_byte_avx2(start, length, newline_str);
+	sz_cptr_t last_newline = simd.rfind_byte(start, length, newline_str);
 
 	if (last_newline != NULL)
 	{
 		leftover_size = (start + length) - last_newline;
 		leftover_size = leftover_size > overflow_length ? overflow_length : leftover_size;
 
-		sz_copy_avx2(overflow_start + overflow_length - leftover_size, last_newline, leftover_size);
+		simd.copy(overflow_start + overflow_length - leftover_size, last_newline, leftover_size);
 	}
 
 	return leftover_size;
 }
 
+static bool
+handle_block_callback(u8 *block, size_t block_size, u64 block_offset, void *user_data)
+{
+	parse_context_t *context = (parse_context_t *) user_data;
+
+	char *buffer         = (char *) block;
+	char *virtual_buffer = buffer - context->leftover_block_size;
+
+	// A mapped file arrives as one block, there is no next block to carry a dangling line into
+	bool is_whole_file = (block_offset == 0) && (block_size == context->file_size);
+
+	size_t leftover_capacity = is_whole_file ? 0 : context->leftover_capacity;
+
+	simd.copy(virtual_buffer, context->leftover_buffer + context->leftover_capacity - context->leftover_block_size, context->leftover_block_size);
+
+	context->leftover_block_size = handle_block(virtual_buffer, block_size + context->leftover_block_size,
+	                                            context->leftover_buffer, leftover_capacity,
+	                                            context->records, context->hash_state);
+
+	return true;
+}
+
+static void
+handle_pass_callback(void *user_data, bool is_final_pass)
+{
+	(void) is_final_pass;
+
+	parse_context_t *context = (parse_context_t *) user_data;
+
+	memset(context->records, 0, sizeof(record_t) * STATION_COUNT);
+
+	for (u32 i = 0; i < STATION_COUNT; ++i)
+	{
+		context->records[i].min = FLT_MAX;
+	}
+
+	context->leftover_block_size = 0;
+}
+
 int 
 main(int argc, const char **argv)
 {
+	block_reader_config_t reader_config = default_block_reader_config(FILE_BUFFER_SIZE, "parsed");
+	reader_config.allow_mmap            = true;
+
+	argc = strip_block_reader_options(argc, argv, &reader_config);
+
 	if (argc < 3)
 	{
 		print_about(argv);
@@ -201,15 +258,9 @@ main(int argc, const char **argv)
 	const char *file_path    = argv[1];
 	const char *results_path = argv[2];
 
-	HANDLE file_handle = CreateFileA(file_path,
-									 GENERIC_READ,
-									 FILE_SHARE_READ,
-									 NULL,
-									 OPEN_EXISTING,
-									 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-									 NULL);
+	file_handle_t file_handle = open_file_for_block_reader(file_path, &reader_config);
 
-	if (file_handle == INVALID_HANDLE_VALUE)
+	if (!is_file_handle_valid(file_handle))
 	{
 		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
 		return 1;
@@ -219,31 +270,7 @@ main(int argc, const char **argv)
 	u64 file_size = get_file_size(file_handle);
 	printf("(file size is %lf GB)\n", ((double) file_size / (double) GIGABYTES(1)));
 
-	//
-	// Alloc buffer
-	// The second half of the buffer is used to hold our current file read. The first half contains the dangingling
-	// last line of the previous buffer
-	//
-	char *buffer_real     = (char*) VirtualAlloc(0, FILE_BUFFER_SIZE * 2, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-	char *buffer          = buffer_real + FILE_BUFFER_SIZE;
-	char *leftover_buffer = buffer_real;
-
-	u64 bytes_parsed = 0;
-
-	u64 read_time  = 0;
-	u64 think_time = 0;
-
-	u64 print_bytes_parsed = 0;
-	u64 print_time_elapsed = 0;
-
-	size_t leftover_block_size = 0;
-
-	record_t *records = (record_t*) VirtualAlloc(0, sizeof(record_t) * STATION_COUNT, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-
-	for (u32 i = 0; i < STATION_COUNT; ++i)
-	{
-		records[i].min = FLT_MAX;
-	}
+	record_t *records = (record_t*) alloc_pages(sizeof(record_t) * STATION_COUNT);
 
 	XXH64_state_t * const hash_state = XXH64_createState();
 	if (hash_state == NULL)
@@ -252,61 +279,22 @@ main(int argc, const char **argv)
 		return 1;
 	}
 
-	do
-	{
-		u64 block_start = read_os_timer();
-
-		DWORD bytes_read = 0;
-		BOOL read_status = ReadFile(file_handle, buffer, FILE_BUFFER_SIZE, &bytes_read, NULL);
-
-		u64 read_end_time = read_os_timer();
-
-		if (!read_status)
-		{
-			DWORD last_error = GetLastError();
-			// https://learn.microsoft.com/en-us/windows/win32/debug/system-error-codes
-			fprintf(stderr, "(fatal: could not read from file, system code %u)\n", last_error);
-
-			break;
-		}
-
-		char *virtual_buffer = buffer - leftover_block_size;
-
-		leftover_block_size = handle_block(virtual_buffer, bytes_read + leftover_block_size, 
-			                               leftover_buffer, FILE_BUFFER_SIZE,
-			                               records, hash_state);
-
-		bytes_parsed       += bytes_read;
-		print_bytes_parsed += bytes_read;
-
-		u64 block_end     = read_os_timer();
-		u64 block_elapsed = block_end - block_start;
-
-		print_time_elapsed += block_elapsed;
-		if (print_time_elapsed >= (timer_freq / 5))
-		{
-			double mb_per_sec  = ((double) print_bytes_parsed / (double) MEGABYTES(1)) / (print_time_elapsed               / (double) timer_freq);
-			double total_speed = ((double) bytes_parsed       / (double) MEGABYTES(1)) / ((block_end - program_start_time) / (double) timer_freq);
-
-			double eta_in_sec  = ((double) (file_size - bytes_parsed) / (double) MEGABYTES(1)) / mb_per_sec;
-
-			double gb_parsed = ((double) bytes_parsed / (double) GIGABYTES(1));
-			double read_precent = ((double) bytes_parsed / (double) file_size) * 100;
-
-			u64 read_elpased = (read_end_time - block_start);
-
-			read_time  += read_elpased;
-			think_time += (block_elapsed - read_elpased);
-
-			double read_process_ratio = ((double) read_time / (double) think_time);
+	//
+	// Alloc leftover buffer
+	// Holds the dangling last line of the previous block, it gets copied into the headroom in front of the next
+	// block
+	//
+	parse_context_t context = {0};
+	context.records           = records;
+	context.hash_state        = hash_state;
+	context.file_size         = file_size;
+	context.leftover_capacity = reader_config.block_size;
+	context.leftover_buffer   = (char*) alloc_pages(context.leftover_capacity);
 
-			// printf("\033[2K\r(searched %lf GB, current speed %lf MB/s, overall average %lf MB/s, eta in %.02lfs)", ((double) bytes_parsed / (double) GIGABYTES(1)), mb_per_sec, total_speed, eta_in_sec);
-			printf("\033[2K\r(parsed %lf GB (%.02lf%%), current %lf MB/s, average %lf MB/s, eta in %.00lfs, read/process ratio %.02lf)", gb_parsed, read_precent, mb_per_sec, total_speed, eta_in_sec, read_process_ratio);
+	reader_config.block_headroom = context.leftover_capacity;
 
-			print_time_elapsed = 0;
-			print_bytes_parsed = 0;
-		}
-	} while (bytes_parsed < file_size);
+	// Also initialises the records, min starts at FLT_MAX
+	run_block_reader_passes(file_handle, file_size, reader_config, handle_pass_callback, handle_block_callback, &context, NULL);
 
 	qsort(records, STATION_COUNT, sizeof(record_t), compare_record_t);
 
@@ -317,6 +305,7 @@ main(int argc, const char **argv)
 
 	printf("\n");
 	printf("(took %lf sec @ average of %lf MB/s)\n", total_sec, mb_per_sec);
+	print_roofline_percent(reader_config.roofline_path, mb_per_sec, 1);
 
 	FILE *results_file = fopen(results_path, "wt");
 
@@ -339,10 +328,10 @@ main(int argc, const char **argv)
 		fclose(results_file);
 	}
 
-	CloseHandle(file_handle);
+	close_file(file_handle);
 
-	VirtualFree(buffer_real, 0, MEM_RELEASE);
-	VirtualFree(records, 0 , MEM_RELEASE);
+	free_pages(context.leftover_buffer, context.leftover_capacity);
+	free_pages(records, sizeof(record_t) * STATION_COUNT);
 	XXH64_freeState(hash_state);
 
 	return 0;
@@ -0,0 +1,1247 @@
+//
+// Shared read stage for the block scanning tools. A dedicated I/O thread fills a ring of buffers while the
+// calling thread hands filled blocks to the tool's handler, so reading block k+1 overlaps processing block k.
+//
+// Every buffer has block_headroom bytes reserved in front of it, a handler may write there (e.g. to prepend
+// the dangling line of the previous block) without another copy of the block itself.
+//
+// On Linux regular files are read through io_uring with queue_depth fixed-buffer reads in flight, completions
+// are handed out in file order. When io_uring is unavailable (old kernel, seccomp, pipes) the I/O thread falls
+// back to plain blocking reads.
+//
+// Tools that opt into allow_mmap get a regular file that fits the address space budget mapped whole and handed
+// to the handler as a single block at offset 0, no buffers, no copies and no limit on line length.
+//
+// unbuffered opens the file with O_DIRECT / FILE_FLAG_NO_BUFFERING so scanning a huge archive does not evict
+// everybody else's page cache. Buffers, block size and the final short read are kept sector aligned. drop_cache
+// is the fallback for filesystems that reject O_DIRECT, pages are evicted with DONTNEED right after each read.
+//
+// thread_count > 1 switches run_block_reader_passes to run_parallel_block_reader, which splits the file into
+// contiguous ranges and calls the handler from every thread at once. Only for tools whose per-block work does not
+// depend on the previous block.
+//
+// end_with_empty_block calls the handler once more with an empty block after the last one, for tools that carry
+// a partial line from block to block and need to know when nothing follows. The stat size cannot tell them,
+// a pipe reports 0.
+//
+// cold evicts the whole file before the run so the numbers are disk speed rather than page cache speed, and
+// benchmark runs the tool twice, cold then warm, printing both throughputs side by side.
+//
+
+#define BLOCK_READER_DEFAULT_BUFFER_COUNT (3)
+#define BLOCK_READER_DEFAULT_QUEUE_DEPTH  (4)
+#define BLOCK_READER_MAX_THREADS          (256)
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+	#define BLOCK_READER_DEFAULT_MMAP_BUDGET (GIGABYTES(256ull))
+#else
+	#define BLOCK_READER_DEFAULT_MMAP_BUDGET (MEGABYTES(512ull))
+#endif
+
+// Return false to stop reading early
+typedef bool (*block_handler_t)(u8 *block, size_t block_size, u64 block_offset, void *user_data);
+
+// Called before every pass of run_block_reader_passes to reset the tool's state, only the final pass should print
+typedef void (*block_pass_handler_t)(void *user_data, bool is_final_pass);
+
+typedef struct
+{
+	size_t block_size;
+	size_t block_headroom;
+	u32    buffer_count;
+
+	u32  queue_depth;
+	bool use_sqpoll;
+	bool disable_io_uring;
+
+	bool allow_mmap;
+	bool mmap_populate;
+	u64  mmap_budget;
+
+	// See end_with_empty_block above, run_block_reader only
+	bool end_with_empty_block;
+
+	bool unbuffered;
+	bool drop_cache;
+
+	bool evict_cache;
+	bool benchmark;
+
+	// More than 1 hands blocks to the handler from several threads, see run_parallel_block_reader
+	u32 thread_count;
+
+	// Bytes before this are skipped, block offsets stay relative to the start of the file
+	u64 start_offset;
+
+	// Saved by read_speed_test --roofline, NULL when the tool should not print percent of roofline
+	const char *roofline_path;
+
+	// Label used for the progress line, e.g. "searched". NULL disables progress output
+	const char *progress_label;
+} block_reader_config_t;
+
+typedef struct
+{
+	u64 bytes_parsed;
+
+	u64 read_time;
+	u64 process_time;
+
+	// read() or io_uring_enter() calls issued by the I/O thread
+	u64 syscall_count;
+
+	bool read_failed;
+	bool stopped;
+	bool used_io_uring;
+	bool used_mmap;
+} block_reader_stats_t;
+
+typedef struct
+{
+	u8    *buffer;
+	size_t size;
+	u64    offset;
+	u64    read_time;
+	u32    error_code;
+	bool   is_last;
+
+	// io_uring bookkeeping
+	size_t target_size;
+	u64    read_start;
+	bool   complete;
+} block_slot_t;
+
+typedef struct
+{
+	file_handle_t file;
+	u64 file_size;
+	block_reader_config_t config;
+
+	size_t io_alignment;
+
+	// start_offset rounded down to io_alignment, reads begin here and the consumer trims the difference
+	u64 read_offset;
+
+	u64 syscall_count;
+
+#if defined(PLATFORM_LINUX)
+	uring_t ring;
+	bool fixed_buffers;
+
+	// Reads the ring could not be waited out on, the arena may still be written to
+	bool abandoned_reads;
+#endif
+
+	block_slot_t *slots;
+
+	u8    *arena;
+	size_t arena_size;
+
+	semaphore_t free_slots;
+	semaphore_t full_slots;
+
+	volatile bool stop;
+} block_reader_t;
+
+#define BLOCK_READER_OPTIONS_HELP \
+	"  --block-size=<size>   bytes per read, accepts K/M/G suffixes\n" \
+	"  --queue-depth=<n>     reads kept in flight (io_uring only)\n" \
+	"  --sqpoll              use a kernel submission polling thread (io_uring only)\n" \
+	"  --no-io-uring         always use blocking reads\n" \
+	"  --mmap, --no-mmap     map the whole file instead of streaming it in blocks\n" \
+	"  --mmap-populate       prefault the whole mapping up front\n" \
+	"  --unbuffered          bypass the page cache (O_DIRECT / FILE_FLAG_NO_BUFFERING)\n" \
+	"  --drop-cache          evict pages right after reading them\n" \
+	"  --cold                evict the file from the page cache before reading it\n" \
+	"  --bench               run cold then warm and print both throughputs\n" \
+	"  --roofline=<file>     show throughput as percent of the ceilings saved by read_speed_test --roofline\n" \
+	"  --simd=<level>        force serial, sse2, avx2, avx512 or neon kernels (default: widest supported,\n" \
+	"                        or FILEUTILS_SIMD)\n"
+
+//
+// Parses sizes like 65536, 64K, 5M or 1G
+//
+inline static bool
+parse_size(const char *text, u64 *out)
+{
+	char *end   = NULL;
+	u64   value = strtoull(text, &end, 10);
+
+	if (end == text)
+	{
+		return false;
+	}
+
+	switch (*end)
+	{
+		case 'k': case 'K': value = KILOBYTES(value); ++end; break;
+		case 'm': case 'M': value = MEGABYTES(value); ++end; break;
+		case 'g': case 'G': value = GIGABYTES(value); ++end; break;
+		default: break;
+	}
+
+	if (*end != 0)
+	{
+		return false;
+	}
+
+	*out = value;
+
+	return true;
+}
+
+inline static block_reader_config_t
+default_block_reader_config(size_t block_size, const char *progress_label)
+{
+	block_reader_config_t config = {0};
+	config.block_size     = block_size;
+	config.buffer_count   = BLOCK_READER_DEFAULT_BUFFER_COUNT;
+	config.queue_depth    = BLOCK_READER_DEFAULT_QUEUE_DEPTH;
+	config.mmap_budget    = BLOCK_READER_DEFAULT_MMAP_BUDGET;
+	config.thread_count   = 1;
+	config.progress_label = progress_label;
+
+	return config;
+}
+
+static THREAD_PROC(block_reader_thread)
+{
+	block_reader_t *reader = (block_reader_t *) thread_param;
+
+	u32 buffer_count = reader->config.buffer_count;
+	u64 offset       = reader->read_offset;
+
+	if (offset && !seek_file(reader->file, offset))
+	{
+		wait_semaphore(&reader->free_slots);
+
+		block_slot_t *slot = &reader->slots[0];
+		slot->size       = 0;
+		slot->error_code = get_last_os_error();
+		slot->is_last    = true;
+
+		signal_semaphore(&reader->full_slots);
+
+		return 0;
+	}
+
+	for (u32 index = 0;; index = (index + 1) % buffer_count)
+	{
+		wait_semaphore(&reader->free_slots);
+
+		block_slot_t *slot = &reader->slots[index];
+
+		if (reader->stop)
+		{
+			slot->size       = 0;
+			slot->error_code = 0;
+			slot->is_last    = true;
+
+			signal_semaphore(&reader->full_slots);
+			break;
+		}
+
+		u64 read_start = read_os_timer();
+
+		size_t bytes_read = 0;
+		bool read_status  = read_file(reader->file, slot->buffer, reader->config.block_size, &bytes_read);
+
+		reader->syscall_count += 1;
+
+		slot->read_time  = read_os_timer() - read_start;
+		slot->size       = bytes_read;
+		slot->offset     = offset;
+		slot->error_code = read_status ? 0 : get_last_os_error();
+		slot->is_last    = !read_status || (bytes_read == 0);
+
+		if (reader->config.drop_cache && bytes_read)
+		{
+			drop_file_cache(reader->file, offset, bytes_read);
+		}
+
+		offset += bytes_read;
+
+		signal_semaphore(&reader->full_slots);
+
+		if (slot->is_last)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+#if defined(PLATFORM_LINUX)
+
+inline static bool
+queue_uring_block_read(block_reader_t *reader, u32 index)
+{
+	block_slot_t *slot = &reader->slots[index];
+
+	struct io_uring_sqe *sqe = get_uring_sqe(&reader->ring);
+
+	if (sqe == NULL)
+	{
+		return false;
+	}
+
+	s32 fixed_index = reader->fixed_buffers ? (s32) index : -1;
+
+	// Unbuffered reads must be whole sectors, the kernel stops at EOF and reports the real tail length
+	u64 read_size = align_up(slot->target_size, reader->io_alignment) - slot->size;
+
+	prep_uring_read(sqe, reader->file, slot->buffer + slot->size, (u32) read_size,
+	                slot->offset + slot->size, fixed_index, index);
+
+	return true;
+}
+
+//
+// Keeps up to queue_depth reads in flight, completions may arrive in any order but slots are only published
+// to the consumer once every block before them is complete
+//
+static THREAD_PROC(block_reader_uring_thread)
+{
+	block_reader_t *reader = (block_reader_t *) thread_param;
+
+	u32 buffer_count = reader->config.buffer_count;
+	u32 queue_depth  = reader->config.queue_depth;
+	u64 block_size   = reader->config.block_size;
+	u64 file_size    = reader->file_size;
+	u64 read_offset  = reader->read_offset;
+
+	u64 block_total  = (file_size - read_offset + block_size - 1) / block_size;
+
+	u64 next_submit  = 0;
+	u64 next_publish = 0;
+	u32 in_flight    = 0;
+
+	u32 error_code = 0;
+
+	for (;;)
+	{
+		bool can_submit = !reader->stop && (error_code == 0);
+
+		while (can_submit && in_flight < queue_depth && next_submit < block_total)
+		{
+			// Only block on a free slot when nothing is outstanding, otherwise go reap completions
+			if (in_flight == 0)
+			{
+				wait_semaphore(&reader->free_slots);
+			}
+			else if (!try_wait_semaphore(&reader->free_slots))
+			{
+				break;
+			}
+
+			u32 index          = (u32) (next_submit % buffer_count);
+			block_slot_t *slot = &reader->slots[index];
+
+			slot->offset      = read_offset + next_submit * block_size;
+			slot->size        = 0;
+			slot->target_size = (size_t) MIN(block_size, file_size - slot->offset);
+			slot->error_code  = 0;
+			slot->is_last     = false;
+			slot->complete    = false;
+			slot->read_start  = read_os_timer();
+
+			// Every queued read is submitted before the next batch, a full queue means the ring is broken
+			if (!queue_uring_block_read(reader, index))
+			{
+				signal_semaphore(&reader->free_slots);
+				error_code = EBUSY;
+				break;
+			}
+
+			in_flight   += 1;
+			next_submit += 1;
+		}
+
+		if (in_flight == 0)
+		{
+			break;
+		}
+
+		if (!submit_uring(&reader->ring, 1))
+		{
+			error_code = get_last_os_error();
+			break;
+		}
+
+		struct io_uring_cqe *cqe;
+		while ((cqe = peek_uring_cqe(&reader->ring)) != NULL)
+		{
+			u32 index          = (u32) cqe->user_data;
+			s32 result         = cqe->res;
+			block_slot_t *slot = &reader->slots[index];
+
+			advance_uring_cq(&reader->ring);
+
+			if (result == -EINTR || result == -EAGAIN)
+			{
+				if (queue_uring_block_read(reader, index))
+				{
+					continue;
+				}
+
+				result = -EBUSY;
+			}
+
+			if (result < 0)
+			{
+				error_code     = (u32) -result;
+				slot->complete = true;
+				in_flight     -= 1;
+
+				continue;
+			}
+
+			slot->size += (size_t) result;
+
+			// Short read in the middle of the block, go again for the remainder. Zero means the file shrank
+			if (result > 0 && slot->size < slot->target_size)
+			{
+				if (queue_uring_block_read(reader, index))
+				{
+					continue;
+				}
+
+				error_code     = EBUSY;
+				slot->complete = true;
+				in_flight     -= 1;
+
+				continue;
+			}
+
+			slot->size      = MIN(slot->size, slot->target_size);
+			slot->read_time = read_os_timer() - slot->read_start;
+			slot->complete  = true;
+			in_flight      -= 1;
+
+			if (reader->config.drop_cache && slot->size)
+			{
+				drop_file_cache(reader->file, slot->offset, slot->size);
+			}
+		}
+
+		while (next_publish < next_submit && error_code == 0)
+		{
+			block_slot_t *slot = &reader->slots[next_publish % buffer_count];
+
+			if (!slot->complete)
+			{
+				break;
+			}
+
+			next_publish += 1;
+			signal_semaphore(&reader->full_slots);
+		}
+
+		if (next_publish == block_total)
+		{
+			break;
+		}
+	}
+
+	// The kernel writes into a slot's buffer until its read completes, wait every one out before the buffers can
+	// be released. A wait that keeps failing for anything but a busy ring gives up and leaves the arena leaked
+	while (in_flight)
+	{
+		struct io_uring_cqe *cqe;
+		while ((cqe = peek_uring_cqe(&reader->ring)) != NULL)
+		{
+			advance_uring_cq(&reader->ring);
+			in_flight -= 1;
+		}
+
+		if (in_flight && !submit_uring(&reader->ring, 1))
+		{
+			u32 wait_error = get_last_os_error();
+
+			if (wait_error != EAGAIN && wait_error != EBUSY)
+			{
+				error_code              = error_code ? error_code : wait_error;
+				reader->abandoned_reads = true;
+				break;
+			}
+		}
+	}
+
+	// The end marker goes in the next slot in consumer order, it may already be owned by us
+	if (next_publish == next_submit)
+	{
+		wait_semaphore(&reader->free_slots);
+	}
+
+	block_slot_t *slot = &reader->slots[next_publish % buffer_count];
+	slot->size       = 0;
+	slot->error_code = error_code;
+	slot->is_last    = true;
+
+	signal_semaphore(&reader->full_slots);
+
+	return 0;
+}
+
+#endif
+
+inline static void
+print_block_progress(const char *label, u64 bytes_parsed, u64 file_size,
+                     u64 print_bytes_parsed, u64 print_time_elapsed, u64 total_elapsed,
+                     u64 read_time, u64 process_time, u64 timer_freq)
+{
+	double mb_per_sec  = ((double) print_bytes_parsed / (double) MEGABYTES(1)) / (print_time_elapsed / (double) timer_freq);
+	double total_speed = ((double) bytes_parsed       / (double) MEGABYTES(1)) / (total_elapsed      / (double) timer_freq);
+
+	double eta_in_sec  = (file_size > bytes_parsed) ? ((double) (file_size - bytes_parsed) / (double) MEGABYTES(1)) / mb_per_sec : 0;
+
+	double gb_parsed    = ((double) bytes_parsed / (double) GIGABYTES(1));
+	double read_precent = file_size ? ((double) bytes_parsed / (double) file_size) * 100 : 0;
+
+	double read_process_ratio = process_time ? ((double) read_time / (double) process_time) : 0;
+
+	printf("\033[2K\r(%s %lf GB (%.02lf%%), current %lf MB/s, average %lf MB/s, eta in %.00lfs, read/process ratio %.02lf)", label, gb_parsed, read_precent, mb_per_sec, total_speed, eta_in_sec, read_process_ratio);
+}
+
+inline static void
+print_resident_fraction(const char *label, u64 resident_bytes, u64 file_size)
+{
+	double percent = file_size ? ((double) resident_bytes / (double) file_size) * 100 : 100;
+
+	printf("%s %.01lf%%", label, percent);
+}
+
+static void
+evict_file_from_cache_and_report(const char *path)
+{
+	file_handle_t handle = open_file_for_read(path, 0);
+
+	if (!is_file_handle_valid(handle))
+	{
+		return;
+	}
+
+	u64 file_size = get_file_size(handle);
+	u64 before    = 0;
+	u64 after     = 0;
+
+	bool have_before = get_file_resident_bytes(handle, file_size, &before);
+
+	close_file(handle);
+
+	if (!evict_file_from_cache(path))
+	{
+		fprintf(stderr, "(could not evict %s from the page cache, system code %u)\n", path, get_last_os_error());
+		return;
+	}
+
+	handle = open_file_for_read(path, 0);
+
+	if (!is_file_handle_valid(handle))
+	{
+		return;
+	}
+
+	bool have_after = get_file_resident_bytes(handle, file_size, &after);
+
+	close_file(handle);
+
+	if (have_before && have_after)
+	{
+		printf("(page cache:");
+		print_resident_fraction(" resident", before, file_size);
+		print_resident_fraction(", after eviction", after, file_size);
+		printf(")\n");
+	}
+	else
+	{
+		printf("(page cache: evicted, residency unknown on this platform)\n");
+	}
+}
+
+//
+// Opens path the way config asks for. When the filesystem refuses O_DIRECT (tmpfs, some FUSE and network
+// mounts) we fall back to a buffered handle and evict pages behind the reader instead
+//
+static file_handle_t
+open_file_for_block_reader(const char *path, block_reader_config_t *config)
+{
+	if (config->evict_cache || config->benchmark)
+	{
+		evict_file_from_cache_and_report(path);
+	}
+
+	if (config->unbuffered)
+	{
+		file_handle_t handle = open_file_for_read(path, FILE_OPEN_SEQUENTIAL | FILE_OPEN_UNBUFFERED);
+
+		if (is_file_handle_valid(handle))
+		{
+			return handle;
+		}
+
+		config->unbuffered = false;
+		config->drop_cache = true;
+	}
+
+	return open_file_for_read(path, FILE_OPEN_SEQUENTIAL);
+}
+
+static void
+destroy_block_reader(block_reader_t *reader)
+{
+	destroy_semaphore(&reader->free_slots);
+	destroy_semaphore(&reader->full_slots);
+
+	bool release_arena = true;
+
+#if defined(PLATFORM_LINUX)
+	release_arena = !reader->abandoned_reads;
+#endif
+
+	if (release_arena)
+	{
+		free_pages(reader->arena, reader->arena_size);
+	}
+
+	free_pages(reader->slots, sizeof(block_slot_t) * reader->config.buffer_count);
+
+#if defined(PLATFORM_LINUX)
+	if (reader->ring.fd >= 0)
+	{
+		destroy_uring(&reader->ring);
+	}
+#endif
+}
+
+//
+// Reads file from the start to EOF, calling handler once per block in file order
+//
+static bool
+run_block_reader(file_handle_t file, u64 file_size, block_reader_config_t config,
+                 block_handler_t handler, void *user_data, block_reader_stats_t *stats)
+{
+	block_reader_stats_t local_stats = {0};
+
+	if (stats == NULL)
+	{
+		stats = &local_stats;
+	}
+
+	*stats = local_stats;
+
+	if (config.buffer_count < 2)
+	{
+		config.buffer_count = 2;
+	}
+
+	if (config.start_offset && config.start_offset >= file_size)
+	{
+		return true;
+	}
+
+	// A mapping always goes through the page cache
+	if (config.unbuffered || config.drop_cache)
+	{
+		config.allow_mmap = false;
+	}
+
+	// Pipes and empty files report size 0 and stay on the streaming path
+	if (config.allow_mmap && file_size > 0 && file_size <= config.mmap_budget)
+	{
+		mapped_file_t mapped;
+
+		if (map_file(file, file_size, config.mmap_populate, &mapped))
+		{
+			u64 process_start = read_os_timer();
+
+			bool keep_going = handler(mapped.data + config.start_offset, (size_t) (file_size - config.start_offset), config.start_offset, user_data);
+
+			if (keep_going && config.end_with_empty_block)
+			{
+				handler(mapped.data + file_size, 0, file_size, user_data);
+			}
+
+			stats->process_time = read_os_timer() - process_start;
+			stats->bytes_parsed = file_size - config.start_offset;
+			stats->stopped      = !keep_going;
+			stats->used_mmap    = true;
+
+			unmap_file(&mapped);
+
+			return true;
+		}
+	}
+
+	block_reader_t reader = {0};
+	reader.file         = file;
+	reader.file_size    = file_size;
+	reader.io_alignment = 1;
+
+	if (config.unbuffered)
+	{
+		reader.io_alignment   = get_file_io_alignment(file);
+		config.block_size     = (size_t) align_up(config.block_size, reader.io_alignment);
+		config.block_headroom = (size_t) align_up(config.block_headroom, reader.io_alignment);
+	}
+
+	reader.read_offset = config.start_offset - (config.start_offset % reader.io_alignment);
+
+	thread_proc_t io_proc = block_reader_thread;
+
+#if defined(PLATFORM_LINUX)
+	reader.ring.fd = -1;
+
+	if (!config.disable_io_uring && config.queue_depth > 0 && file_size > 0)
+	{
+		if (init_uring(&reader.ring, config.queue_depth, config.use_sqpoll))
+		{
+			io_proc = block_reader_uring_thread;
+
+			// One slot held by the consumer, one ready to go while queue_depth reads are in flight
+			config.buffer_count = MAX(config.buffer_count, config.queue_depth + 2);
+
+			stats->used_io_uring = true;
+		}
+	}
+#endif
+
+	reader.config = config;
+
+	init_semaphore(&reader.free_slots, config.buffer_count, config.buffer_count);
+	init_semaphore(&reader.full_slots, 0, config.buffer_count);
+
+	size_t slot_stride = config.block_headroom + config.block_size;
+
+	reader.arena_size = slot_stride * config.buffer_count;
+	reader.arena      = (u8 *) alloc_aligned_pages(reader.arena_size, reader.io_alignment);
+	reader.slots      = (block_slot_t *) alloc_pages(sizeof(block_slot_t) * config.buffer_count);
+
+	if (reader.arena == NULL || reader.slots == NULL)
+	{
+		fprintf(stderr, "(fatal: could not allocate read buffers)\n");
+
+		destroy_block_reader(&reader);
+		return false;
+	}
+
+	for (u32 i = 0; i < config.buffer_count; ++i)
+	{
+		reader.slots[i].buffer = reader.arena + (slot_stride * i) + config.block_headroom;
+	}
+
+#if defined(PLATFORM_LINUX)
+	if (stats->used_io_uring)
+	{
+		struct iovec buffers[64];
+
+		if (config.buffer_count <= (sizeof(buffers) / sizeof(buffers[0])))
+		{
+			for (u32 i = 0; i < config.buffer_count; ++i)
+			{
+				buffers[i].iov_base = reader.slots[i].buffer;
+				buffers[i].iov_len  = config.block_size;
+			}
+
+			// Usually fails on RLIMIT_MEMLOCK, plain reads through the ring still work
+			reader.fixed_buffers = register_uring_buffers(&reader.ring, buffers, config.buffer_count);
+		}
+	}
+#endif
+
+	thread_t io_thread;
+	if (!create_thread(&io_thread, io_proc, &reader))
+	{
+		fprintf(stderr, "(fatal: could not start reader thread)\n");
+
+		destroy_block_reader(&reader);
+		return false;
+	}
+
+	u64 timer_freq  = get_os_timer_freq();
+	u64 start_time  = read_os_timer();
+	u64 print_start = start_time;
+
+	u64 print_bytes_parsed = 0;
+
+	// Where the data read so far ends, the end marker slot does not say
+	u64 end_offset = config.start_offset;
+
+	for (u32 index = 0;; index = (index + 1) % config.buffer_count)
+	{
+		wait_semaphore(&reader.full_slots);
+
+		block_slot_t *slot = &reader.slots[index];
+
+		if (slot->is_last)
+		{
+			if (slot->error_code)
+			{
+				fprintf(stderr, "(fatal: could not read from file, system code %u)\n", slot->error_code);
+				stats->read_failed = true;
+			}
+			else if (config.end_with_empty_block)
+			{
+				// The end marker's buffer still has its headroom, the handler may use it as for any block
+				handler(slot->buffer, 0, end_offset, user_data);
+			}
+
+			break;
+		}
+
+		// Only the first block of an unbuffered read from start_offset starts early
+		size_t skip = (slot->offset < config.start_offset) ? (size_t) MIN(config.start_offset - slot->offset, slot->size) : 0;
+
+		u64 process_start = read_os_timer();
+
+		bool keep_going = handler(slot->buffer + skip, slot->size - skip, slot->offset + skip, user_data);
+
+		u64 process_end = read_os_timer();
+
+		end_offset = slot->offset + slot->size;
+
+		stats->read_time    += slot->read_time;
+		stats->process_time += (process_end - process_start);
+		stats->bytes_parsed += slot->size - skip;
+
+		print_bytes_parsed += slot->size - skip;
+
+		if (!keep_going)
+		{
+			reader.stop    = true;
+			stats->stopped = true;
+		}
+
+		signal_semaphore(&reader.free_slots);
+
+		if (config.progress_label && (process_end - print_start) >= (timer_freq / 5))
+		{
+			print_block_progress(config.progress_label, stats->bytes_parsed, file_size - config.start_offset,
+			                     print_bytes_parsed, process_end - print_start, process_end - start_time,
+			                     stats->read_time, stats->process_time, timer_freq);
+
+			print_start        = process_end;
+			print_bytes_parsed = 0;
+		}
+
+		if (!keep_going)
+		{
+			// Drain until the I/O thread has seen the stop flag and posted its final slot
+			for (u32 drain = (index + 1) % config.buffer_count;; drain = (drain + 1) % config.buffer_count)
+			{
+				wait_semaphore(&reader.full_slots);
+
+				bool drained = reader.slots[drain].is_last;
+
+				signal_semaphore(&reader.free_slots);
+
+				if (drained)
+				{
+					break;
+				}
+			}
+
+			break;
+		}
+	}
+
+	join_thread(io_thread);
+
+	stats->syscall_count = reader.syscall_count;
+
+#if defined(PLATFORM_LINUX)
+	if (stats->used_io_uring)
+	{
+		stats->syscall_count = reader.ring.enter_count;
+	}
+#endif
+
+	destroy_block_reader(&reader);
+
+	return !stats->read_failed;
+}
+
+typedef struct
+{
+	file_handle_t file;
+	u8 *mapping;
+
+	u64 range_start;
+	u64 range_end;
+
+	block_reader_config_t *config;
+	size_t io_alignment;
+
+	block_handler_t handler;
+	void *user_data;
+
+	volatile bool *stop;
+
+	u8 *buffer;
+	u64 bytes_parsed;
+	u64 syscall_count;
+	u32 error_code;
+	bool read_failed;
+} parallel_range_t;
+
+static THREAD_PROC(parallel_range_thread)
+{
+	parallel_range_t *range = (parallel_range_t *) thread_param;
+	size_t block_size       = range->config->block_size;
+
+	for (u64 offset = range->range_start; offset < range->range_end && !*range->stop;)
+	{
+		size_t remaining = (size_t) MIN(block_size, range->range_end - offset);
+		size_t size      = remaining;
+		u8 *block        = NULL;
+
+		if (range->mapping)
+		{
+			block = range->mapping + offset;
+		}
+		else
+		{
+			// Round the last read of the range up so unbuffered reads stay aligned, the extra bytes are ignored
+			size_t read_size = (size_t) MIN(block_size, align_up(remaining, range->io_alignment));
+
+			if (!read_file_at(range->file, range->buffer, read_size, offset, &size))
+			{
+				range->error_code  = get_last_os_error();
+				range->read_failed = true;
+				*range->stop       = true;
+
+				break;
+			}
+
+			range->syscall_count += 1;
+
+			if (range->config->drop_cache && size)
+			{
+				drop_file_cache(range->file, offset, size);
+			}
+
+			if (size == 0)
+			{
+				break;
+			}
+
+			size  = MIN(size, remaining);
+			block = range->buffer;
+		}
+
+		size_t skip = (offset < range->config->start_offset) ? (size_t) MIN(range->config->start_offset - offset, size) : 0;
+
+		range->bytes_parsed += size - skip;
+
+		if (!range->handler(block + skip, size - skip, offset + skip, range->user_data))
+		{
+			*range->stop = true;
+		}
+
+		offset += size;
+	}
+
+	return 0;
+}
+
+//
+// Splits the file into config.thread_count contiguous block aligned ranges and reads them in parallel, with
+// pread into a buffer per thread or, with allow_mmap, out of one shared mapping. The handler runs on every
+// thread at once with the same user_data, blocks only arrive in order within a range. No headroom
+//
+static bool
+run_parallel_block_reader(file_handle_t file, u64 file_size, block_reader_config_t config,
+                          block_handler_t handler, void *user_data, block_reader_stats_t *stats)
+{
+	block_reader_stats_t local_stats = {0};
+
+	if (stats == NULL)
+	{
+		stats = &local_stats;
+	}
+
+	*stats = local_stats;
+
+	if (config.start_offset && config.start_offset >= file_size)
+	{
+		return true;
+	}
+
+	u32 thread_count = MIN(MAX(config.thread_count, 1), BLOCK_READER_MAX_THREADS);
+
+	if (config.unbuffered || config.drop_cache)
+	{
+		config.allow_mmap = false;
+	}
+
+	size_t io_alignment = 1;
+
+	if (config.unbuffered)
+	{
+		io_alignment      = get_file_io_alignment(file);
+		config.block_size = (size_t) align_up(config.block_size, io_alignment);
+	}
+
+	mapped_file_t mapped = {0};
+
+	if (config.allow_mmap && file_size > 0 && file_size <= config.mmap_budget)
+	{
+		stats->used_mmap = map_file(file, file_size, config.mmap_populate, &mapped);
+	}
+
+	parallel_range_t ranges[BLOCK_READER_MAX_THREADS] = {0};
+	thread_t threads[BLOCK_READER_MAX_THREADS];
+
+	volatile bool stop = false;
+
+	u64 read_offset = config.start_offset - (config.start_offset % io_alignment);
+	u64 block_count = (file_size - read_offset + config.block_size - 1) / config.block_size;
+	bool ok         = true;
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		parallel_range_t *range = &ranges[i];
+
+		range->file         = file;
+		range->mapping      = mapped.data;
+		range->range_start  = MIN(file_size, read_offset + ((block_count * i) / thread_count) * config.block_size);
+		range->range_end    = MIN(file_size, read_offset + ((block_count * (i + 1)) / thread_count) * config.block_size);
+		range->config       = &config;
+		range->io_alignment = io_alignment;
+		range->handler      = handler;
+		range->user_data    = user_data;
+		range->stop         = &stop;
+
+		if (!range->mapping)
+		{
+			range->buffer = (u8 *) alloc_aligned_pages(config.block_size, MAX(io_alignment, get_page_size()));
+
+			if (range->buffer == NULL)
+			{
+				ok = false;
+			}
+		}
+	}
+
+	if (!ok)
+	{
+		fprintf(stderr, "(fatal: could not allocate read buffers)\n");
+	}
+	else
+	{
+		u64 process_start = read_os_timer();
+
+		u32 started = start_threads(threads, thread_count, parallel_range_thread, ranges, sizeof(parallel_range_t));
+
+		if (started < thread_count)
+		{
+			// The ranges without a thread would go unread, stop the ones already running and fail the run
+			fprintf(stderr, "(fatal: could not start reader thread %u of %u)\n", started + 1, thread_count);
+
+			stop = true;
+			ok   = false;
+		}
+
+		join_threads(threads, started);
+
+		for (u32 i = 0; i < started; ++i)
+		{
+			stats->bytes_parsed  += ranges[i].bytes_parsed;
+			stats->syscall_count += ranges[i].syscall_count;
+
+			if (ranges[i].read_failed)
+			{
+				fprintf(stderr, "(fatal: could not read from file, system code %u)\n", ranges[i].error_code);
+				stats->read_failed = true;
+			}
+		}
+
+		stats->process_time = read_os_timer() - process_start;
+		stats->stopped      = stop && ok && !stats->read_failed;
+	}
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		free_pages(ranges[i].buffer, config.block_size);
+	}
+
+	if (mapped.data)
+	{
+		unmap_file(&mapped);
+	}
+
+	return ok && !stats->read_failed;
+}
+
+//
+// run_block_reader, once normally or twice with config.benchmark. The first benchmark pass runs on the file
+// open_file_for_block_reader just evicted, the second on whatever the first left in the page cache. stats and
+// the tool's state are from the last pass
+//
+static bool
+run_block_reader_passes(file_handle_t file, u64 file_size, block_reader_config_t config,
+                        block_pass_handler_t pass_handler, block_handler_t handler, void *user_data,
+                        block_reader_stats_t *stats)
+{
+	u32 pass_count = config.benchmark ? 2 : 1;
+
+	u64 timer_freq = get_os_timer_freq();
+
+	f64 pass_seconds[2]  = {0};
+	u64 pass_resident[2] = {0};
+	bool have_resident   = true;
+
+	bool ok = true;
+
+	for (u32 pass = 0; ok && pass < pass_count; ++pass)
+	{
+		if (config.benchmark)
+		{
+			have_resident = get_file_resident_bytes(file, file_size, &pass_resident[pass]) && have_resident;
+		}
+
+		if (pass_handler)
+		{
+			pass_handler(user_data, pass == pass_count - 1);
+		}
+
+		u64 pass_start = read_os_timer();
+
+		if (config.thread_count > 1)
+		{
+			ok = run_parallel_block_reader(file, file_size, config, handler, user_data, stats);
+		}
+		else
+		{
+			ok = run_block_reader(file, file_size, config, handler, user_data, stats);
+		}
+
+		pass_seconds[pass] = (f64) (read_os_timer() - pass_start) / (f64) timer_freq;
+
+		if (config.progress_label && pass + 1 < pass_count)
+		{
+			printf("\n");
+		}
+	}
+
+	if (config.benchmark && ok)
+	{
+		double file_size_in_mb = (double) file_size / MEGABYTES(1);
+
+		printf("(cold %lf sec @ %lf MB/s", pass_seconds[0], file_size_in_mb / pass_seconds[0]);
+
+		if (have_resident)
+		{
+			print_resident_fraction(",", pass_resident[0], file_size);
+			printf(" resident");
+		}
+
+		printf(" | warm %lf sec @ %lf MB/s", pass_seconds[1], file_size_in_mb / pass_seconds[1]);
+
+		if (have_resident)
+		{
+			print_resident_fraction(",", pass_resident[1], file_size);
+			printf(" resident");
+		}
+
+		printf(")\n");
+	}
+
+	return ok;
+}
+
+//
+// Pulls the shared reader options out of argv so the tools only see their own arguments, returns the new argc.
+// Exits on a malformed option.
+//
+static int
+strip_block_reader_options(int argc, const char **argv, block_reader_config_t *config)
+{
+	int out                = 1;
+	const char *simd_level = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		u64 value       = 0;
+
+		if (strncmp(arg, "--block-size=", 13) == 0)
+		{
+			if (!parse_size(arg + 13, &value) || value == 0 || value > GIGABYTES(1))
+			{
+				fprintf(stderr, "(fatal: invalid block size %s)\n", arg + 13);
+				exit(1);
+			}
+
+			config->block_size = (size_t) value;
+		}
+		else if (strncmp(arg, "--queue-depth=", 14) == 0)
+		{
+			if (!parse_size(arg + 14, &value) || value > 4096)
+			{
+				fprintf(stderr, "(fatal: invalid queue depth %s)\n", arg + 14);
+				exit(1);
+			}
+
+			config->queue_depth = (u32) value;
+		}
+		else if (strcmp(arg, "--sqpoll") == 0)
+		{
+			config->use_sqpoll = true;
+		}
+		else if (strcmp(arg, "--no-io-uring") == 0)
+		{
+			config->disable_io_uring = true;
+		}
+		else if (strcmp(arg, "--mmap") == 0)
+		{
+			config->allow_mmap = true;
+		}
+		else if (strcmp(arg, "--no-mmap") == 0)
+		{
+			config->allow_mmap = false;
+		}
+		else if (strcmp(arg, "--mmap-populate") == 0)
+		{
+			config->allow_mmap    = true;
+			config->mmap_populate = true;
+		}
+		else if (strcmp(arg, "--unbuffered") == 0)
+		{
+			config->unbuffered = true;
+		}
+		else if (strcmp(arg, "--drop-cache") == 0)
+		{
+			config->drop_cache = true;
+		}
+		else if (strcmp(arg, "--cold") == 0)
+		{
+			config->evict_cache = true;
+		}
+		else if (strcmp(arg, "--bench") == 0)
+		{
+			config->benchmark = true;
+		}
+		else if (strncmp(arg, "--roofline=", 11) == 0)
+		{
+			config->roofline_path = arg + 11;
+		}
+		else if (strncmp(arg, "--simd=", 7) == 0)
+		{
+			simd_level = arg + 7;
+		}
+		else
+		{
+			argv[out++] = arg;
+		}
+	}
+
+	// Every tool strips its options first, so this is where the kernel table gets filled
+	if (!init_simd_dispatch(simd_level))
+	{
+		exit(1);
+	}
+
+	return out;
+}
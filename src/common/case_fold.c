@@ -0,0 +1,275 @@
+//
+// ASCII case-insensitive substring search. The needle is lowered once up front and the haystack never is:
+// candidates come from comparing the first and last needle bytes against haystack bytes with 0x20 OR'ed in
+// (for a letter c, b | 0x20 == c holds exactly for c and its upper case), and only candidates get a full
+// compare that folds A..Z on the fly. Bytes outside A..Z, UTF-8 included, compare exactly.
+//
+
+inline static u8
+fold_ascii_case(u8 byte)
+{
+	return byte + (((u8) (byte - 'A') < 26) << 5);
+}
+
+inline static bool
+is_ascii_letter(u8 byte)
+{
+	return (u8) ((byte | 0x20) - 'a') < 26;
+}
+
+// Needle in place, for the kernels below
+inline static void
+lower_ascii_case(char *text, size_t length)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		text[i] = (char) fold_ascii_case((u8) text[i]);
+	}
+}
+
+inline static bool
+equal_ascii_case_serial(u8 const *text, u8 const *lower, size_t length)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		if (fold_ascii_case(text[i]) != lower[i])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static sz_cptr_t
+find_ascii_case_serial(sz_cptr_t haystack, sz_size_t length, sz_cptr_t needle, sz_size_t needle_length)
+{
+	u8 const *text  = (u8 const *) haystack;
+	u8 const *lower = (u8 const *) needle;
+
+	if (needle_length == 0 || length < needle_length)
+	{
+		return NULL;
+	}
+
+	u8 first = lower[0];
+	u8 last  = lower[needle_length - 1];
+
+	for (size_t i = 0; i + needle_length <= length; ++i)
+	{
+		if (fold_ascii_case(text[i]) == first && fold_ascii_case(text[i + needle_length - 1]) == last &&
+		    equal_ascii_case_serial(text + i, lower, needle_length))
+		{
+			return haystack + i;
+		}
+	}
+
+	return NULL;
+}
+
+#if defined(ARCH_X64)
+
+inline static bool
+equal_ascii_case_sse2(u8 const *text, u8 const *lower, size_t length)
+{
+	__m128i upper_a = _mm_set1_epi8('A');
+	__m128i z_range = _mm_set1_epi8(25);
+	__m128i case_on = _mm_set1_epi8(0x20);
+
+	size_t i = 0;
+
+	for (; i + 16 <= length; i += 16)
+	{
+		__m128i bytes    = _mm_loadu_si128((__m128i const *) (text + i));
+		__m128i offset   = _mm_sub_epi8(bytes, upper_a);
+		__m128i is_upper = _mm_cmpeq_epi8(_mm_min_epu8(offset, z_range), offset);
+		__m128i folded   = _mm_add_epi8(bytes, _mm_and_si128(is_upper, case_on));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(folded, _mm_loadu_si128((__m128i const *) (lower + i)))) != 0xFFFF)
+		{
+			return false;
+		}
+	}
+
+	return equal_ascii_case_serial(text + i, lower + i, length - i);
+}
+
+static sz_cptr_t
+find_ascii_case_sse2(sz_cptr_t haystack, sz_size_t length, sz_cptr_t needle, sz_size_t needle_length)
+{
+	u8 const *text  = (u8 const *) haystack;
+	u8 const *lower = (u8 const *) needle;
+
+	if (needle_length == 0 || length < needle_length)
+	{
+		return NULL;
+	}
+
+	__m128i first      = _mm_set1_epi8((char) lower[0]);
+	__m128i last       = _mm_set1_epi8((char) lower[needle_length - 1]);
+	__m128i first_fold = _mm_set1_epi8(is_ascii_letter(lower[0]) ? 0x20 : 0);
+	__m128i last_fold  = _mm_set1_epi8(is_ascii_letter(lower[needle_length - 1]) ? 0x20 : 0);
+
+	size_t i = 0;
+
+	for (; i + needle_length - 1 + 16 <= length; i += 16)
+	{
+		__m128i head = _mm_or_si128(_mm_loadu_si128((__m128i const *) (text + i)), first_fold);
+		__m128i tail = _mm_or_si128(_mm_loadu_si128((__m128i const *) (text + i + needle_length - 1)), last_fold);
+
+		u32 candidates = (u32) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+
+		while (candidates)
+		{
+			size_t at = i + sz_u64_ctz(candidates);
+
+			if (equal_ascii_case_sse2(text + at, lower, needle_length))
+			{
+				return haystack + at;
+			}
+
+			candidates &= candidates - 1;
+		}
+	}
+
+	return find_ascii_case_serial(haystack + i, length - i, needle, needle_length);
+}
+
+TARGET_AVX2 inline static bool
+equal_ascii_case_avx2(u8 const *text, u8 const *lower, size_t length)
+{
+	__m256i upper_a = _mm256_set1_epi8('A');
+	__m256i z_range = _mm256_set1_epi8(25);
+	__m256i case_on = _mm256_set1_epi8(0x20);
+
+	size_t i = 0;
+
+	for (; i + 32 <= length; i += 32)
+	{
+		__m256i bytes    = _mm256_loadu_si256((__m256i const *) (text + i));
+		__m256i offset   = _mm256_sub_epi8(bytes, upper_a);
+		__m256i is_upper = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, z_range), offset);
+		__m256i folded   = _mm256_add_epi8(bytes, _mm256_and_si256(is_upper, case_on));
+
+		if ((u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(folded, _mm256_loadu_si256((__m256i const *) (lower + i)))) != 0xFFFFFFFFu)
+		{
+			return false;
+		}
+	}
+
+	return equal_ascii_case_serial(text + i, lower + i, length - i);
+}
+
+TARGET_AVX2 static sz_cptr_t
+find_ascii_case_avx2(sz_cptr_t haystack, sz_size_t length, sz_cptr_t needle, sz_size_t needle_length)
+{
+	u8 const *text  = (u8 const *) haystack;
+	u8 const *lower = (u8 const *) needle;
+
+	if (needle_length == 0 || length < needle_length)
+	{
+		return NULL;
+	}
+
+	__m256i first      = _mm256_set1_epi8((char) lower[0]);
+	__m256i last       = _mm256_set1_epi8((char) lower[needle_length - 1]);
+	__m256i first_fold = _mm256_set1_epi8(is_ascii_letter(lower[0]) ? 0x20 : 0);
+	__m256i last_fold  = _mm256_set1_epi8(is_ascii_letter(lower[needle_length - 1]) ? 0x20 : 0);
+
+	size_t i = 0;
+
+	for (; i + needle_length - 1 + 32 <= length; i += 32)
+	{
+		__m256i head = _mm256_or_si256(_mm256_loadu_si256((__m256i const *) (text + i)), first_fold);
+		__m256i tail = _mm256_or_si256(_mm256_loadu_si256((__m256i const *) (text + i + needle_length - 1)), last_fold);
+
+		u32 candidates = (u32) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(head, first), _mm256_cmpeq_epi8(tail, last)));
+
+		while (candidates)
+		{
+			size_t at = i + sz_u64_ctz(candidates);
+
+			if (equal_ascii_case_avx2(text + at, lower, needle_length))
+			{
+				return haystack + at;
+			}
+
+			candidates &= candidates - 1;
+		}
+	}
+
+	return find_ascii_case_serial(haystack + i, length - i, needle, needle_length);
+}
+
+TARGET_AVX512BW inline static bool
+equal_ascii_case_avx512(u8 const *text, u8 const *lower, size_t length)
+{
+	__m512i upper_a = _mm512_set1_epi8('A');
+	__m512i z_range = _mm512_set1_epi8(25);
+	__m512i case_on = _mm512_set1_epi8(0x20);
+
+	for (size_t i = 0; i < length; i += 64)
+	{
+		u32 count       = (u32) MIN(length - i, 64);
+		__mmask64 valid = (count == 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << count) - 1);
+
+		__m512i bytes     = _mm512_maskz_loadu_epi8(valid, text + i);
+		__mmask64 upper   = _mm512_cmple_epu8_mask(_mm512_sub_epi8(bytes, upper_a), z_range);
+		__m512i folded    = _mm512_mask_add_epi8(bytes, upper, bytes, case_on);
+		__m512i expected  = _mm512_maskz_loadu_epi8(valid, lower + i);
+
+		if (_mm512_cmpneq_epi8_mask(folded, expected))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+TARGET_AVX512BW static sz_cptr_t
+find_ascii_case_avx512(sz_cptr_t haystack, sz_size_t length, sz_cptr_t needle, sz_size_t needle_length)
+{
+	u8 const *text  = (u8 const *) haystack;
+	u8 const *lower = (u8 const *) needle;
+
+	if (needle_length == 0 || length < needle_length)
+	{
+		return NULL;
+	}
+
+	__m512i first      = _mm512_set1_epi8((char) lower[0]);
+	__m512i last       = _mm512_set1_epi8((char) lower[needle_length - 1]);
+	__m512i first_fold = _mm512_set1_epi8(is_ascii_letter(lower[0]) ? 0x20 : 0);
+	__m512i last_fold  = _mm512_set1_epi8(is_ascii_letter(lower[needle_length - 1]) ? 0x20 : 0);
+
+	// Candidate starts, the last needle_length - 1 bytes of the haystack cannot start a match
+	size_t starts = length - needle_length + 1;
+
+	for (size_t i = 0; i < starts; i += 64)
+	{
+		u32 count       = (u32) MIN(starts - i, 64);
+		__mmask64 valid = (count == 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << count) - 1);
+
+		__m512i head = _mm512_or_si512(_mm512_maskz_loadu_epi8(valid, text + i), first_fold);
+		__m512i tail = _mm512_or_si512(_mm512_maskz_loadu_epi8(valid, text + i + needle_length - 1), last_fold);
+
+		u64 candidates = _mm512_mask_cmpeq_epi8_mask(_mm512_mask_cmpeq_epi8_mask(valid, head, first), tail, last);
+
+		while (candidates)
+		{
+			size_t at = i + sz_u64_ctz(candidates);
+
+			if (equal_ascii_case_avx512(text + at, lower, needle_length))
+			{
+				return haystack + at;
+			}
+
+			candidates &= candidates - 1;
+		}
+	}
+
+	return NULL;
+}
+
+#endif
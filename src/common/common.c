@@ -1,8 +1,56 @@
-#include <Windows.h>
+#if defined(_WIN32)
+	#define PLATFORM_WIN32 (1)
+#elif defined(__linux__)
+	#define PLATFORM_LINUX (1)
+	#if !defined(_GNU_SOURCE)
+		#define _GNU_SOURCE
+	#endif
+#else
+	#error "unsupported platform"
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+	#define ARCH_X64 (1)
+#elif defined(__aarch64__) || defined(_M_ARM64)
+	#define ARCH_ARM64 (1)
+#else
+	#error "unsupported architecture"
+#endif
+
+#if defined(PLATFORM_WIN32)
+	#include <Windows.h>
+	#include <intrin.h>
+	#include <psapi.h>
+#elif defined(PLATFORM_LINUX)
+	#include <dirent.h>
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <pthread.h>
+	#include <semaphore.h>
+	#include <time.h>
+	#include <unistd.h>
+	#include <linux/io_uring.h>
+	#include <sys/mman.h>
+	#include <sys/resource.h>
+	#include <sys/stat.h>
+	#include <sys/syscall.h>
+	#include <sys/uio.h>
+#endif
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
-#include <immintrin.h>
+
+#if defined(ARCH_X64)
+	#include <immintrin.h>
+	#if !defined(_MSC_VER)
+		#include <cpuid.h>
+	#endif
+#elif defined(ARCH_ARM64)
+	#include <arm_neon.h>
+#endif
 
 #define KILOBYTES(v) ((v) * 1024)
 #define MEGABYTES(v) (KILOBYTES(v) * 1024)
@@ -24,16 +72,42 @@ typedef int64_t s64;
 typedef float  f32;
 typedef double f64;
 
-#define SZ_USE_X86_AVX2 (1)
+// Compile every StringZilla backend for the architecture, common/simd.c picks one per host at startup. The
+// wider backends carry their own target pragmas, so the build itself does not need -mavx2 or /arch:AVX2
+#if defined(ARCH_X64)
+	#define SZ_USE_X86_AVX2   (1)
+	#define SZ_USE_X86_AVX512 (1)
+	#define SZ_USE_ARM_NEON   (0)
+#else
+	#define SZ_USE_X86_AVX2   (0)
+	#define SZ_USE_X86_AVX512 (0)
+	#define SZ_USE_ARM_NEON   (1)
+#endif
 
-#pragma warning(push)
-#pragma warning(disable: 4068)
-#pragma warning(disable: 4146)
+#if defined(_MSC_VER)
+	#pragma warning(push)
+	#pragma warning(disable: 4068)
+	#pragma warning(disable: 4146)
+#endif
 #include "common/stringzilla.h"
-#pragma warning(pop)
+#if defined(_MSC_VER)
+	#pragma warning(pop)
+#endif
 
+#include "common/cpu.c"
 #include "common/memory.c"
+#include "common/hash.c"
+#include "common/text_stats.c"
+#include "common/line_stats.c"
+#include "common/case_fold.c"
+#include "common/simd.c"
+#include "common/multi_pattern.c"
+#include "common/line_set.c"
+#include "common/regex.c"
 #include "common/timer.c"
 #include "common/file.c"
-#include "common/hash.c"
-
+#include "common/thread.c"
+#include "common/uring.c"
+#include "common/block_reader.c"
+#include "common/roofline.c"
+#include "common/line_index.c"
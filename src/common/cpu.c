@@ -0,0 +1,140 @@
+//
+// CPU feature detection for kernels picked at runtime. Kernels compiled for a wider ISA than the baseline are
+// tagged with TARGET_POPCNT / TARGET_AVX2 / TARGET_AVX512BW so one binary carries every variant and only calls
+// the ones the host (and the OS, for the wider register state) supports.
+//
+
+#define CPU_FEATURE_SSE2     (1 << 0)
+#define CPU_FEATURE_POPCNT   (1 << 1)
+#define CPU_FEATURE_AVX2     (1 << 2)
+#define CPU_FEATURE_BMI2     (1 << 3)
+#define CPU_FEATURE_AVX512BW (1 << 4)
+#define CPU_FEATURE_AVX512VL (1 << 5)
+#define CPU_FEATURE_NEON     (1 << 6)
+
+#if defined(_MSC_VER)
+	// MSVC lets any function use any intrinsic
+	#define TARGET_POPCNT
+	#define TARGET_AVX2
+	#define TARGET_AVX512BW
+#else
+	#define TARGET_POPCNT   __attribute__((target("popcnt")))
+	#define TARGET_AVX2     __attribute__((target("avx2,popcnt")))
+	#define TARGET_AVX512BW __attribute__((target("avx512f,avx512bw,popcnt")))
+#endif
+
+#if defined(ARCH_X64)
+
+inline static void
+read_cpuid(u32 leaf, u32 subleaf, u32 registers[4])
+{
+#if defined(_MSC_VER)
+	__cpuidex((int *) registers, (int) leaf, (int) subleaf);
+#else
+	__cpuid_count(leaf, subleaf, registers[0], registers[1], registers[2], registers[3]);
+#endif
+}
+
+// Which register files the OS saves on a context switch, only valid when OSXSAVE is set
+inline static u64
+read_xcr0()
+{
+#if defined(_MSC_VER)
+	return _xgetbv(0);
+#else
+	u32 low, high;
+	__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+
+	return ((u64) high << 32) | low;
+#endif
+}
+
+inline static u32
+detect_cpu_features()
+{
+	u32 registers[4];
+	u32 features = 0;
+
+	read_cpuid(0, 0, registers);
+	u32 max_leaf = registers[0];
+
+	read_cpuid(1, 0, registers);
+
+	if (registers[3] & (1u << 26))
+	{
+		features |= CPU_FEATURE_SSE2;
+	}
+
+	if (registers[2] & (1u << 23))
+	{
+		features |= CPU_FEATURE_POPCNT;
+	}
+
+	bool os_saves_ymm = false;
+	bool os_saves_zmm = false;
+
+	if ((registers[2] & (1u << 27)) && (registers[2] & (1u << 28)))
+	{
+		u64 xcr0 = read_xcr0();
+
+		// SSE + AVX state, then also opmask and both halves of the upper ZMM registers
+		os_saves_ymm = (xcr0 & 0x06) == 0x06;
+		os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+	}
+
+	if (max_leaf >= 7)
+	{
+		read_cpuid(7, 0, registers);
+
+		u32 ebx = registers[1];
+
+		if (os_saves_ymm && (ebx & (1u << 5)))
+		{
+			features |= CPU_FEATURE_AVX2;
+		}
+
+		// BMI1 and BMI2, StringZilla's AVX-512 code uses both
+		if ((ebx & (1u << 3)) && (ebx & (1u << 8)))
+		{
+			features |= CPU_FEATURE_BMI2;
+		}
+
+		if (os_saves_zmm && (ebx & (1u << 16)) && (ebx & (1u << 30)))
+		{
+			features |= CPU_FEATURE_AVX512BW;
+		}
+
+		if (os_saves_zmm && (ebx & (1u << 31)))
+		{
+			features |= CPU_FEATURE_AVX512VL;
+		}
+	}
+
+	return features;
+}
+
+#elif defined(ARCH_ARM64)
+
+// Advanced SIMD is part of the ARMv8-A baseline
+inline static u32
+detect_cpu_features()
+{
+	return CPU_FEATURE_NEON;
+}
+
+#endif
+
+inline static u32
+get_cpu_features()
+{
+	static u32 features = 0;
+	static bool detected = false;
+
+	if (!detected)
+	{
+		features = detect_cpu_features();
+		detected = true;
+	}
+
+	return features;
+}
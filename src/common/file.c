@@ -1,5 +1,81 @@
+//
+// Thin per-platform file layer. Everything here is inline static and chosen at compile time, so the
+// per-block read calls cost the same as calling the OS directly.
+//
+
+#define FILE_OPEN_SEQUENTIAL (1 << 0)
+
+// Bypass the page cache. Reads then need sector aligned buffers, offsets and sizes, see get_file_io_alignment
+#define FILE_OPEN_UNBUFFERED (1 << 1)
+
+#define DEFAULT_IO_ALIGNMENT (4096)
+
+// Tells whether a path still names the same file, e.g. a log that was rotated away has a new id
+typedef struct
+{
+	u64 device;
+	u64 id;
+	u64 modified_time;
+} file_identity_t;
+
+#if defined(PLATFORM_WIN32)
+
+#define MAX_PATH_LENGTH (MAX_PATH)
+#define PATH_SEPARATOR  ('\\')
+
+typedef HANDLE file_handle_t;
+
+#define INVALID_FILE_HANDLE (INVALID_HANDLE_VALUE)
+
+typedef struct
+{
+	const char *name;
+	bool is_directory;
+
+	// Plain files (or links to them), not devices or pipes that could block a read
+	bool is_regular;
+} dir_entry_t;
+
+typedef struct
+{
+	u8 *data;
+	u64 size;
+	HANDLE mapping;
+} mapped_file_t;
+
+typedef struct
+{
+	HANDLE find;
+	WIN32_FIND_DATAA find_data;
+	bool has_pending;
+} dir_iter_t;
+
+inline static file_handle_t
+open_file_for_read(const char *path, u32 flags)
+{
+	DWORD attributes = FILE_ATTRIBUTE_NORMAL;
+
+	if (flags & FILE_OPEN_SEQUENTIAL)
+	{
+		attributes |= FILE_FLAG_SEQUENTIAL_SCAN;
+	}
+
+	if (flags & FILE_OPEN_UNBUFFERED)
+	{
+		attributes |= FILE_FLAG_NO_BUFFERING;
+	}
+
+	return CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, attributes, NULL);
+}
+
+inline static void
+close_file(file_handle_t handle)
+{
+	CloseHandle(handle);
+}
+
 inline static u64
-get_file_size(HANDLE handle)
+get_file_size(file_handle_t handle)
 {
 	DWORD file_size_upper_bits = 0;
 	DWORD file_size_lower_bits = GetFileSize(handle, &file_size_upper_bits);
@@ -8,3 +84,579 @@ get_file_size(HANDLE handle)
 
 	return file_size;
 }
+
+// Volume serial plus file index, modified time in FILETIME ticks
+inline static bool
+get_file_identity(file_handle_t handle, file_identity_t *identity)
+{
+	BY_HANDLE_FILE_INFORMATION info;
+
+	if (!GetFileInformationByHandle(handle, &info))
+	{
+		return false;
+	}
+
+	identity->device        = info.dwVolumeSerialNumber;
+	identity->id            = ((u64) info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	identity->modified_time = ((u64) info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+
+	return true;
+}
+
+// Moves the position read_file continues from
+inline static bool
+seek_file(file_handle_t handle, u64 offset)
+{
+	LARGE_INTEGER position;
+	position.QuadPart = (LONGLONG) offset;
+
+	return SetFilePointerEx(handle, position, NULL, FILE_BEGIN) != 0;
+}
+
+// 4K covers both 512e and 4Kn drives, querying FileStorageInfo is not worth it for a read-only scan
+inline static size_t
+get_file_io_alignment(file_handle_t handle)
+{
+	(void) handle;
+
+	return DEFAULT_IO_ALIGNMENT;
+}
+
+// Unbuffered handles never touch the cache on Win32
+inline static void
+drop_file_cache(file_handle_t handle, u64 offset, u64 length)
+{
+	(void) handle;
+	(void) offset;
+	(void) length;
+}
+
+//
+// Opening a file unbuffered makes the cache manager flush and purge its cached pages, provided nobody else
+// holds it open. There is no cheap way to ask what is resident, so get_file_resident_bytes reports failure
+//
+inline static bool
+evict_file_from_cache(const char *path)
+{
+	HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, NULL);
+
+	if (handle == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	CloseHandle(handle);
+
+	return true;
+}
+
+inline static bool
+get_file_resident_bytes(file_handle_t handle, u64 size, u64 *resident_bytes)
+{
+	(void) handle;
+	(void) size;
+
+	*resident_bytes = 0;
+
+	return false;
+}
+
+// https://learn.microsoft.com/en-us/windows/win32/debug/system-error-codes
+inline static u32
+get_last_os_error()
+{
+	return GetLastError();
+}
+
+inline static bool
+read_file(file_handle_t handle, void *buffer, size_t size, size_t *bytes_read)
+{
+	DWORD read = 0;
+	BOOL status = ReadFile(handle, buffer, (DWORD) size, &read, NULL);
+
+	*bytes_read = read;
+
+	return status != 0;
+}
+
+inline static bool
+read_file_at(file_handle_t handle, void *buffer, size_t size, u64 offset, size_t *bytes_read)
+{
+	OVERLAPPED overlapped = {0};
+	overlapped.Offset     = (DWORD) (offset & 0xFFFFFFFF);
+	overlapped.OffsetHigh = (DWORD) (offset >> 32);
+
+	DWORD read = 0;
+	BOOL status = ReadFile(handle, buffer, (DWORD) size, &read, &overlapped);
+
+	*bytes_read = read;
+
+	if (!status && GetLastError() == ERROR_HANDLE_EOF)
+	{
+		return true;
+	}
+
+	return status != 0;
+}
+
+//
+// Maps the whole file read-only. populate is a hint, Win32 has no cheap equivalent of MAP_POPULATE
+//
+inline static bool
+map_file(file_handle_t handle, u64 size, bool populate, mapped_file_t *mapped)
+{
+	(void) populate;
+
+	mapped->data    = NULL;
+	mapped->size    = size;
+	mapped->mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+
+	if (mapped->mapping == NULL)
+	{
+		return false;
+	}
+
+	mapped->data = (u8 *) MapViewOfFile(mapped->mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if (mapped->data == NULL)
+	{
+		CloseHandle(mapped->mapping);
+		return false;
+	}
+
+	return true;
+}
+
+inline static void
+unmap_file(mapped_file_t *mapped)
+{
+	UnmapViewOfFile(mapped->data);
+	CloseHandle(mapped->mapping);
+}
+
+inline static bool
+open_dir(const char *path, dir_iter_t *iter)
+{
+	char pattern[MAX_PATH_LENGTH + 1];
+	int length = snprintf(pattern, sizeof(pattern), "%s\\*", path);
+
+	if (length < 0 || length >= (int) sizeof(pattern))
+	{
+		return false;
+	}
+
+	iter->find        = FindFirstFileA(pattern, &iter->find_data);
+	iter->has_pending = (iter->find != INVALID_HANDLE_VALUE);
+
+	return iter->has_pending;
+}
+
+inline static bool
+next_dir_entry(dir_iter_t *iter, dir_entry_t *entry)
+{
+	for (;;)
+	{
+		if (!iter->has_pending)
+		{
+			if (FindNextFileA(iter->find, &iter->find_data) == 0)
+			{
+				return false;
+			}
+		}
+
+		iter->has_pending = false;
+
+		const char *name = iter->find_data.cFileName;
+
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		{
+			continue;
+		}
+
+		DWORD attributes = iter->find_data.dwFileAttributes;
+
+		entry->name         = name;
+		entry->is_directory = (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		entry->is_regular   = (attributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) == 0;
+
+		return true;
+	}
+}
+
+inline static void
+close_dir(dir_iter_t *iter)
+{
+	FindClose(iter->find);
+}
+
+#elif defined(PLATFORM_LINUX)
+
+#define MAX_PATH_LENGTH (4096)
+#define PATH_SEPARATOR  ('/')
+
+typedef int file_handle_t;
+
+#define INVALID_FILE_HANDLE (-1)
+
+#define DIR_BUFFER_SIZE (KILOBYTES(32))
+
+typedef struct
+{
+	const char *name;
+	bool is_directory;
+
+	// Plain files (or links to them), not devices or pipes that could block a read
+	bool is_regular;
+} dir_entry_t;
+
+typedef struct
+{
+	u8 *data;
+	u64 size;
+} mapped_file_t;
+
+typedef struct
+{
+	int fd;
+
+	size_t buffer_pos;
+	size_t buffer_used;
+
+	u8 buffer[DIR_BUFFER_SIZE];
+} dir_iter_t;
+
+// Layout returned by getdents64, glibc does not expose it
+typedef struct
+{
+	u64 d_ino;
+	s64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+} linux_dirent64_t;
+
+inline static file_handle_t
+open_file_for_read(const char *path, u32 flags)
+{
+	int open_flags = O_RDONLY | O_CLOEXEC;
+
+	if (flags & FILE_OPEN_UNBUFFERED)
+	{
+		open_flags |= O_DIRECT;
+	}
+
+	int fd = open(path, open_flags);
+
+	if (fd >= 0 && (flags & FILE_OPEN_SEQUENTIAL))
+	{
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	return fd;
+}
+
+inline static void
+close_file(file_handle_t handle)
+{
+	close(handle);
+}
+
+inline static u64
+get_file_size(file_handle_t handle)
+{
+	struct stat info;
+
+	if (fstat(handle, &info) != 0)
+	{
+		return 0;
+	}
+
+	return (u64) info.st_size;
+}
+
+// Device and inode, modified time in nanoseconds
+inline static bool
+get_file_identity(file_handle_t handle, file_identity_t *identity)
+{
+	struct stat info;
+
+	if (fstat(handle, &info) != 0)
+	{
+		return false;
+	}
+
+	identity->device        = (u64) info.st_dev;
+	identity->id            = (u64) info.st_ino;
+	identity->modified_time = (u64) info.st_mtim.tv_sec * 1000000000ull + (u64) info.st_mtim.tv_nsec;
+
+	return true;
+}
+
+// Moves the position read_file continues from
+inline static bool
+seek_file(file_handle_t handle, u64 offset)
+{
+	return lseek(handle, (off_t) offset, SEEK_SET) == (off_t) offset;
+}
+
+inline static size_t
+get_file_io_alignment(file_handle_t handle)
+{
+#if defined(STATX_DIOALIGN)
+	struct statx info;
+
+	if (statx(handle, "", AT_EMPTY_PATH, STATX_DIOALIGN, &info) == 0 && (info.stx_mask & STATX_DIOALIGN))
+	{
+		size_t alignment = MAX(info.stx_dio_mem_align, info.stx_dio_offset_align);
+
+		if (alignment)
+		{
+			return alignment;
+		}
+	}
+#else
+	(void) handle;
+#endif
+
+	return DEFAULT_IO_ALIGNMENT;
+}
+
+// Evicts a range we are done with from the page cache, for filesystems that refuse O_DIRECT
+inline static void
+drop_file_cache(file_handle_t handle, u64 offset, u64 length)
+{
+	posix_fadvise(handle, (off_t) offset, (off_t) length, POSIX_FADV_DONTNEED);
+}
+
+// Drops every clean cached page of the file, the whole-file version of drop_file_cache
+inline static bool
+evict_file_from_cache(const char *path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	bool evicted = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	close(fd);
+
+	return evicted;
+}
+
+//
+// Bytes of the file currently in the page cache, what fincore reports. Walks the file through mincore in
+// 1 GB windows so the residency vector stays small
+//
+inline static bool
+get_file_resident_bytes(file_handle_t handle, u64 size, u64 *resident_bytes)
+{
+	*resident_bytes = 0;
+
+	size_t page_size = get_page_size();
+	u64 window_size  = GIGABYTES(1ull);
+
+	size_t vector_size     = (size_t) (window_size / page_size);
+	unsigned char *vector  = (unsigned char *) alloc_pages(vector_size);
+
+	bool ok = (vector != NULL);
+
+	for (u64 offset = 0; ok && offset < size; offset += window_size)
+	{
+		size_t length = (size_t) MIN(window_size, size - offset);
+		void *data    = mmap(NULL, length, PROT_READ, MAP_SHARED, handle, (off_t) offset);
+
+		if (data == MAP_FAILED)
+		{
+			ok = false;
+			break;
+		}
+
+		if (mincore(data, length, vector) == 0)
+		{
+			size_t page_count = (length + page_size - 1) / page_size;
+
+			for (size_t i = 0; i < page_count; ++i)
+			{
+				if (vector[i] & 1)
+				{
+					*resident_bytes += MIN(page_size, length - (i * page_size));
+				}
+			}
+		}
+		else
+		{
+			ok = false;
+		}
+
+		munmap(data, length);
+	}
+
+	free_pages(vector, vector_size);
+
+	return ok;
+}
+
+inline static u32
+get_last_os_error()
+{
+	return (u32) errno;
+}
+
+inline static bool
+read_file(file_handle_t handle, void *buffer, size_t size, size_t *bytes_read)
+{
+	ssize_t result;
+
+	do
+	{
+		result = read(handle, buffer, size);
+	} while (result < 0 && errno == EINTR);
+
+	*bytes_read = (result < 0) ? 0 : (size_t) result;
+
+	return result >= 0;
+}
+
+inline static bool
+read_file_at(file_handle_t handle, void *buffer, size_t size, u64 offset, size_t *bytes_read)
+{
+	ssize_t result;
+
+	do
+	{
+		result = pread(handle, buffer, size, (off_t) offset);
+	} while (result < 0 && errno == EINTR);
+
+	*bytes_read = (result < 0) ? 0 : (size_t) result;
+
+	return result >= 0;
+}
+
+//
+// Maps the whole file read-only and tells the kernel we will stream through it. HUGEPAGE only takes on
+// filesystems with large folio support, elsewhere madvise just fails and we carry on
+//
+inline static bool
+map_file(file_handle_t handle, u64 size, bool populate, mapped_file_t *mapped)
+{
+	int flags = MAP_PRIVATE;
+
+	if (populate)
+	{
+		flags |= MAP_POPULATE;
+	}
+
+	void *data = mmap(NULL, (size_t) size, PROT_READ, flags, handle, 0);
+
+	if (data == MAP_FAILED)
+	{
+		mapped->data = NULL;
+		mapped->size = 0;
+
+		return false;
+	}
+
+	madvise(data, (size_t) size, MADV_SEQUENTIAL);
+#if defined(MADV_HUGEPAGE)
+	madvise(data, (size_t) size, MADV_HUGEPAGE);
+#endif
+
+	mapped->data = (u8 *) data;
+	mapped->size = size;
+
+	return true;
+}
+
+inline static void
+unmap_file(mapped_file_t *mapped)
+{
+	munmap(mapped->data, (size_t) mapped->size);
+}
+
+inline static bool
+open_dir(const char *path, dir_iter_t *iter)
+{
+	iter->fd          = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	iter->buffer_pos  = 0;
+	iter->buffer_used = 0;
+
+	return iter->fd >= 0;
+}
+
+inline static bool
+next_dir_entry(dir_iter_t *iter, dir_entry_t *entry)
+{
+	for (;;)
+	{
+		if (iter->buffer_pos >= iter->buffer_used)
+		{
+			long result = syscall(SYS_getdents64, iter->fd, iter->buffer, sizeof(iter->buffer));
+
+			if (result <= 0)
+			{
+				return false;
+			}
+
+			iter->buffer_pos  = 0;
+			iter->buffer_used = (size_t) result;
+		}
+
+		linux_dirent64_t *dirent = (linux_dirent64_t *) (iter->buffer + iter->buffer_pos);
+		iter->buffer_pos += dirent->d_reclen;
+
+		const char *name = dirent->d_name;
+
+		if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+		{
+			continue;
+		}
+
+		bool is_directory = (dirent->d_type == DT_DIR);
+		bool is_regular   = (dirent->d_type == DT_REG);
+
+		if (dirent->d_type == DT_UNKNOWN || dirent->d_type == DT_LNK)
+		{
+			struct stat info;
+
+			// Links are followed to see what they point at, but never reported as directories so a walk cannot loop
+			if (fstatat(iter->fd, name, &info, (dirent->d_type == DT_LNK) ? 0 : AT_SYMLINK_NOFOLLOW) == 0)
+			{
+				is_directory = S_ISDIR(info.st_mode) && (dirent->d_type != DT_LNK);
+				is_regular   = S_ISREG(info.st_mode);
+			}
+		}
+
+		entry->name         = name;
+		entry->is_directory = is_directory;
+		entry->is_regular   = is_regular;
+
+		return true;
+	}
+}
+
+inline static void
+close_dir(dir_iter_t *iter)
+{
+	close(iter->fd);
+}
+
+#endif
+
+inline static bool
+is_file_handle_valid(file_handle_t handle)
+{
+	return handle != INVALID_FILE_HANDLE;
+}
+
+//
+// Joins a directory and a file name into out, returns false if the result does not fit
+//
+inline static bool
+join_path(char *out, size_t out_size, const char *dir, const char *name)
+{
+	int length = snprintf(out, out_size, "%s%c%s", dir, PATH_SEPARATOR, name);
+
+	return (length >= 0) && ((size_t) length < out_size);
+}
@@ -0,0 +1,249 @@
+//
+// Sidecar index of line start offsets, built by count_lines --index=<file> during its counting pass and used
+// by --print-lines to seek to a line without scanning everything before it. Entry i holds the byte offset where
+// line i * every (0 based) starts. On disk:
+//
+//   line_index_header_t
+//   u64 anchors[(entry_count + 63) / 64]   absolute offset of entries 0, 64, 128 ..
+//   u32 deltas[entry_count]                offset minus the previous entry's offset, 0 for anchored entries
+//
+// so the file can be mapped as is and any entry costs at most 63 adds.
+//
+
+#define LINE_INDEX_MAGIC (0x3130584449454C46ull) // "FLEIDX01"
+#define LINE_INDEX_GROUP (64)
+
+#define DEFAULT_LINE_INDEX_EVERY (4096)
+
+typedef struct
+{
+	u64 magic;
+	u64 every;
+	u64 line_count;
+	u64 file_size;
+	u64 entry_count;
+	u64 reserved[3];
+} line_index_header_t;
+
+typedef struct
+{
+	u64 every;
+
+	u64 *offsets;
+	u64 count;
+	u64 capacity;
+} line_index_builder_t;
+
+typedef struct
+{
+	line_index_header_t const *header;
+	u64 const *anchors;
+	u32 const *deltas;
+
+	file_handle_t file;
+	mapped_file_t mapped;
+} line_index_t;
+
+//
+// Offset of the nth (1 based) occurrence of byte, or size when there are fewer. Counts 4K at a time and only
+// searches for single bytes inside the chunk that holds it
+//
+inline static size_t
+find_nth_byte(u8 const *data, size_t size, u8 byte, u64 n)
+{
+	size_t offset = 0;
+
+	while (offset < size)
+	{
+		size_t chunk = MIN(size - offset, KILOBYTES(4));
+		u64 count    = simd.count_byte(data + offset, chunk, byte);
+
+		if (count >= n)
+		{
+			sz_cptr_t at  = (sz_cptr_t) (data + offset);
+			sz_cptr_t end = at + chunk;
+
+			for (;;)
+			{
+				sz_cptr_t found = simd.find_byte(at, end - at, (sz_cptr_t) &byte);
+
+				if (--n == 0)
+				{
+					return (size_t) ((u8 const *) found - data);
+				}
+
+				at = found + 1;
+			}
+		}
+
+		n      -= count;
+		offset += chunk;
+	}
+
+	return size;
+}
+
+// Every entry needs every newlines before it, so file_size / every + 1 entries always fit
+inline static bool
+init_line_index_builder(line_index_builder_t *builder, u64 every, u64 file_size)
+{
+	builder->every    = every;
+	builder->capacity = file_size / every + 2;
+	builder->offsets  = (u64 *) alloc_pages(builder->capacity * sizeof(u64));
+	builder->count    = 1;
+
+	if (builder->offsets == NULL)
+	{
+		return false;
+	}
+
+	// Line 0 always starts at 0
+	builder->offsets[0] = 0;
+
+	return true;
+}
+
+inline static void
+reset_line_index_builder(line_index_builder_t *builder)
+{
+	builder->count = 1;
+}
+
+inline static void
+free_line_index_builder(line_index_builder_t *builder)
+{
+	free_pages(builder->offsets, builder->capacity * sizeof(u64));
+}
+
+//
+// Blocks have to come in file order. lines_before is the newline count of everything ahead of the block and
+// block_lines the count inside it, both already known from counting, so this only looks for the few newlines
+// that start an indexed line
+//
+inline static void
+add_block_to_line_index(line_index_builder_t *builder, u8 const *block, size_t block_size, u64 block_offset,
+                        u64 lines_before, u64 block_lines)
+{
+	u64 every = builder->every;
+	u64 line  = (lines_before / every + 1) * every;
+
+	size_t searched_to = 0;
+	u64 newlines_seen  = lines_before;
+
+	for (; line <= lines_before + block_lines && builder->count < builder->capacity; line += every)
+	{
+		size_t at = searched_to + find_nth_byte(block + searched_to, block_size - searched_to, '\n', line - newlines_seen);
+
+		builder->offsets[builder->count++] = block_offset + at + 1;
+
+		searched_to   = at + 1;
+		newlines_seen = line;
+	}
+}
+
+inline static bool
+save_line_index(const char *path, line_index_builder_t *builder, u64 line_count, u64 file_size)
+{
+	for (u64 i = 1; i < builder->count; ++i)
+	{
+		if ((i % LINE_INDEX_GROUP) && builder->offsets[i] - builder->offsets[i - 1] > 0xFFFFFFFFull)
+		{
+			fprintf(stderr, "(%zu lines span more than 4 GB, use a smaller --index-every)\n", builder->every);
+			return false;
+		}
+	}
+
+	FILE *file = fopen(path, "wb");
+
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	line_index_header_t header = {0};
+	header.magic       = LINE_INDEX_MAGIC;
+	header.every       = builder->every;
+	header.line_count  = line_count;
+	header.file_size   = file_size;
+	header.entry_count = builder->count;
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	for (u64 i = 0; i < builder->count; i += LINE_INDEX_GROUP)
+	{
+		fwrite(&builder->offsets[i], sizeof(u64), 1, file);
+	}
+
+	for (u64 i = 0; i < builder->count; ++i)
+	{
+		u32 delta = (i % LINE_INDEX_GROUP) ? (u32) (builder->offsets[i] - builder->offsets[i - 1]) : 0;
+		fwrite(&delta, sizeof(u32), 1, file);
+	}
+
+	bool written = (ferror(file) == 0);
+	fclose(file);
+
+	return written;
+}
+
+inline static u64
+get_line_index_anchor_count(u64 entry_count)
+{
+	return (entry_count + LINE_INDEX_GROUP - 1) / LINE_INDEX_GROUP;
+}
+
+inline static bool
+open_line_index(const char *path, line_index_t *index)
+{
+	index->file = open_file_for_read(path, 0);
+
+	if (!is_file_handle_valid(index->file))
+	{
+		return false;
+	}
+
+	u64 size = get_file_size(index->file);
+
+	if (size < sizeof(line_index_header_t) || !map_file(index->file, size, false, &index->mapped))
+	{
+		close_file(index->file);
+		return false;
+	}
+
+	index->header  = (line_index_header_t const *) index->mapped.data;
+	index->anchors = (u64 const *) (index->mapped.data + sizeof(line_index_header_t));
+	index->deltas  = (u32 const *) (index->anchors + get_line_index_anchor_count(index->header->entry_count));
+
+	u64 expected = sizeof(line_index_header_t) + get_line_index_anchor_count(index->header->entry_count) * sizeof(u64) +
+	               index->header->entry_count * sizeof(u32);
+
+	if (index->header->magic != LINE_INDEX_MAGIC || index->header->every == 0 || index->header->entry_count == 0 || size != expected)
+	{
+		unmap_file(&index->mapped);
+		close_file(index->file);
+		return false;
+	}
+
+	return true;
+}
+
+inline static void
+close_line_index(line_index_t *index)
+{
+	unmap_file(&index->mapped);
+	close_file(index->file);
+}
+
+inline static u64
+get_line_index_offset(line_index_t *index, u64 entry)
+{
+	u64 group  = entry / LINE_INDEX_GROUP;
+	u64 offset = index->anchors[group];
+
+	for (u64 i = group * LINE_INDEX_GROUP + 1; i <= entry; ++i)
+	{
+		offset += index->deltas[i];
+	}
+
+	return offset;
+}
@@ -0,0 +1,101 @@
+//
+// Open addressing hash set of byte strings for whole line membership tests, one XXH64 hash and usually one
+// probe per lookup however many lines it holds. Entries point at the caller's memory (a mapped pattern file
+// or argv), nothing is copied, so that memory has to outlive the set.
+//
+
+typedef struct
+{
+	// 0 marks an empty slot, real hashes of 0 are stored as 1
+	u64 hash;
+	u8 const *data;
+	u64 length;
+} line_set_entry_t;
+
+typedef struct
+{
+	line_set_entry_t *entries;
+	u64 capacity;
+	u64 count;
+} line_set_t;
+
+inline static u64
+hash_line_set_key(u8 const *data, size_t length)
+{
+	u64 hash = XXH64(data, length, 0);
+
+	return hash ? hash : 1;
+}
+
+// Room for max_count lines at a load factor of at most one half
+inline static bool
+init_line_set(line_set_t *set, u64 max_count)
+{
+	set->count    = 0;
+	set->capacity = 16;
+
+	while (set->capacity < max_count * 2)
+	{
+		set->capacity *= 2;
+	}
+
+	// Fresh pages are zero, every slot starts empty
+	set->entries = (line_set_entry_t *) alloc_pages(set->capacity * sizeof(line_set_entry_t));
+
+	return set->entries != NULL;
+}
+
+inline static void
+free_line_set(line_set_t *set)
+{
+	free_pages(set->entries, set->capacity * sizeof(line_set_entry_t));
+}
+
+// Slot holding the line, or the empty slot where it would go
+inline static line_set_entry_t *
+find_line_set_slot(line_set_t const *set, u64 hash, u8 const *data, size_t length)
+{
+	u64 mask  = set->capacity - 1;
+	u64 index = hash & mask;
+
+	for (;;)
+	{
+		line_set_entry_t *entry = &set->entries[index];
+
+		if (entry->hash == 0 || (entry->hash == hash && entry->length == length && memcmp(entry->data, data, length) == 0))
+		{
+			return entry;
+		}
+
+		index = (index + 1) & mask;
+	}
+}
+
+// Duplicates are dropped, adding past the count given to init_line_set fails
+inline static bool
+add_to_line_set(line_set_t *set, u8 const *data, size_t length)
+{
+	u64 hash                = hash_line_set_key(data, length);
+	line_set_entry_t *entry = find_line_set_slot(set, hash, data, length);
+
+	if (entry->hash == 0)
+	{
+		if ((set->count + 1) * 2 > set->capacity)
+		{
+			return false;
+		}
+
+		entry->hash   = hash;
+		entry->data   = data;
+		entry->length = length;
+		set->count   += 1;
+	}
+
+	return true;
+}
+
+inline static bool
+is_in_line_set(line_set_t const *set, u8 const *data, size_t length)
+{
+	return find_line_set_slot(set, hash_line_set_key(data, length), data, length)->hash != 0;
+}
@@ -0,0 +1,249 @@
+//
+// Line length distribution: a log2 bucketed histogram, min/max/mean and the K longest lines with their offsets.
+// The kernels only turn 64 bytes at a time into a newline bit mask, the walk over the set bits is shared and
+// runs once per line. Lengths are in bytes without the newline.
+//
+
+#define LINE_STATS_MAX_TOP (1024)
+
+typedef struct
+{
+	u64 length;
+	u64 offset;
+	u64 line_number;
+} line_record_t;
+
+typedef struct
+{
+	// Bucket 0 holds empty lines, bucket b lengths in [2^(b-1), 2^b)
+	u64 histogram[65];
+
+	u64 line_count;
+	u64 min_length;
+	u64 max_length;
+	u64 total_length;
+
+	// Lines longer than this are counted separately, e.g. the block size of the tools that need a whole line
+	u64 long_threshold;
+	u64 long_count;
+
+	// Min-heap on length, top[0] is the shortest of the longest
+	u32 top_capacity;
+	u32 top_count;
+	line_record_t top[LINE_STATS_MAX_TOP];
+
+	// File offset where the current line started, carried between chunks and blocks
+	u64 line_start;
+} line_stats_t;
+
+inline static void
+init_line_stats(line_stats_t *stats, u32 top_capacity, u64 long_threshold)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	stats->min_length     = ~0ull;
+	stats->top_capacity   = MIN(top_capacity, LINE_STATS_MAX_TOP);
+	stats->long_threshold = long_threshold;
+}
+
+inline static void
+sift_down_line_record(line_record_t *heap, u32 count, u32 index)
+{
+	for (;;)
+	{
+		u32 smallest = index;
+		u32 left     = index * 2 + 1;
+		u32 right    = left + 1;
+
+		if (left < count && heap[left].length < heap[smallest].length)
+		{
+			smallest = left;
+		}
+
+		if (right < count && heap[right].length < heap[smallest].length)
+		{
+			smallest = right;
+		}
+
+		if (smallest == index)
+		{
+			break;
+		}
+
+		line_record_t swap = heap[index];
+		heap[index]        = heap[smallest];
+		heap[smallest]     = swap;
+
+		index = smallest;
+	}
+}
+
+// 1 + floor(log2(length)), 0 for empty lines. Not sz_u64_clz, MSVC builds that on lzcnt which older CPUs run as bsr
+inline static u32
+get_line_length_bucket(u64 length)
+{
+#if defined(_MSC_VER)
+	unsigned long index;
+	return _BitScanReverse64(&index, length) ? (u32) index + 1 : 0;
+#else
+	return length ? 64 - (u32) __builtin_clzll(length) : 0;
+#endif
+}
+
+inline static void
+record_line_length(line_stats_t *stats, u64 length, u64 offset)
+{
+	u32 bucket = get_line_length_bucket(length);
+
+	stats->histogram[bucket] += 1;
+	stats->line_count        += 1;
+	stats->total_length      += length;
+	stats->min_length         = MIN(stats->min_length, length);
+	stats->max_length         = MAX(stats->max_length, length);
+	stats->long_count        += (length > stats->long_threshold);
+
+	if (stats->top_count < stats->top_capacity)
+	{
+		// Sift up
+		u32 index = stats->top_count++;
+
+		stats->top[index] = (line_record_t) { length, offset, stats->line_count };
+
+		while (index && stats->top[(index - 1) / 2].length > stats->top[index].length)
+		{
+			line_record_t swap          = stats->top[index];
+			stats->top[index]           = stats->top[(index - 1) / 2];
+			stats->top[(index - 1) / 2] = swap;
+
+			index = (index - 1) / 2;
+		}
+	}
+	else if (stats->top_capacity && length > stats->top[0].length)
+	{
+		stats->top[0] = (line_record_t) { length, offset, stats->line_count };
+		sift_down_line_record(stats->top, stats->top_count, 0);
+	}
+}
+
+// Bit i of newline is byte chunk_offset + i of the file
+inline static void
+accumulate_line_lengths(line_stats_t *stats, u64 newline, u64 chunk_offset)
+{
+	while (newline)
+	{
+		u64 end = chunk_offset + sz_u64_ctz(newline);
+
+		record_line_length(stats, end - stats->line_start, stats->line_start);
+
+		stats->line_start = end + 1;
+		newline          &= newline - 1;
+	}
+}
+
+inline static u64
+find_newlines_serial(u8 const *data, u32 count)
+{
+	u64 newline = 0;
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		newline |= (u64) (data[i] == '\n') << i;
+	}
+
+	return newline;
+}
+
+static void
+collect_line_lengths_serial(line_stats_t *stats, u8 const *data, size_t size, u64 offset)
+{
+	for (size_t i = 0; i < size; i += 64)
+	{
+		u32 count = (u32) MIN(size - i, 64);
+
+		accumulate_line_lengths(stats, find_newlines_serial(data + i, count), offset + i);
+	}
+}
+
+// A last line with no newline after it ends at the end of the file
+inline static void
+finish_line_stats(line_stats_t *stats, u64 file_size)
+{
+	if (stats->line_start < file_size)
+	{
+		record_line_length(stats, file_size - stats->line_start, stats->line_start);
+	}
+
+	if (stats->line_count == 0)
+	{
+		stats->min_length = 0;
+	}
+}
+
+static int
+compare_line_records_longest_first(const void *a, const void *b)
+{
+	u64 length_a = ((line_record_t const *) a)->length;
+	u64 length_b = ((line_record_t const *) b)->length;
+
+	return (length_a < length_b) - (length_a > length_b);
+}
+
+inline static void
+sort_longest_lines(line_stats_t *stats)
+{
+	qsort(stats->top, stats->top_count, sizeof(line_record_t), compare_line_records_longest_first);
+}
+
+#if defined(ARCH_X64)
+
+static void
+collect_line_lengths_sse2(line_stats_t *stats, u8 const *data, size_t size, u64 offset)
+{
+	__m128i newline_byte = _mm_set1_epi8('\n');
+	size_t i             = 0;
+
+	for (; i + 64 <= size; i += 64)
+	{
+		u64 mask0 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i)),      newline_byte));
+		u64 mask1 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i + 16)), newline_byte));
+		u64 mask2 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i + 32)), newline_byte));
+		u64 mask3 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i + 48)), newline_byte));
+
+		accumulate_line_lengths(stats, mask0 | (mask1 << 16) | (mask2 << 32) | (mask3 << 48), offset + i);
+	}
+
+	collect_line_lengths_serial(stats, data + i, size - i, offset + i);
+}
+
+TARGET_AVX2 static void
+collect_line_lengths_avx2(line_stats_t *stats, u8 const *data, size_t size, u64 offset)
+{
+	__m256i newline_byte = _mm256_set1_epi8('\n');
+	size_t i             = 0;
+
+	for (; i + 64 <= size; i += 64)
+	{
+		u64 mask0 = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i)),      newline_byte));
+		u64 mask1 = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i + 32)), newline_byte));
+
+		accumulate_line_lengths(stats, mask0 | (mask1 << 32), offset + i);
+	}
+
+	collect_line_lengths_serial(stats, data + i, size - i, offset + i);
+}
+
+TARGET_AVX512BW static void
+collect_line_lengths_avx512(line_stats_t *stats, u8 const *data, size_t size, u64 offset)
+{
+	__m512i newline_byte = _mm512_set1_epi8('\n');
+
+	for (size_t i = 0; i < size; i += 64)
+	{
+		u32 count       = (u32) MIN(size - i, 64);
+		__mmask64 valid = (count == 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << count) - 1);
+
+		accumulate_line_lengths(stats, _mm512_mask_cmpeq_epi8_mask(valid, _mm512_maskz_loadu_epi8(valid, data + i), newline_byte), offset + i);
+	}
+}
+
+#endif
@@ -1,87 +1,291 @@
+// alignment must be a power of two
+inline static u64
+align_up(u64 value, u64 alignment)
+{
+	return (value + alignment - 1) & ~(alignment - 1);
+}
+
+#if defined(PLATFORM_WIN32)
+
+inline static size_t
+get_page_size()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwPageSize;
+}
+
+inline static void *
+alloc_pages(size_t size)
+{
+	return VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+}
+
 inline static void
-copy_serial(void *target, void const *source, size_t length)
+free_pages(void *memory, size_t size)
 {
-	if (length < 1)
+	(void) size;
+
+	if (memory)
 	{
-		return;
+		VirtualFree(memory, 0, MEM_RELEASE);
 	}
+}
 
-	u8 *dest      = target;
-	u8 const *src = source;
+//
+// Data cache sizes in bytes for L1/L2/L3, 0 where the level does not exist
+//
+inline static void
+get_cpu_cache_sizes(size_t sizes[3])
+{
+	sizes[0] = sizes[1] = sizes[2] = 0;
 
-	while (length--)
+	DWORD length = 0;
+	GetLogicalProcessorInformation(NULL, &length);
+
+	SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION *) alloc_pages(length);
+
+	if (info == NULL)
 	{
-		*(dest++) = *(src++);
+		return;
 	}
+
+	if (GetLogicalProcessorInformation(info, &length))
+	{
+		DWORD count = length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+
+		for (DWORD i = 0; i < count; ++i)
+		{
+			CACHE_DESCRIPTOR *cache = &info[i].Cache;
+
+			if (info[i].Relationship == RelationCache && cache->Level >= 1 && cache->Level <= 3 &&
+			    (cache->Type == CacheData || cache->Type == CacheUnified))
+			{
+				sizes[cache->Level - 1] = MAX(sizes[cache->Level - 1], (size_t) cache->Size);
+			}
+		}
+	}
+
+	VirtualFree(info, 0, MEM_RELEASE);
 }
 
-inline static void 
-copy(void *target, void const *source, size_t length) 
+// VirtualAlloc hands out 64K aligned regions, which covers every sector size we care about
+inline static void *
+alloc_aligned_pages(size_t size, size_t alignment)
 {
-	u8 *dest      = target;
-	u8 const *src = source;
+	return (alignment <= KILOBYTES(64)) ? alloc_pages(size) : NULL;
+}
+
+#elif defined(PLATFORM_LINUX)
+
+inline static size_t
+get_page_size()
+{
+	return (size_t) sysconf(_SC_PAGESIZE);
+}
 
-    for (; length >= 32; src += 32, dest += 32, length -= 32)
-    {
-    	_mm256_storeu_si256((__m256i *)target, _mm256_lddqu_si256((__m256i const *) src));
-    }
+inline static void
+get_cpu_cache_sizes(size_t sizes[3])
+{
+	long l1 = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+
+	sizes[0] = (l1 > 0) ? (size_t) l1 : 0;
+	sizes[1] = (l2 > 0) ? (size_t) l2 : 0;
+	sizes[2] = (l3 > 0) ? (size_t) l3 : 0;
+}
+
+inline static void *
+alloc_pages(size_t size)
+{
+	void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
 
-    copy_serial(dest, src, length);
+	return (memory == MAP_FAILED) ? NULL : memory;
 }
 
 inline static void
-clear_serial(void *target, size_t length)
+free_pages(void *memory, size_t size)
 {
-	if (length < 1)
+	if (memory)
 	{
-		return;
+		munmap(memory, size);
+	}
+}
+
+//
+// Over-maps by alignment and trims the ends, so the result can still be released with free_pages
+//
+inline static void *
+alloc_aligned_pages(size_t size, size_t alignment)
+{
+	if (alignment <= get_page_size())
+	{
+		return alloc_pages(size);
+	}
+
+	size = (size_t) align_up(size, get_page_size());
+
+	u8 *memory = (u8 *) alloc_pages(size + alignment);
+
+	if (memory == NULL)
+	{
+		return NULL;
+	}
+
+	u8 *aligned = (u8 *) (((uintptr_t) memory + alignment - 1) & ~((uintptr_t) alignment - 1));
+
+	size_t head = aligned - memory;
+	size_t tail = alignment - head;
+
+	if (head)
+	{
+		munmap(memory, head);
+	}
+
+	if (tail)
+	{
+		munmap(aligned + size, tail);
 	}
 
-	u8 *dest = target;
+	return aligned;
+}
+
+#endif
+
+//
+// Byte counting kernels. Compare a vector at a time, turn the compare into a bit mask and popcount it, there is
+// no branch per match so the speed does not depend on how often the byte occurs (newlines in short-line logs).
+//
+
+// The SSE2 kernel has to run on hosts without POPCNT
+inline static u64
+popcount_u64_serial(u64 value)
+{
+	value = value - ((value >> 1) & 0x5555555555555555ull);
+	value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+	value = (value + (value >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+
+	return (value * 0x0101010101010101ull) >> 56;
+}
+
+static u64
+count_byte_serial(u8 const *data, size_t size, u8 byte)
+{
+	u64 count = 0;
 
-	while (length--)
+	for (size_t i = 0; i < size; ++i)
 	{
-		*(dest++) = 0;
+		count += (data[i] == byte);
 	}
+
+	return count;
 }
 
-inline static void
-clear(void *target, size_t length)
+#if defined(ARCH_X64)
+
+static u64
+count_byte_sse2(u8 const *data, size_t size, u8 byte)
 {
-	u8 *dest = target;
+	__m128i needle = _mm_set1_epi8((char) byte);
+	u64 count      = 0;
+	size_t i       = 0;
 
-	const __m256i zero = _mm256_set1_epi8(0);
+	for (; i + 64 <= size; i += 64)
+	{
+		u64 mask0 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i)),      needle));
+		u64 mask1 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i + 16)), needle));
+		u64 mask2 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i + 32)), needle));
+		u64 mask3 = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i + 48)), needle));
+
+		count += popcount_u64_serial(mask0 | (mask1 << 16) | (mask2 << 32) | (mask3 << 48));
+	}
 
-    for (; length >= 32; dest += 32, length -= 32)
-    {
-    	_mm256_storeu_si256((__m256i *) target, zero);
-    }
+	for (; i + 16 <= size; i += 16)
+	{
+		count += popcount_u64_serial((u32) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *) (data + i)), needle)));
+	}
 
-    clear_serial(dest, length);
+	return count + count_byte_serial(data + i, size - i, byte);
 }
 
-inline static u64
-count_byte_in_block(char *block, size_t block_size, const char *byte)
+TARGET_AVX2 static u64
+count_byte_avx2(u8 const *data, size_t size, u8 byte)
 {
-	size_t buf_remain = block_size;
-	sz_cptr_t buf     = block;
+	__m256i needle = _mm256_set1_epi8((char) byte);
+	u64 count      = 0;
+	size_t i       = 0;
 
-	u64 newline_count = 0;
+	for (; i + 128 <= size; i += 128)
+	{
+		u64 mask0 = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i)),      needle));
+		u64 mask1 = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i + 32)), needle));
+		u64 mask2 = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i + 64)), needle));
+		u64 mask3 = (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i + 96)), needle));
+
+		count += _mm_popcnt_u64(mask0 | (mask1 << 32));
+		count += _mm_popcnt_u64(mask2 | (mask3 << 32));
+	}
+
+	for (; i + 32 <= size; i += 32)
+	{
+		count += _mm_popcnt_u64((u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *) (data + i)), needle)));
+	}
+
+	return count + count_byte_serial(data + i, size - i, byte);
+}
+
+TARGET_AVX512BW static u64
+count_byte_avx512(u8 const *data, size_t size, u8 byte)
+{
+	__m512i needle = _mm512_set1_epi8((char) byte);
+	u64 count      = 0;
+	size_t i       = 0;
+
+	for (; i + 256 <= size; i += 256)
+	{
+		count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((void const *) (data + i)),       needle));
+		count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((void const *) (data + i + 64)),  needle));
+		count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((void const *) (data + i + 128)), needle));
+		count += _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512((void const *) (data + i + 192)), needle));
+	}
 
-	while (buf_remain)
+	for (; i < size; i += 64)
 	{
-		sz_cptr_t found_newline = sz_find_byte_avx2(buf, buf_remain, byte);
+		// Masked load for the tail, lanes past size are neither read nor compared
+		__mmask64 valid = (size - i >= 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << (size - i)) - 1);
 
-		if (found_newline == NULL)
+		count += _mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(valid, _mm512_maskz_loadu_epi8(valid, data + i), needle));
+	}
+
+	return count;
+}
+
+#elif defined(ARCH_ARM64)
+
+static u64
+count_byte_neon(u8 const *data, size_t size, u8 byte)
+{
+	uint8x16_t needle = vdupq_n_u8(byte);
+	u64 count         = 0;
+	size_t i          = 0;
+
+	// Matches are 0xFF, subtracting them counts up per lane. 255 rounds of 16 bytes fit in a u8 lane
+	while (i + 16 <= size)
+	{
+		size_t rounds      = MIN((size - i) / 16, 255);
+		uint8x16_t counter = vdupq_n_u8(0);
+
+		for (size_t r = 0; r < rounds; ++r, i += 16)
 		{
-			break;
+			counter = vsubq_u8(counter, vceqq_u8(vld1q_u8(data + i), needle));
 		}
 
-		newline_count += 1;
-
-		buf = found_newline + 1;
-		buf_remain = block_size - (buf - block);
+		count += vaddlvq_u8(counter);
 	}
 
-	return newline_count;
-}
\ No newline at end of file
+	return count + count_byte_serial(data + i, size - i, byte);
+}
+
+#endif
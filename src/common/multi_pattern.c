@@ -0,0 +1,309 @@
+//
+// Aho-Corasick automaton for finding many patterns in one pass. Failure links are folded into a full transition
+// table, so every byte is one lookup, and bytes are first mapped to classes (every byte no pattern uses shares
+// class 0) to keep the table small. While the automaton sits in the root state nothing can be in progress, so
+// it skips to the next byte that starts a pattern with simd.find_byte or simd.find_charset, which is where the
+// speed on real text comes from: most of the input is never stepped through.
+//
+
+#define MULTI_PATTERN_NONE (0xFFFFFFFFu)
+
+typedef struct
+{
+	u8 byte_class[256];
+	u32 class_count;
+
+	u32 state_count;
+
+	// next[state * class_count + class]
+	u32 *next;
+
+	// Pattern ending exactly at the state, and the closest state on the failure chain that ends one
+	u32 *own_pattern;
+	u32 *output_link;
+
+	// Non-zero when the state or anything on its failure chain ends a pattern
+	u8 *has_output;
+
+	// What the root skips to
+	u32 start_byte_count;
+	u8 start_byte;
+	sz_charset_t start_bytes;
+
+	size_t table_size;
+} multi_pattern_t;
+
+typedef struct
+{
+	u32 state;
+	size_t offset;
+
+	// Output state still being reported, MULTI_PATTERN_NONE when there is none
+	u32 output_state;
+
+	// The match, data[end - length .. end) where length is the pattern's
+	u32 pattern;
+	size_t end;
+} multi_pattern_scan_t;
+
+inline static u32
+step_multi_pattern(multi_pattern_t const *matcher, u32 state, u8 byte)
+{
+	return matcher->next[(size_t) state * matcher->class_count + matcher->byte_class[byte]];
+}
+
+inline static void
+free_multi_pattern(multi_pattern_t *matcher)
+{
+	free_pages(matcher->next, matcher->table_size);
+	memset(matcher, 0, sizeof(*matcher));
+}
+
+//
+// Identical patterns share a state and only the first of them is reported. Empty patterns are ignored. With
+// fold_case, A..Z share the class of a..z, so the scan matches ASCII letters in either case at no extra cost
+//
+static bool
+init_multi_pattern(multi_pattern_t *matcher, char const *const *patterns, size_t const *lengths, u32 pattern_count, bool fold_case)
+{
+	memset(matcher, 0, sizeof(*matcher));
+
+	u64 max_states = 1;
+
+	for (u32 i = 0; i < pattern_count; ++i)
+	{
+		for (size_t j = 0; j < lengths[i]; ++j)
+		{
+			u8 byte = (u8) patterns[i][j];
+
+			matcher->byte_class[fold_case ? fold_ascii_case(byte) : byte] = 1;
+		}
+
+		max_states += lengths[i];
+	}
+
+	u32 used_bytes = 0;
+
+	for (u32 byte = 0; byte < 256; ++byte)
+	{
+		used_bytes += matcher->byte_class[byte];
+	}
+
+	// Class 0 is only needed when some byte is in no pattern
+	matcher->class_count = (used_bytes < 256) ? 1 : 0;
+
+	for (u32 byte = 0; byte < 256; ++byte)
+	{
+		if (matcher->byte_class[byte])
+		{
+			matcher->byte_class[byte] = (u8) matcher->class_count++;
+		}
+	}
+
+	if (fold_case)
+	{
+		for (u32 byte = 'A'; byte <= 'Z'; ++byte)
+		{
+			matcher->byte_class[byte] = matcher->byte_class[byte + 0x20];
+		}
+	}
+
+	if (max_states >= MULTI_PATTERN_NONE)
+	{
+		return false;
+	}
+
+	// One block for the table and the per state arrays, plus the breadth first queue and failure links
+	size_t next_size    = (size_t) max_states * matcher->class_count * sizeof(u32);
+	size_t state_size   = (size_t) max_states * (3 * sizeof(u32) + sizeof(u8));
+	matcher->table_size = next_size + state_size + (size_t) max_states * 2 * sizeof(u32);
+
+	u8 *memory = (u8 *) alloc_pages(matcher->table_size);
+
+	if (memory == NULL)
+	{
+		return false;
+	}
+
+	matcher->next        = (u32 *) memory;
+	matcher->own_pattern = (u32 *) (memory + next_size);
+	matcher->output_link = matcher->own_pattern + max_states;
+	u32 *fail            = matcher->output_link + max_states;
+	u32 *queue           = fail + max_states;
+	matcher->has_output  = (u8 *) (queue + max_states);
+
+	memset(matcher->next, 0xFF, next_size);
+	memset(matcher->own_pattern, 0xFF, (size_t) max_states * sizeof(u32));
+
+	u32 class_count = matcher->class_count;
+
+	// Trie
+	matcher->state_count = 1;
+	sz_charset_init(&matcher->start_bytes);
+
+	for (u32 i = 0; i < pattern_count; ++i)
+	{
+		if (lengths[i] == 0)
+		{
+			continue;
+		}
+
+		u32 state = 0;
+
+		for (size_t j = 0; j < lengths[i]; ++j)
+		{
+			u32 *edge = &matcher->next[(size_t) state * class_count + matcher->byte_class[(u8) patterns[i][j]]];
+
+			if (*edge == MULTI_PATTERN_NONE)
+			{
+				*edge = matcher->state_count++;
+			}
+
+			state = *edge;
+		}
+
+		if (matcher->own_pattern[state] == MULTI_PATTERN_NONE)
+		{
+			matcher->own_pattern[state] = i;
+		}
+
+		u8 first = (u8) patterns[i][0];
+
+		if (fold_case)
+		{
+			first = fold_ascii_case(first);
+		}
+
+		for (u32 variant = 0; variant < ((fold_case && is_ascii_letter(first)) ? 2 : 1); ++variant)
+		{
+			u8 byte = variant ? (u8) (first - 0x20) : first;
+
+			if (!sz_charset_contains_u8(&matcher->start_bytes, byte))
+			{
+				sz_charset_add_u8(&matcher->start_bytes, byte);
+
+				matcher->start_byte        = byte;
+				matcher->start_byte_count += 1;
+			}
+		}
+	}
+
+	// Breadth first, so a state's failure target is final before its children need it
+	u32 queue_head = 0;
+	u32 queue_tail = 0;
+
+	fail[0]                 = 0;
+	matcher->output_link[0] = MULTI_PATTERN_NONE;
+	matcher->has_output[0]  = 0;
+
+	for (u32 c = 0; c < class_count; ++c)
+	{
+		u32 *edge = &matcher->next[c];
+
+		if (*edge == MULTI_PATTERN_NONE)
+		{
+			*edge = 0;
+		}
+		else
+		{
+			fail[*edge]         = 0;
+			queue[queue_tail++] = *edge;
+		}
+	}
+
+	while (queue_head < queue_tail)
+	{
+		u32 state = queue[queue_head++];
+		u32 link  = fail[state];
+
+		matcher->output_link[state] = (matcher->own_pattern[link] != MULTI_PATTERN_NONE) ? link : matcher->output_link[link];
+		matcher->has_output[state]  = (matcher->own_pattern[state] != MULTI_PATTERN_NONE) || matcher->has_output[link];
+
+		for (u32 c = 0; c < class_count; ++c)
+		{
+			u32 *edge    = &matcher->next[(size_t) state * class_count + c];
+			u32 fallback = matcher->next[(size_t) link * class_count + c];
+
+			if (*edge == MULTI_PATTERN_NONE)
+			{
+				*edge = fallback;
+			}
+			else
+			{
+				fail[*edge]         = fallback;
+				queue[queue_tail++] = *edge;
+			}
+		}
+	}
+
+	return true;
+}
+
+inline static void
+init_multi_pattern_scan(multi_pattern_scan_t *scan, u32 state)
+{
+	scan->state        = state;
+	scan->offset       = 0;
+	scan->output_state = MULTI_PATTERN_NONE;
+}
+
+//
+// Next match in data, in order of where matches end (longest first among those ending at the same byte).
+// Overlapping matches are all reported. Returns false once data is exhausted
+//
+static bool
+find_next_multi_pattern(multi_pattern_t const *matcher, u8 const *data, size_t size, multi_pattern_scan_t *scan)
+{
+	for (;;)
+	{
+		// Walk the outputs of the state the last byte led to
+		while (scan->output_state != MULTI_PATTERN_NONE)
+		{
+			u32 output_state   = scan->output_state;
+			scan->output_state = matcher->output_link[output_state];
+
+			if (matcher->own_pattern[output_state] != MULTI_PATTERN_NONE)
+			{
+				scan->pattern = matcher->own_pattern[output_state];
+				scan->end     = scan->offset;
+
+				return true;
+			}
+		}
+
+		size_t offset = scan->offset;
+		u32 state     = scan->state;
+
+		for (;;)
+		{
+			if (state == 0 && offset < size)
+			{
+				sz_cptr_t text  = (sz_cptr_t) data + offset;
+				sz_cptr_t found = (matcher->start_byte_count == 1) ? simd.find_byte(text, size - offset, (sz_cptr_t) &matcher->start_byte) :
+				                                                     simd.find_charset(text, size - offset, &matcher->start_bytes);
+
+				offset = found ? (size_t) ((u8 const *) found - data) : size;
+			}
+
+			if (offset >= size)
+			{
+				scan->state  = state;
+				scan->offset = size;
+
+				return false;
+			}
+
+			state   = step_multi_pattern(matcher, state, data[offset]);
+			offset += 1;
+
+			if (matcher->has_output[state])
+			{
+				break;
+			}
+		}
+
+		scan->state        = state;
+		scan->offset       = offset;
+		scan->output_state = state;
+	}
+}
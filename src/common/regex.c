@@ -0,0 +1,1559 @@
+//
+// Regular expressions for line search. Patterns are parsed into a tree, compiled to a Thompson NFA, and run
+// through a DFA that is built lazily, one transition the first time it is needed, over byte classes. The DFA
+// lives in a cache of REGEX_DFA_CACHE_SIZE bytes that is simply thrown away and rebuilt when it fills up, so a
+// pattern whose DFA would blow up costs time instead of memory.
+//
+// The tree also yields the literals one of which every match has to contain (regex->literals). Callers scan
+// for those with the SIMD substring search and only run the DFA over the lines they land in.
+//
+// Supported, as in grep -E: literals, ., [...] with ranges, negation and [:class:], the escapes \d \w \s \D \W
+// \S \t \r and escaped punctuation, ^ $, ( ), |, and * + ? {m} {m,} {m,n}. A match is searched for anywhere in
+// a line, bytes are bytes (no UTF-8 decoding)
+//
+
+#define REGEX_NONE           (0xFFFFFFFFu)
+#define REGEX_UNBOUNDED      (0xFFFFFFFFu)
+#define REGEX_MAX_REPEAT     (1000)
+#define REGEX_MAX_STACKED    (8)
+#define REGEX_MAX_DEPTH      (64)
+#define REGEX_MAX_NFA_STATES (1 << 16)
+#define REGEX_MAX_LITERAL    (64)
+#define REGEX_MAX_LITERALS   (16)
+#define REGEX_DFA_CACHE_SIZE (MEGABYTES(8))
+
+typedef enum
+{
+	REGEX_NODE_EMPTY,
+	REGEX_NODE_SET,
+	REGEX_NODE_LINE_START,
+	REGEX_NODE_LINE_END,
+	REGEX_NODE_CONCAT,
+	REGEX_NODE_ALTERNATE,
+	REGEX_NODE_REPEAT,
+} regex_node_kind_t;
+
+typedef struct
+{
+	regex_node_kind_t kind;
+
+	// CONCAT and ALTERNATE use both, REPEAT only left. Chains of either lean left
+	u32 left;
+	u32 right;
+
+	// REPEAT
+	u32 min;
+	u32 max;
+
+	// SET, and the byte it stands for when it is a single literal byte (lowered under fold_case)
+	u32 set;
+	bool is_literal;
+	u8 literal;
+} regex_node_t;
+
+typedef struct
+{
+	u64 bits[4];
+} regex_set_t;
+
+typedef enum
+{
+	REGEX_NFA_SET,
+	REGEX_NFA_SPLIT,
+	REGEX_NFA_LINE_START,
+	REGEX_NFA_LINE_END,
+	REGEX_NFA_MATCH,
+} regex_nfa_kind_t;
+
+typedef struct
+{
+	u32 kind;
+	u32 set;
+	u32 out;
+	u32 out1;
+} regex_nfa_state_t;
+
+typedef struct
+{
+	u8 data[REGEX_MAX_LITERAL];
+	u32 length;
+} regex_literal_t;
+
+typedef struct
+{
+	// NFA states of the set, sorted, at pool[first .. first + count)
+	u32 first;
+	u32 count;
+	u64 hash;
+
+	// A match has been seen, or one completes if the line ends here
+	bool accepts;
+	bool accepts_at_end;
+} regex_dfa_state_t;
+
+typedef struct
+{
+	regex_nfa_state_t *nfa;
+	u32 nfa_count;
+	u32 nfa_start;
+
+	regex_set_t *sets;
+	u32 set_count;
+	u32 set_capacity;
+
+	u8 byte_class[256];
+	u8 class_byte[256];
+	u32 class_count;
+
+	// Lazy DFA, all of it in one block that is reset when either the states or the pool run out
+	regex_dfa_state_t *dfa;
+	u32 dfa_count;
+	u32 dfa_capacity;
+	u32 *next;
+	u32 *pool;
+	u32 pool_used;
+	u32 pool_capacity;
+	u32 *table;
+	u32 table_mask;
+	u32 start_state;
+	u64 flush_count;
+	void *dfa_memory;
+	size_t dfa_memory_size;
+
+	// Closure work space, one entry per NFA state
+	u32 *marks;
+	u32 mark;
+	u32 *stack;
+	u32 *scratch;
+
+	// Every match contains at least one of these, none are known when literal_count is 0
+	u32 literal_count;
+	regex_literal_t literals[REGEX_MAX_LITERALS];
+
+	bool matches_empty_line;
+
+	const char *error;
+	u32 error_pattern;
+} regex_t;
+
+typedef struct
+{
+	regex_node_t *nodes;
+	u32 node_count;
+	u32 node_capacity;
+
+	// Spines of concat and alternate chains, so walking them does not recurse per element
+	u32 *spine;
+	u32 spine_used;
+
+	regex_t *regex;
+
+	u8 const *text;
+	size_t length;
+	size_t at;
+	u32 depth;
+	bool fold_case;
+} regex_parser_t;
+
+typedef struct
+{
+	// Every match is exactly prefix (and suffix)
+	bool is_exact;
+	regex_literal_t prefix;
+	regex_literal_t suffix;
+
+	// One of required[] is in every match
+	u32 required_count;
+	regex_literal_t required[REGEX_MAX_LITERALS];
+} regex_facts_t;
+
+inline static void
+add_regex_set_byte(regex_set_t *set, u8 byte)
+{
+	set->bits[byte >> 6] |= (u64) 1 << (byte & 63);
+}
+
+inline static bool
+is_in_regex_set(regex_set_t const *set, u8 byte)
+{
+	return (set->bits[byte >> 6] >> (byte & 63)) & 1;
+}
+
+inline static void
+add_regex_set_range(regex_set_t *set, u32 low, u32 high)
+{
+	for (u32 byte = low; byte <= high; ++byte)
+	{
+		add_regex_set_byte(set, (u8) byte);
+	}
+}
+
+//
+// Parser
+//
+
+inline static u32
+add_regex_node(regex_parser_t *parser, regex_node_kind_t kind, u32 left, u32 right)
+{
+	if (parser->node_count == parser->node_capacity)
+	{
+		parser->regex->error = "pattern is too large";
+		return REGEX_NONE;
+	}
+
+	regex_node_t *node = &parser->nodes[parser->node_count];
+	memset(node, 0, sizeof(*node));
+
+	node->kind  = kind;
+	node->left  = left;
+	node->right = right;
+
+	return parser->node_count++;
+}
+
+inline static u32
+add_regex_set_node(regex_parser_t *parser, regex_set_t **set)
+{
+	regex_t *regex = parser->regex;
+
+	if (regex->set_count == regex->set_capacity)
+	{
+		regex->error = "pattern is too large";
+		return REGEX_NONE;
+	}
+
+	u32 node = add_regex_node(parser, REGEX_NODE_SET, 0, 0);
+
+	if (node != REGEX_NONE)
+	{
+		parser->nodes[node].set = regex->set_count;
+
+		*set = &regex->sets[regex->set_count++];
+		memset(*set, 0, sizeof(**set));
+	}
+
+	return node;
+}
+
+// Letters in the set get their other case too
+inline static void
+fold_regex_set(regex_set_t *set)
+{
+	for (u32 byte = 'a'; byte <= 'z'; ++byte)
+	{
+		if (is_in_regex_set(set, (u8) byte) || is_in_regex_set(set, (u8) (byte - 0x20)))
+		{
+			add_regex_set_byte(set, (u8) byte);
+			add_regex_set_byte(set, (u8) (byte - 0x20));
+		}
+	}
+}
+
+static u32
+add_regex_byte(regex_parser_t *parser, u8 byte)
+{
+	regex_set_t *set;
+	u32 node = add_regex_set_node(parser, &set);
+
+	if (node != REGEX_NONE)
+	{
+		add_regex_set_byte(set, byte);
+
+		if (parser->fold_case)
+		{
+			fold_regex_set(set);
+			byte = fold_ascii_case(byte);
+		}
+
+		// Lines never contain a newline, a pattern with one cannot match and it is no use as a literal
+		parser->nodes[node].is_literal = (byte != '\n');
+		parser->nodes[node].literal    = byte;
+	}
+
+	return node;
+}
+
+// \d \w \s and their negations, false for anything else
+static bool
+add_regex_class_escape(regex_set_t *set, u8 escape)
+{
+	switch (escape | 0x20)
+	{
+		case 'd':
+		{
+			add_regex_set_range(set, '0', '9');
+		} break;
+
+		case 'w':
+		{
+			add_regex_set_range(set, '0', '9');
+			add_regex_set_range(set, 'a', 'z');
+			add_regex_set_range(set, 'A', 'Z');
+			add_regex_set_byte(set, '_');
+		} break;
+
+		case 's':
+		{
+			add_regex_set_range(set, '\t', '\r');
+			add_regex_set_byte(set, ' ');
+		} break;
+
+		default:
+		{
+			return false;
+		}
+	}
+
+	// Upper case negates
+	if (!(escape & 0x20))
+	{
+		for (u32 i = 0; i < 4; ++i)
+		{
+			set->bits[i] = ~set->bits[i];
+		}
+	}
+
+	return true;
+}
+
+// [:name:] inside brackets, at points just past the opening "[:". Members are given as inclusive byte ranges
+static bool
+add_regex_named_class(regex_parser_t *parser, regex_set_t *set)
+{
+	static const struct
+	{
+		const char *name;
+		const char *ranges;
+	} classes[] =
+	{
+		{ "alpha",  "azAZ" },
+		{ "digit",  "09" },
+		{ "alnum",  "azAZ09" },
+		{ "upper",  "AZ" },
+		{ "lower",  "az" },
+		{ "space",  "\t\r  " },
+		{ "blank",  "\t\t  " },
+		{ "punct",  "!/:@[`{~" },
+		{ "xdigit", "09afAF" },
+	};
+
+	for (u32 i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i)
+	{
+		size_t length = strlen(classes[i].name);
+
+		if (parser->at + length + 2 > parser->length || memcmp(parser->text + parser->at, classes[i].name, length) != 0 ||
+		    parser->text[parser->at + length] != ':' || parser->text[parser->at + length + 1] != ']')
+		{
+			continue;
+		}
+
+		parser->at += length + 2;
+
+		for (const char *range = classes[i].ranges; *range; range += 2)
+		{
+			add_regex_set_range(set, (u8) range[0], (u8) range[1]);
+		}
+
+		return true;
+	}
+
+	parser->regex->error = "unknown character class";
+	return false;
+}
+
+// [...], at points just past the '['. Backslashes are plain bytes in here, as POSIX has it
+static u32
+parse_regex_bracket(regex_parser_t *parser)
+{
+	regex_set_t *set;
+	u32 node = add_regex_set_node(parser, &set);
+
+	if (node == REGEX_NONE)
+	{
+		return REGEX_NONE;
+	}
+
+	bool negate = (parser->at < parser->length && parser->text[parser->at] == '^');
+	parser->at += negate;
+
+	bool first = true;
+
+	for (;;)
+	{
+		if (parser->at >= parser->length)
+		{
+			parser->regex->error = "missing ]";
+			return REGEX_NONE;
+		}
+
+		u8 low = parser->text[parser->at];
+
+		// A ']' right after the opening (or its '^') is a member
+		if (low == ']' && !first)
+		{
+			parser->at += 1;
+			break;
+		}
+
+		first = false;
+
+		if (low == '[' && parser->at + 1 < parser->length && parser->text[parser->at + 1] == ':')
+		{
+			parser->at += 2;
+
+			if (!add_regex_named_class(parser, set))
+			{
+				return REGEX_NONE;
+			}
+
+			continue;
+		}
+
+		parser->at += 1;
+
+		u8 high = low;
+
+		if (parser->at + 1 < parser->length && parser->text[parser->at] == '-' && parser->text[parser->at + 1] != ']')
+		{
+			high        = parser->text[parser->at + 1];
+			parser->at += 2;
+
+			if (high < low)
+			{
+				parser->regex->error = "invalid range";
+				return REGEX_NONE;
+			}
+		}
+
+		add_regex_set_range(set, low, high);
+	}
+
+	if (parser->fold_case)
+	{
+		fold_regex_set(set);
+	}
+
+	if (negate)
+	{
+		for (u32 i = 0; i < 4; ++i)
+		{
+			set->bits[i] = ~set->bits[i];
+		}
+	}
+
+	return node;
+}
+
+static u32 parse_regex_alternation(regex_parser_t *parser);
+
+static u32
+parse_regex_atom(regex_parser_t *parser)
+{
+	u8 c        = parser->text[parser->at];
+	parser->at += 1;
+
+	switch (c)
+	{
+		case '(':
+		{
+			if (++parser->depth > REGEX_MAX_DEPTH)
+			{
+				parser->regex->error = "groups are nested too deep";
+				return REGEX_NONE;
+			}
+
+			u32 node = parse_regex_alternation(parser);
+
+			if (node == REGEX_NONE)
+			{
+				return REGEX_NONE;
+			}
+
+			if (parser->at >= parser->length || parser->text[parser->at] != ')')
+			{
+				parser->regex->error = "missing )";
+				return REGEX_NONE;
+			}
+
+			parser->at    += 1;
+			parser->depth -= 1;
+
+			return node;
+		}
+
+		case '[':
+		{
+			return parse_regex_bracket(parser);
+		}
+
+		case '.':
+		{
+			regex_set_t *set;
+			u32 node = add_regex_set_node(parser, &set);
+
+			if (node != REGEX_NONE)
+			{
+				add_regex_set_range(set, 0, 255);
+				set->bits['\n' >> 6] &= ~((u64) 1 << ('\n' & 63));
+			}
+
+			return node;
+		}
+
+		case '^':
+		{
+			return add_regex_node(parser, REGEX_NODE_LINE_START, 0, 0);
+		}
+
+		case '$':
+		{
+			return add_regex_node(parser, REGEX_NODE_LINE_END, 0, 0);
+		}
+
+		case '\\':
+		{
+			if (parser->at >= parser->length)
+			{
+				parser->regex->error = "trailing backslash";
+				return REGEX_NONE;
+			}
+
+			u8 escape   = parser->text[parser->at];
+			parser->at += 1;
+
+			if (escape == 't' || escape == 'r' || escape == 'n')
+			{
+				return add_regex_byte(parser, (escape == 't') ? '\t' : ((escape == 'r') ? '\r' : '\n'));
+			}
+
+			regex_set_t class_set = {0};
+
+			if (add_regex_class_escape(&class_set, escape))
+			{
+				regex_set_t *set;
+				u32 node = add_regex_set_node(parser, &set);
+
+				if (node != REGEX_NONE)
+				{
+					*set = class_set;
+				}
+
+				return node;
+			}
+
+			return add_regex_byte(parser, escape);
+		}
+
+		default:
+		{
+			// Includes a leading * + ? or {, which grep -E also takes literally
+			return add_regex_byte(parser, c);
+		}
+	}
+}
+
+// {m}, {m,} or {m,n} at parser->at. Anything else leaves at alone and the '{' is read as a literal
+static bool
+parse_regex_bounds(regex_parser_t *parser, u32 *min, u32 *max)
+{
+	size_t at = parser->at + 1;
+	u64 low   = 0;
+	u64 high  = 0;
+
+	size_t digits = 0;
+
+	while (at < parser->length && parser->text[at] >= '0' && parser->text[at] <= '9' && digits < 9)
+	{
+		low = low * 10 + (parser->text[at++] - '0');
+		digits += 1;
+	}
+
+	if (digits == 0)
+	{
+		return false;
+	}
+
+	high = low;
+
+	if (at < parser->length && parser->text[at] == ',')
+	{
+		at    += 1;
+		digits = 0;
+		high   = 0;
+
+		while (at < parser->length && parser->text[at] >= '0' && parser->text[at] <= '9' && digits < 9)
+		{
+			high = high * 10 + (parser->text[at++] - '0');
+			digits += 1;
+		}
+
+		high = digits ? high : REGEX_UNBOUNDED;
+	}
+
+	if (at >= parser->length || parser->text[at] != '}')
+	{
+		return false;
+	}
+
+	parser->at = at + 1;
+
+	*min = (u32) low;
+	*max = (u32) high;
+
+	return true;
+}
+
+static u32
+parse_regex_repeat(regex_parser_t *parser)
+{
+	u32 node    = parse_regex_atom(parser);
+	u32 stacked = 0;
+
+	while (node != REGEX_NONE && parser->at < parser->length)
+	{
+		u8 c    = parser->text[parser->at];
+		u32 min = 0;
+		u32 max = REGEX_UNBOUNDED;
+
+		if (c == '*' || c == '+' || c == '?')
+		{
+			min         = (c == '+') ? 1 : 0;
+			max         = (c == '?') ? 1 : REGEX_UNBOUNDED;
+			parser->at += 1;
+		}
+		else if (c != '{' || !parse_regex_bounds(parser, &min, &max))
+		{
+			break;
+		}
+
+		if (min > REGEX_MAX_REPEAT || (max != REGEX_UNBOUNDED && max > REGEX_MAX_REPEAT))
+		{
+			parser->regex->error = "repeat count is too large";
+			return REGEX_NONE;
+		}
+
+		if (max < min)
+		{
+			parser->regex->error = "invalid repeat bounds";
+			return REGEX_NONE;
+		}
+
+		if (++stacked > REGEX_MAX_STACKED)
+		{
+			parser->regex->error = "too many stacked repeats";
+			return REGEX_NONE;
+		}
+
+		u32 repeat = add_regex_node(parser, REGEX_NODE_REPEAT, node, 0);
+
+		if (repeat != REGEX_NONE)
+		{
+			parser->nodes[repeat].min = min;
+			parser->nodes[repeat].max = max;
+		}
+
+		node = repeat;
+	}
+
+	return node;
+}
+
+static u32
+parse_regex_concat(regex_parser_t *parser)
+{
+	u32 node = REGEX_NONE;
+
+	while (parser->at < parser->length && parser->text[parser->at] != '|' && parser->text[parser->at] != ')')
+	{
+		u32 item = parse_regex_repeat(parser);
+
+		if (item == REGEX_NONE)
+		{
+			return REGEX_NONE;
+		}
+
+		node = (node == REGEX_NONE) ? item : add_regex_node(parser, REGEX_NODE_CONCAT, node, item);
+
+		if (node == REGEX_NONE)
+		{
+			return REGEX_NONE;
+		}
+	}
+
+	return (node == REGEX_NONE) ? add_regex_node(parser, REGEX_NODE_EMPTY, 0, 0) : node;
+}
+
+static u32
+parse_regex_alternation(regex_parser_t *parser)
+{
+	u32 node = parse_regex_concat(parser);
+
+	while (node != REGEX_NONE && parser->at < parser->length && parser->text[parser->at] == '|')
+	{
+		parser->at += 1;
+
+		u32 item = parse_regex_concat(parser);
+
+		node = (item == REGEX_NONE) ? REGEX_NONE : add_regex_node(parser, REGEX_NODE_ALTERNATE, node, item);
+	}
+
+	return node;
+}
+
+// Children of a left leaning chain of kind, first to last, pushed on parser->spine. Returns how many
+inline static u32
+push_regex_spine(regex_parser_t *parser, u32 node_index, regex_node_kind_t kind)
+{
+	u32 count = 0;
+
+	while (parser->nodes[node_index].kind == kind)
+	{
+		parser->spine[parser->spine_used + count++] = parser->nodes[node_index].right;
+		node_index                                  = parser->nodes[node_index].left;
+	}
+
+	parser->spine[parser->spine_used + count++] = node_index;
+
+	// Collected last to first
+	for (u32 i = 0; i < count / 2; ++i)
+	{
+		u32 swap                                            = parser->spine[parser->spine_used + i];
+		parser->spine[parser->spine_used + i]               = parser->spine[parser->spine_used + count - 1 - i];
+		parser->spine[parser->spine_used + count - 1 - i]   = swap;
+	}
+
+	parser->spine_used += count;
+
+	return count;
+}
+
+//
+// Literal extraction
+//
+
+inline static void
+join_regex_literals(regex_literal_t *out, regex_literal_t const *a, regex_literal_t const *b, bool keep_end)
+{
+	regex_literal_t joined;
+	joined.length = 0;
+
+	u32 total = a->length + b->length;
+	u32 skip  = (keep_end && total > REGEX_MAX_LITERAL) ? total - REGEX_MAX_LITERAL : 0;
+
+	for (u32 i = skip; i < total && joined.length < REGEX_MAX_LITERAL; ++i)
+	{
+		joined.data[joined.length++] = (i < a->length) ? a->data[i] : b->data[i - a->length];
+	}
+
+	*out = joined;
+}
+
+inline static u32
+get_regex_facts_score(regex_facts_t const *facts)
+{
+	u32 score = facts->required_count ? REGEX_MAX_LITERAL : 0;
+
+	for (u32 i = 0; i < facts->required_count; ++i)
+	{
+		score = MIN(score, facts->required[i].length);
+	}
+
+	return score;
+}
+
+// A single required literal replaces the set when it is at least as long as the set's shortest
+inline static void
+consider_regex_literal(regex_facts_t *facts, regex_literal_t const *literal)
+{
+	u32 score = get_regex_facts_score(facts);
+
+	if (literal->length > score || (literal->length == score && literal->length && facts->required_count > 1))
+	{
+		facts->required[0]     = *literal;
+		facts->required_count  = 1;
+	}
+}
+
+inline static void
+consider_regex_facts(regex_facts_t *facts, regex_facts_t const *other)
+{
+	u32 score       = get_regex_facts_score(facts);
+	u32 other_score = get_regex_facts_score(other);
+
+	if (other_score > score || (other_score == score && other_score && other->required_count < facts->required_count))
+	{
+		facts->required_count = other->required_count;
+		memcpy(facts->required, other->required, sizeof(regex_literal_t) * other->required_count);
+	}
+}
+
+static void
+concat_regex_facts(regex_facts_t *a, regex_facts_t const *b)
+{
+	regex_literal_t bridge;
+	join_regex_literals(&bridge, &a->suffix, &b->prefix, false);
+
+	bool is_exact = a->is_exact && b->is_exact && a->prefix.length + b->prefix.length <= REGEX_MAX_LITERAL;
+
+	if (a->is_exact)
+	{
+		join_regex_literals(&a->prefix, &a->prefix, &b->prefix, false);
+	}
+
+	if (b->is_exact)
+	{
+		join_regex_literals(&a->suffix, &a->suffix, &b->suffix, true);
+	}
+	else
+	{
+		a->suffix = b->suffix;
+	}
+
+	a->is_exact = is_exact;
+
+	consider_regex_facts(a, b);
+	consider_regex_literal(a, &bridge);
+	consider_regex_literal(a, &a->prefix);
+	consider_regex_literal(a, &a->suffix);
+}
+
+static void
+alternate_regex_facts(regex_facts_t *a, regex_facts_t const *b)
+{
+	a->is_exact = a->is_exact && b->is_exact && a->prefix.length == b->prefix.length &&
+	              memcmp(a->prefix.data, b->prefix.data, a->prefix.length) == 0;
+
+	u32 prefix_length = 0;
+
+	while (prefix_length < a->prefix.length && prefix_length < b->prefix.length && a->prefix.data[prefix_length] == b->prefix.data[prefix_length])
+	{
+		prefix_length += 1;
+	}
+
+	u32 suffix_length = 0;
+
+	while (suffix_length < a->suffix.length && suffix_length < b->suffix.length &&
+	       a->suffix.data[a->suffix.length - 1 - suffix_length] == b->suffix.data[b->suffix.length - 1 - suffix_length])
+	{
+		suffix_length += 1;
+	}
+
+	a->prefix.length = prefix_length;
+
+	memmove(a->suffix.data, a->suffix.data + a->suffix.length - suffix_length, suffix_length);
+	a->suffix.length = suffix_length;
+
+	// Either side's literals, as long as both sides have some and they fit
+	bool fits = a->required_count && b->required_count;
+
+	for (u32 i = 0; i < b->required_count && fits; ++i)
+	{
+		bool seen = false;
+
+		for (u32 j = 0; j < a->required_count && !seen; ++j)
+		{
+			seen = (a->required[j].length == b->required[i].length) && memcmp(a->required[j].data, b->required[i].data, b->required[i].length) == 0;
+		}
+
+		if (!seen)
+		{
+			fits = (a->required_count < REGEX_MAX_LITERALS);
+
+			if (fits)
+			{
+				a->required[a->required_count++] = b->required[i];
+			}
+		}
+	}
+
+	a->required_count = fits ? a->required_count : 0;
+
+	consider_regex_literal(a, &a->prefix);
+	consider_regex_literal(a, &a->suffix);
+}
+
+static void
+collect_regex_facts(regex_parser_t *parser, u32 node_index, regex_facts_t *facts)
+{
+	regex_node_t const *node = &parser->nodes[node_index];
+
+	memset(facts, 0, sizeof(*facts));
+
+	switch (node->kind)
+	{
+		case REGEX_NODE_EMPTY:
+		case REGEX_NODE_LINE_START:
+		case REGEX_NODE_LINE_END:
+		{
+			facts->is_exact = true;
+		} break;
+
+		case REGEX_NODE_SET:
+		{
+			if (node->is_literal)
+			{
+				facts->is_exact       = true;
+				facts->prefix.data[0] = node->literal;
+				facts->prefix.length  = 1;
+				facts->suffix         = facts->prefix;
+				facts->required[0]    = facts->prefix;
+				facts->required_count = 1;
+			}
+		} break;
+
+		case REGEX_NODE_CONCAT:
+		case REGEX_NODE_ALTERNATE:
+		{
+			u32 first = parser->spine_used;
+			u32 count = push_regex_spine(parser, node_index, node->kind);
+
+			regex_facts_t item;
+			collect_regex_facts(parser, parser->spine[first], facts);
+
+			for (u32 i = 1; i < count; ++i)
+			{
+				collect_regex_facts(parser, parser->spine[first + i], &item);
+
+				if (node->kind == REGEX_NODE_CONCAT)
+				{
+					concat_regex_facts(facts, &item);
+				}
+				else
+				{
+					alternate_regex_facts(facts, &item);
+				}
+			}
+
+			parser->spine_used = first;
+		} break;
+
+		case REGEX_NODE_REPEAT:
+		{
+			if (node->max == 0)
+			{
+				facts->is_exact = true;
+			}
+			else if (node->min > 0)
+			{
+				collect_regex_facts(parser, node->left, facts);
+
+				if (facts->is_exact && node->min == node->max && facts->prefix.length * node->min <= REGEX_MAX_LITERAL)
+				{
+					regex_literal_t once = facts->prefix;
+
+					for (u32 i = 1; i < node->min; ++i)
+					{
+						join_regex_literals(&facts->prefix, &facts->prefix, &once, false);
+					}
+
+					facts->suffix = facts->prefix;
+					consider_regex_literal(facts, &facts->prefix);
+				}
+				else
+				{
+					facts->is_exact = false;
+				}
+			}
+		} break;
+	}
+}
+
+//
+// NFA
+//
+
+inline static u32
+add_regex_nfa_state(regex_t *regex, regex_nfa_kind_t kind, u32 set, u32 out, u32 out1)
+{
+	if (regex->nfa_count == REGEX_MAX_NFA_STATES)
+	{
+		regex->error = "pattern is too large";
+		return REGEX_NONE;
+	}
+
+	regex_nfa_state_t *state = &regex->nfa[regex->nfa_count];
+
+	state->kind = kind;
+	state->set  = set;
+	state->out  = out;
+	state->out1 = out1;
+
+	return regex->nfa_count++;
+}
+
+// Built back to front: returns the state that matches node and then continues at next
+static u32
+compile_regex_node(regex_parser_t *parser, u32 node_index, u32 next)
+{
+	regex_t *regex           = parser->regex;
+	regex_node_t const *node = &parser->nodes[node_index];
+
+	if (next == REGEX_NONE)
+	{
+		return REGEX_NONE;
+	}
+
+	switch (node->kind)
+	{
+		case REGEX_NODE_EMPTY:
+		{
+			return next;
+		}
+
+		case REGEX_NODE_SET:
+		{
+			return add_regex_nfa_state(regex, REGEX_NFA_SET, node->set, next, REGEX_NONE);
+		}
+
+		case REGEX_NODE_LINE_START:
+		{
+			return add_regex_nfa_state(regex, REGEX_NFA_LINE_START, 0, next, REGEX_NONE);
+		}
+
+		case REGEX_NODE_LINE_END:
+		{
+			return add_regex_nfa_state(regex, REGEX_NFA_LINE_END, 0, next, REGEX_NONE);
+		}
+
+		case REGEX_NODE_CONCAT:
+		case REGEX_NODE_ALTERNATE:
+		{
+			u32 first = parser->spine_used;
+			u32 count = push_regex_spine(parser, node_index, node->kind);
+			u32 start = next;
+
+			for (u32 i = count; i-- > 0;)
+			{
+				u32 item = compile_regex_node(parser, parser->spine[first + i], (node->kind == REGEX_NODE_CONCAT) ? start : next);
+
+				if (item == REGEX_NONE)
+				{
+					start = REGEX_NONE;
+					break;
+				}
+
+				// Concats chain into the item after them, alternates put each branch in front of the rest
+				start = (node->kind == REGEX_NODE_CONCAT || i == count - 1) ? item : add_regex_nfa_state(regex, REGEX_NFA_SPLIT, 0, item, start);
+
+				if (start == REGEX_NONE)
+				{
+					break;
+				}
+			}
+
+			parser->spine_used = first;
+
+			return start;
+		}
+
+		case REGEX_NODE_REPEAT:
+		{
+			u32 tail = next;
+
+			if (node->max == REGEX_UNBOUNDED)
+			{
+				u32 loop = add_regex_nfa_state(regex, REGEX_NFA_SPLIT, 0, REGEX_NONE, next);
+
+				if (loop == REGEX_NONE)
+				{
+					return REGEX_NONE;
+				}
+
+				u32 body = compile_regex_node(parser, node->left, loop);
+
+				if (body == REGEX_NONE)
+				{
+					return REGEX_NONE;
+				}
+
+				regex->nfa[loop].out = body;
+				tail                 = loop;
+			}
+			else
+			{
+				for (u32 i = node->min; i < node->max && tail != REGEX_NONE; ++i)
+				{
+					u32 body = compile_regex_node(parser, node->left, tail);
+
+					tail = (body == REGEX_NONE) ? REGEX_NONE : add_regex_nfa_state(regex, REGEX_NFA_SPLIT, 0, body, next);
+				}
+			}
+
+			for (u32 i = 0; i < node->min && tail != REGEX_NONE; ++i)
+			{
+				tail = compile_regex_node(parser, node->left, tail);
+			}
+
+			return tail;
+		}
+	}
+
+	return REGEX_NONE;
+}
+
+// Splits the bytes into classes that every set either fully contains or fully excludes
+static void
+init_regex_byte_classes(regex_t *regex)
+{
+	memset(regex->byte_class, 0, sizeof(regex->byte_class));
+	regex->class_count = 1;
+
+	u32 split[256 * 2];
+
+	for (u32 s = 0; s < regex->set_count; ++s)
+	{
+		memset(split, 0xFF, sizeof(split));
+
+		u32 class_count = 0;
+
+		for (u32 byte = 0; byte < 256; ++byte)
+		{
+			u32 key = regex->byte_class[byte] * 2 + is_in_regex_set(&regex->sets[s], (u8) byte);
+
+			if (split[key] == REGEX_NONE)
+			{
+				split[key] = class_count++;
+			}
+
+			regex->byte_class[byte] = (u8) split[key];
+		}
+
+		regex->class_count = class_count;
+	}
+
+	for (u32 byte = 256; byte-- > 0;)
+	{
+		regex->class_byte[regex->byte_class[byte]] = (u8) byte;
+	}
+}
+
+//
+// Lazy DFA
+//
+
+inline static void
+flush_regex_dfa(regex_t *regex)
+{
+	regex->dfa_count   = 0;
+	regex->pool_used   = 0;
+	regex->start_state = REGEX_NONE;
+
+	memset(regex->table, 0xFF, (size_t) (regex->table_mask + 1) * sizeof(u32));
+}
+
+inline static void
+begin_regex_set(regex_t *regex)
+{
+	if (++regex->mark == 0)
+	{
+		memset(regex->marks, 0, regex->nfa_count * sizeof(u32));
+		regex->mark = 1;
+	}
+}
+
+inline static void
+push_regex_state(regex_t *regex, u32 state, u32 *top)
+{
+	if (regex->marks[state] != regex->mark)
+	{
+		regex->marks[state]   = regex->mark;
+		regex->stack[(*top)++] = state;
+	}
+}
+
+// Adds the states reachable from state without consuming a byte to scratch. Only byte consuming, end of line
+// and match states are kept, they are all a DFA state needs to go on
+static void
+add_regex_closure(regex_t *regex, u32 state, bool at_line_start, u32 *count)
+{
+	u32 top = 0;
+	push_regex_state(regex, state, &top);
+
+	while (top)
+	{
+		u32 index                    = regex->stack[--top];
+		regex_nfa_state_t const *nfa = &regex->nfa[index];
+
+		switch (nfa->kind)
+		{
+			case REGEX_NFA_SPLIT:
+			{
+				push_regex_state(regex, nfa->out1, &top);
+				push_regex_state(regex, nfa->out, &top);
+			} break;
+
+			case REGEX_NFA_LINE_START:
+			{
+				if (at_line_start)
+				{
+					push_regex_state(regex, nfa->out, &top);
+				}
+			} break;
+
+			default:
+			{
+				regex->scratch[(*count)++] = index;
+			} break;
+		}
+	}
+}
+
+// Whether a match follows once the line ends right at state. On an empty line ^ still holds there too
+static bool
+reaches_regex_match_at_end(regex_t *regex, u32 state, bool at_line_start)
+{
+	begin_regex_set(regex);
+
+	u32 top = 0;
+	push_regex_state(regex, state, &top);
+
+	while (top)
+	{
+		regex_nfa_state_t const *nfa = &regex->nfa[regex->stack[--top]];
+
+		switch (nfa->kind)
+		{
+			case REGEX_NFA_MATCH:
+			{
+				return true;
+			}
+
+			case REGEX_NFA_SPLIT:
+			{
+				push_regex_state(regex, nfa->out1, &top);
+				push_regex_state(regex, nfa->out, &top);
+			} break;
+
+			case REGEX_NFA_LINE_START:
+			{
+				if (at_line_start)
+				{
+					push_regex_state(regex, nfa->out, &top);
+				}
+			} break;
+
+			case REGEX_NFA_LINE_END:
+			{
+				push_regex_state(regex, nfa->out, &top);
+			} break;
+
+			default:
+			{
+			} break;
+		}
+	}
+
+	return false;
+}
+
+static int
+compare_regex_states(const void *a, const void *b)
+{
+	u32 left  = *(u32 const *) a;
+	u32 right = *(u32 const *) b;
+
+	return (left > right) - (left < right);
+}
+
+// The DFA state for the NFA set in scratch, REGEX_NONE when the cache has no room for a new one
+static u32
+add_regex_dfa_state(regex_t *regex, u32 count)
+{
+	qsort(regex->scratch, count, sizeof(u32), compare_regex_states);
+
+	u64 hash = XXH64(regex->scratch, count * sizeof(u32), 0);
+	u32 slot = (u32) hash & regex->table_mask;
+
+	for (;; slot = (slot + 1) & regex->table_mask)
+	{
+		u32 index = regex->table[slot];
+
+		if (index == REGEX_NONE)
+		{
+			break;
+		}
+
+		regex_dfa_state_t const *state = &regex->dfa[index];
+
+		if (state->hash == hash && state->count == count && memcmp(regex->pool + state->first, regex->scratch, count * sizeof(u32)) == 0)
+		{
+			return index;
+		}
+	}
+
+	if (regex->dfa_count == regex->dfa_capacity || regex->pool_used + count > regex->pool_capacity)
+	{
+		return REGEX_NONE;
+	}
+
+	u32 index                = regex->dfa_count++;
+	regex_dfa_state_t *state = &regex->dfa[index];
+
+	state->first          = regex->pool_used;
+	state->count          = count;
+	state->hash           = hash;
+	state->accepts        = false;
+	state->accepts_at_end = false;
+
+	memcpy(regex->pool + state->first, regex->scratch, count * sizeof(u32));
+	regex->pool_used += count;
+
+	memset(regex->next + (size_t) index * regex->class_count, 0xFF, regex->class_count * sizeof(u32));
+	regex->table[slot] = index;
+
+	// From the pool, reaches_regex_match_at_end reuses the closure work space
+	for (u32 i = 0; i < count; ++i)
+	{
+		u32 nfa_index = regex->pool[state->first + i];
+
+		if (regex->nfa[nfa_index].kind == REGEX_NFA_MATCH)
+		{
+			state->accepts = true;
+		}
+		else if (regex->nfa[nfa_index].kind == REGEX_NFA_LINE_END && !state->accepts_at_end)
+		{
+			state->accepts_at_end = reaches_regex_match_at_end(regex, regex->nfa[nfa_index].out, false);
+		}
+	}
+
+	state->accepts_at_end |= state->accepts;
+
+	return index;
+}
+
+// Adds the set in scratch, flushing the cache first when it is full. The cache always has room for one state
+inline static u32
+add_regex_dfa_state_or_flush(regex_t *regex, u32 count, bool *flushed)
+{
+	u32 index = add_regex_dfa_state(regex, count);
+	*flushed  = (index == REGEX_NONE);
+
+	if (*flushed)
+	{
+		// The sort already happened, scratch is left as it was
+		flush_regex_dfa(regex);
+		regex->flush_count += 1;
+
+		index = add_regex_dfa_state(regex, count);
+	}
+
+	return index;
+}
+
+static u32
+get_regex_start_state(regex_t *regex)
+{
+	if (regex->start_state == REGEX_NONE)
+	{
+		u32 count = 0;
+
+		begin_regex_set(regex);
+		add_regex_closure(regex, regex->nfa_start, true, &count);
+
+		bool flushed;
+		regex->start_state = add_regex_dfa_state_or_flush(regex, count, &flushed);
+	}
+
+	return regex->start_state;
+}
+
+static u32
+add_regex_transition(regex_t *regex, u32 from, u32 byte_class)
+{
+	u8 byte   = regex->class_byte[byte_class];
+	u32 count = 0;
+
+	begin_regex_set(regex);
+
+	regex_dfa_state_t const *state = &regex->dfa[from];
+
+	for (u32 i = 0; i < state->count; ++i)
+	{
+		regex_nfa_state_t const *nfa = &regex->nfa[regex->pool[state->first + i]];
+
+		if (nfa->kind == REGEX_NFA_SET && is_in_regex_set(&regex->sets[nfa->set], byte))
+		{
+			add_regex_closure(regex, nfa->out, false, &count);
+		}
+	}
+
+	// Unanchored, a match can also start at the next byte
+	add_regex_closure(regex, regex->nfa_start, false, &count);
+
+	bool flushed;
+	u32 to = add_regex_dfa_state_or_flush(regex, count, &flushed);
+
+	// A flush took from with it
+	if (!flushed)
+	{
+		regex->next[(size_t) from * regex->class_count + byte_class] = to;
+	}
+
+	return to;
+}
+
+//
+// Whether the pattern matches anywhere in line, which holds no newline
+//
+static bool
+match_regex_line(regex_t *regex, u8 const *line, size_t length)
+{
+	if (length == 0)
+	{
+		return regex->matches_empty_line;
+	}
+
+	u32 state = get_regex_start_state(regex);
+
+	for (size_t i = 0; i < length; ++i)
+	{
+		if (regex->dfa[state].accepts)
+		{
+			return true;
+		}
+
+		u32 byte_class = regex->byte_class[line[i]];
+		u32 next       = regex->next[(size_t) state * regex->class_count + byte_class];
+
+		state = (next == REGEX_NONE) ? add_regex_transition(regex, state, byte_class) : next;
+	}
+
+	return regex->dfa[state].accepts_at_end;
+}
+
+inline static void
+free_regex(regex_t *regex)
+{
+	free_pages(regex->nfa, REGEX_MAX_NFA_STATES * sizeof(regex_nfa_state_t));
+	free_pages(regex->sets, regex->set_capacity * sizeof(regex_set_t));
+	free_pages(regex->marks, (size_t) regex->nfa_count * 3 * sizeof(u32));
+	free_pages(regex->dfa_memory, regex->dfa_memory_size);
+
+	regex->nfa        = NULL;
+	regex->sets       = NULL;
+	regex->marks      = NULL;
+	regex->dfa_memory = NULL;
+}
+
+//
+// A line matches when any of the patterns matches somewhere in it. With fold_case, ASCII letters match either
+// case and the literals come out lowered. On failure regex->error says why and regex->error_pattern which one
+//
+static bool
+init_regex(regex_t *regex, char const *const *patterns, u32 pattern_count, bool fold_case)
+{
+	memset(regex, 0, sizeof(*regex));
+
+	size_t total_length = 0;
+
+	for (u32 i = 0; i < pattern_count; ++i)
+	{
+		total_length += strlen(patterns[i]);
+	}
+
+	// Every pattern byte adds at most a few nodes (an atom, its concat and a repeat, or an alternate and an empty)
+	regex_parser_t parser = {0};
+	parser.regex          = regex;
+	parser.fold_case      = fold_case;
+	parser.node_capacity  = (u32) MIN(4 * (total_length + pattern_count) + 16, 0x7FFFFFFF);
+
+	regex->set_capacity = (u32) MIN(total_length + 16, 0x7FFFFFFF);
+	regex->sets         = (regex_set_t *) alloc_pages(regex->set_capacity * sizeof(regex_set_t));
+	regex->nfa          = (regex_nfa_state_t *) alloc_pages(REGEX_MAX_NFA_STATES * sizeof(regex_nfa_state_t));
+
+	size_t parser_size = (size_t) parser.node_capacity * (sizeof(regex_node_t) + sizeof(u32));
+	u8 *parser_memory  = (u8 *) alloc_pages(parser_size);
+
+	if (!regex->sets || !regex->nfa || !parser_memory)
+	{
+		regex->error = "out of memory";
+		free_pages(parser_memory, parser_size);
+		return false;
+	}
+
+	parser.nodes = (regex_node_t *) parser_memory;
+	parser.spine = (u32 *) (parser.nodes + parser.node_capacity);
+
+	u32 root = REGEX_NONE;
+
+	for (u32 i = 0; i < pattern_count && !regex->error; ++i)
+	{
+		parser.text   = (u8 const *) patterns[i];
+		parser.length = strlen(patterns[i]);
+		parser.at     = 0;
+		parser.depth  = 0;
+
+		u32 node = parse_regex_alternation(&parser);
+
+		if (node != REGEX_NONE && parser.at < parser.length)
+		{
+			regex->error = "unmatched )";
+		}
+
+		root = (root == REGEX_NONE || node == REGEX_NONE) ? node : add_regex_node(&parser, REGEX_NODE_ALTERNATE, root, node);
+
+		regex->error_pattern = i;
+	}
+
+	if (!regex->error)
+	{
+		regex_facts_t facts;
+		collect_regex_facts(&parser, root, &facts);
+
+		if (get_regex_facts_score(&facts) > 0)
+		{
+			regex->literal_count = facts.required_count;
+			memcpy(regex->literals, facts.required, sizeof(regex_literal_t) * facts.required_count);
+		}
+
+		u32 match        = add_regex_nfa_state(regex, REGEX_NFA_MATCH, 0, REGEX_NONE, REGEX_NONE);
+		regex->nfa_start = compile_regex_node(&parser, root, match);
+	}
+
+	free_pages(parser_memory, parser_size);
+
+	if (regex->error)
+	{
+		return false;
+	}
+
+	init_regex_byte_classes(regex);
+
+	regex->marks   = (u32 *) alloc_pages((size_t) regex->nfa_count * 3 * sizeof(u32));
+	regex->stack   = regex->marks + regex->nfa_count;
+	regex->scratch = regex->stack + regex->nfa_count;
+
+	// Half the cache for states and their transitions, half for their NFA sets, which is always enough for one
+	size_t state_size    = sizeof(regex_dfa_state_t) + regex->class_count * sizeof(u32) + 2 * sizeof(u32);
+	regex->dfa_capacity  = (u32) MAX((REGEX_DFA_CACHE_SIZE / 2) / state_size, 16);
+	regex->pool_capacity = (u32) MAX((REGEX_DFA_CACHE_SIZE / 2) / sizeof(u32), 2 * (size_t) regex->nfa_count);
+
+	u32 table_size = 16;
+
+	while (table_size < 2 * regex->dfa_capacity)
+	{
+		table_size *= 2;
+	}
+
+	regex->table_mask      = table_size - 1;
+	regex->dfa_memory_size = (size_t) regex->dfa_capacity * (sizeof(regex_dfa_state_t) + regex->class_count * sizeof(u32)) +
+	                         (size_t) regex->pool_capacity * sizeof(u32) + (size_t) table_size * sizeof(u32);
+	regex->dfa_memory      = alloc_pages(regex->dfa_memory_size);
+
+	if (!regex->marks || !regex->dfa_memory)
+	{
+		regex->error = "out of memory";
+		return false;
+	}
+
+	regex->dfa   = (regex_dfa_state_t *) regex->dfa_memory;
+	regex->next  = (u32 *) (regex->dfa + regex->dfa_capacity);
+	regex->pool  = regex->next + (size_t) regex->dfa_capacity * regex->class_count;
+	regex->table = regex->pool + regex->pool_capacity;
+
+	flush_regex_dfa(regex);
+
+	regex->matches_empty_line = reaches_regex_match_at_end(regex, regex->nfa_start, true);
+
+	return true;
+}
@@ -0,0 +1,112 @@
+//
+// Memory bandwidth ceilings measured by read_speed_test --roofline, saved as "name MB/s" lines. The tools load
+// them with --roofline=<file> to show how close their throughput gets to what the machine can stream.
+//
+
+typedef enum
+{
+	ROOFLINE_L1_SCAN,
+	ROOFLINE_L2_SCAN,
+	ROOFLINE_L3_SCAN,
+	ROOFLINE_DRAM_READ_SINGLE,
+	ROOFLINE_DRAM_READ_ALL,
+	ROOFLINE_MEMCPY_SINGLE,
+	ROOFLINE_MEMCPY_ALL,
+
+	ROOFLINE_COUNT
+} roofline_ceiling_t;
+
+static const char *roofline_names[ROOFLINE_COUNT] =
+{
+	"l1_scan",
+	"l2_scan",
+	"l3_scan",
+	"dram_read_single",
+	"dram_read_all",
+	"memcpy_single",
+	"memcpy_all",
+};
+
+typedef struct
+{
+	// MB/s, 0 when not measured
+	f64 mb_per_sec[ROOFLINE_COUNT];
+} roofline_t;
+
+inline static bool
+save_roofline(const char *path, roofline_t *roofline)
+{
+	FILE *file = fopen(path, "wt");
+
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	for (u32 i = 0; i < ROOFLINE_COUNT; ++i)
+	{
+		fprintf(file, "%s %.2lf\n", roofline_names[i], roofline->mb_per_sec[i]);
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+inline static bool
+load_roofline(const char *path, roofline_t *roofline)
+{
+	memset(roofline, 0, sizeof(*roofline));
+
+	FILE *file = fopen(path, "rt");
+
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	char name[64];
+	double value = 0;
+
+	while (fscanf(file, "%63s %lf", name, &value) == 2)
+	{
+		for (u32 i = 0; i < ROOFLINE_COUNT; ++i)
+		{
+			if (strcmp(name, roofline_names[i]) == 0)
+			{
+				roofline->mb_per_sec[i] = value;
+			}
+		}
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+//
+// Goes after a tool's "(took ... MB/s)" line. thread_count is how many threads did the reading and processing,
+// one core streaming is held to the single-core DRAM read ceiling and several to the all-core one
+//
+inline static void
+print_roofline_percent(const char *roofline_path, double mb_per_sec, u32 thread_count)
+{
+	if (roofline_path == NULL)
+	{
+		return;
+	}
+
+	roofline_ceiling_t ceiling_id = (thread_count > 1) ? ROOFLINE_DRAM_READ_ALL : ROOFLINE_DRAM_READ_SINGLE;
+
+	roofline_t roofline;
+
+	if (!load_roofline(roofline_path, &roofline) || roofline.mb_per_sec[ceiling_id] <= 0)
+	{
+		fprintf(stderr, "(could not load the %s roofline from %s)\n", roofline_names[ceiling_id], roofline_path);
+		return;
+	}
+
+	f64 ceiling = roofline.mb_per_sec[ceiling_id];
+
+	printf("(%.01lf%% of the %s roofline of %.00lf MB/s)\n", (mb_per_sec / ceiling) * 100, roofline_names[ceiling_id], ceiling);
+}
@@ -0,0 +1,238 @@
+//
+// Kernel dispatch table, filled once at startup from the detected CPU features. The tools call through simd.*
+// instead of naming a StringZilla backend, so one binary runs on any x64 host and uses the widest vectors it
+// has. FILEUTILS_SIMD or --simd=<level> forces a lower level, to compare kernels or rule one out.
+//
+
+typedef enum
+{
+	SIMD_LEVEL_SERIAL,
+	SIMD_LEVEL_SSE2,
+	SIMD_LEVEL_AVX2,
+	SIMD_LEVEL_AVX512,
+	SIMD_LEVEL_NEON,
+
+	SIMD_LEVEL_COUNT
+} simd_level_t;
+
+static const char *simd_level_names[SIMD_LEVEL_COUNT] =
+{
+	"serial",
+	"sse2",
+	"avx2",
+	"avx512",
+	"neon",
+};
+
+typedef sz_cptr_t (*find_byte_proc_t)(sz_cptr_t haystack, sz_size_t length, sz_cptr_t needle);
+typedef sz_cptr_t (*find_charset_proc_t)(sz_cptr_t text, sz_size_t length, sz_charset_t const *set);
+typedef sz_cptr_t (*find_proc_t)(sz_cptr_t haystack, sz_size_t length, sz_cptr_t needle, sz_size_t needle_length);
+typedef void (*copy_proc_t)(sz_ptr_t target, sz_cptr_t source, sz_size_t length);
+typedef void (*fill_proc_t)(sz_ptr_t target, sz_size_t length, sz_u8_t value);
+typedef u64 (*count_byte_proc_t)(u8 const *data, size_t size, u8 byte);
+typedef void (*text_stats_proc_t)(text_stats_t *stats, u8 const *data, size_t size);
+typedef void (*line_lengths_proc_t)(line_stats_t *stats, u8 const *data, size_t size, u64 offset);
+
+typedef struct
+{
+	simd_level_t level;
+
+	find_byte_proc_t find_byte;
+	find_byte_proc_t rfind_byte;
+	find_charset_proc_t find_charset;
+	find_proc_t find;
+	find_proc_t find_case;
+	copy_proc_t copy;
+	fill_proc_t fill;
+	count_byte_proc_t count_byte;
+	text_stats_proc_t text_stats;
+	line_lengths_proc_t line_lengths;
+} simd_kernels_t;
+
+// Serial until init_simd_dispatch runs, so a tool that never calls it is still correct
+static simd_kernels_t simd =
+{
+	SIMD_LEVEL_SERIAL,
+	sz_find_byte_serial,
+	sz_rfind_byte_serial,
+	sz_find_charset_serial,
+	sz_find_serial,
+	find_ascii_case_serial,
+	sz_copy_serial,
+	sz_fill_serial,
+	count_byte_serial,
+	count_text_stats_serial,
+	collect_line_lengths_serial,
+};
+
+inline static simd_level_t
+get_best_simd_level()
+{
+	u32 features = get_cpu_features();
+
+#if defined(ARCH_X64)
+	u32 avx512 = CPU_FEATURE_AVX512BW | CPU_FEATURE_AVX512VL | CPU_FEATURE_BMI2 | CPU_FEATURE_POPCNT;
+
+	if ((features & avx512) == avx512)
+	{
+		return SIMD_LEVEL_AVX512;
+	}
+
+	if ((features & (CPU_FEATURE_AVX2 | CPU_FEATURE_POPCNT)) == (CPU_FEATURE_AVX2 | CPU_FEATURE_POPCNT))
+	{
+		return SIMD_LEVEL_AVX2;
+	}
+
+	if (features & CPU_FEATURE_SSE2)
+	{
+		return SIMD_LEVEL_SSE2;
+	}
+#elif defined(ARCH_ARM64)
+	if (features & CPU_FEATURE_NEON)
+	{
+		return SIMD_LEVEL_NEON;
+	}
+#endif
+
+	return SIMD_LEVEL_SERIAL;
+}
+
+// Levels order by width on x64, NEON is only ever the best (or only) level on ARM64
+inline static bool
+is_simd_level_supported(simd_level_t level, simd_level_t best)
+{
+	if (level == SIMD_LEVEL_SERIAL || level == best)
+	{
+		return true;
+	}
+
+	return (best != SIMD_LEVEL_NEON) && (level != SIMD_LEVEL_NEON) && (level <= best);
+}
+
+inline static void
+set_simd_level(simd_level_t level)
+{
+	simd.level = level;
+
+	simd.find_byte    = sz_find_byte_serial;
+	simd.rfind_byte   = sz_rfind_byte_serial;
+	simd.find_charset = sz_find_charset_serial;
+	simd.find         = sz_find_serial;
+	simd.find_case    = find_ascii_case_serial;
+	simd.copy         = sz_copy_serial;
+	simd.fill         = sz_fill_serial;
+	simd.count_byte   = count_byte_serial;
+	simd.text_stats   = count_text_stats_serial;
+	simd.line_lengths = collect_line_lengths_serial;
+
+	switch (level)
+	{
+#if defined(ARCH_X64)
+		case SIMD_LEVEL_SSE2:
+		{
+			// StringZilla has no SSE backend, only counting and case-insensitive search get wider
+			simd.find_case    = find_ascii_case_sse2;
+			simd.count_byte   = count_byte_sse2;
+			simd.text_stats   = count_text_stats_sse2;
+			simd.line_lengths = collect_line_lengths_sse2;
+		} break;
+
+		case SIMD_LEVEL_AVX2:
+		{
+			simd.find_byte    = sz_find_byte_avx2;
+			simd.rfind_byte   = sz_rfind_byte_avx2;
+			simd.find_charset = sz_find_charset_avx2;
+			simd.find         = sz_find_avx2;
+			simd.find_case    = find_ascii_case_avx2;
+			simd.copy         = sz_copy_avx2;
+			simd.fill         = sz_fill_avx2;
+			simd.count_byte   = count_byte_avx2;
+			simd.text_stats   = count_text_stats_avx2;
+			simd.line_lengths = collect_line_lengths_avx2;
+		} break;
+
+		case SIMD_LEVEL_AVX512:
+		{
+			simd.find_byte    = sz_find_byte_avx512;
+			simd.rfind_byte   = sz_rfind_byte_avx512;
+			simd.find_charset = sz_find_charset_avx2; // The AVX-512 one also needs VBMI, which Skylake-X lacks
+			simd.find         = sz_find_avx512;
+			simd.find_case    = find_ascii_case_avx512;
+			simd.copy         = sz_copy_avx512;
+			simd.fill         = sz_fill_avx512;
+			simd.count_byte   = count_byte_avx512;
+			simd.text_stats   = count_text_stats_avx512;
+			simd.line_lengths = collect_line_lengths_avx512;
+		} break;
+#elif defined(ARCH_ARM64)
+		case SIMD_LEVEL_NEON:
+		{
+			// Byte, charset and substring search plus byte counting. find_case, copy, fill, text_stats and
+			// line_lengths have no NEON kernels yet and stay serial
+			simd.find_byte    = sz_find_byte_neon;
+			simd.rfind_byte   = sz_rfind_byte_neon;
+			simd.find_charset = sz_find_charset_neon;
+			simd.find         = sz_find_neon;
+			simd.count_byte   = count_byte_neon;
+		} break;
+#endif
+
+		default:
+		{
+		} break;
+	}
+}
+
+//
+// Picks the widest level the host supports, or the one named by level_name (falling back to FILEUTILS_SIMD when
+// that is NULL). A forced level the host cannot run is reported and replaced by the best one. Returns false only
+// when the name is not a level at all
+//
+inline static bool
+init_simd_dispatch(const char *level_name)
+{
+	simd_level_t best = get_best_simd_level();
+
+	if (level_name == NULL)
+	{
+		level_name = getenv("FILEUTILS_SIMD");
+	}
+
+	if (level_name == NULL || level_name[0] == '\0')
+	{
+		set_simd_level(best);
+		return true;
+	}
+
+	simd_level_t level = SIMD_LEVEL_COUNT;
+
+	for (u32 i = 0; i < SIMD_LEVEL_COUNT; ++i)
+	{
+		if (strcmp(level_name, simd_level_names[i]) == 0)
+		{
+			level = (simd_level_t) i;
+		}
+	}
+
+	if (level == SIMD_LEVEL_COUNT)
+	{
+		fprintf(stderr, "(fatal: unknown simd level %s, expected serial, sse2, avx2, avx512 or neon)\n", level_name);
+		return false;
+	}
+
+	if (!is_simd_level_supported(level, best))
+	{
+		fprintf(stderr, "(%s is not supported on this cpu, using %s)\n", level_name, simd_level_names[best]);
+		level = best;
+	}
+
+	set_simd_level(level);
+
+	return true;
+}
+
+inline static u64
+count_byte_in_block(char *block, size_t block_size, const char *byte)
+{
+	return simd.count_byte((u8 const *) block, block_size, (u8) *byte);
+}
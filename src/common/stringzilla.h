@@ -2251,7 +2251,7 @@ SZ_PUBLIC sz_cptr_t sz_find_serial(sz_cptr_t h, sz_size_t h_length, sz_cptr_t n,
     if (h_length < n_length || !n_length) return SZ_NULL_CHAR;
 
 
-    for (size_t i = 0; i < h_length - n_length; ++i)
+    for (size_t i = 0; i <= h_length - n_length; ++i)
     {
         size_t j;
 
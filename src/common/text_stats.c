@@ -0,0 +1,211 @@
+//
+// wc style counters in one pass. Each 64 byte chunk is classified into three bit masks (newline, whitespace and
+// code point start) and every counter comes out of popcounts and shifts on those masks, so the cost does not
+// depend on how the text looks. Only the max line length walks the newline bits, once per line.
+//
+
+typedef struct
+{
+	u64 lines;
+	u64 words;
+	u64 bytes;
+	u64 chars;
+	u64 max_line_length;
+
+	// Carried between chunks and blocks
+	u64 line_length;
+	u64 in_word;
+} text_stats_t;
+
+typedef u64 (*popcount_proc_t)(u64 value);
+
+//
+// Bit i of each mask describes byte i of the chunk, bits at and past count are 0. Whitespace is what wc uses
+// (space, \t \n \v \f \r), a code point starts at every byte that is not 10xxxxxx. Line length is in code points
+// and does not expand tabs the way wc -L does
+//
+inline static void
+accumulate_text_stats(text_stats_t *stats, u64 newline, u64 space, u64 start, u32 count, popcount_proc_t popcount)
+{
+	u64 valid    = (count == 64) ? ~0ull : ((1ull << count) - 1);
+	u64 nonspace = ~space & valid;
+
+	stats->words  += popcount(nonspace & ~((nonspace << 1) | stats->in_word));
+	stats->in_word = (nonspace >> (count - 1)) & 1;
+
+	stats->lines += popcount(newline);
+	stats->chars += popcount(start);
+	stats->bytes += count;
+
+	u64 line_chars = start & ~newline;
+
+	while (newline)
+	{
+		u64 lowest  = newline & (~newline + 1);
+		u64 through = (lowest << 1) - 1;
+
+		stats->line_length     += popcount(line_chars & through);
+		stats->max_line_length  = MAX(stats->max_line_length, stats->line_length);
+		stats->line_length      = 0;
+
+		line_chars &= ~through;
+		newline    &= newline - 1;
+	}
+
+	stats->line_length += popcount(line_chars);
+}
+
+inline static void
+classify_text_serial(u8 const *data, u32 count, u64 *newline, u64 *space, u64 *start)
+{
+	*newline = *space = *start = 0;
+
+	for (u32 i = 0; i < count; ++i)
+	{
+		u8 byte = data[i];
+
+		*newline |= (u64) (byte == '\n') << i;
+		*space   |= (u64) ((byte == ' ') | ((u8) (byte - 9) <= 4)) << i;
+		*start   |= (u64) ((byte & 0xC0) != 0x80) << i;
+	}
+}
+
+inline static void
+count_text_stats_tail(text_stats_t *stats, u8 const *data, size_t size, popcount_proc_t popcount)
+{
+	if (size)
+	{
+		u64 newline, space, start;
+		classify_text_serial(data, (u32) size, &newline, &space, &start);
+
+		accumulate_text_stats(stats, newline, space, start, (u32) size, popcount);
+	}
+}
+
+static void
+count_text_stats_serial(text_stats_t *stats, u8 const *data, size_t size)
+{
+	size_t i = 0;
+
+	for (; i + 64 <= size; i += 64)
+	{
+		u64 newline, space, start;
+		classify_text_serial(data + i, 64, &newline, &space, &start);
+
+		accumulate_text_stats(stats, newline, space, start, 64, popcount_u64_serial);
+	}
+
+	count_text_stats_tail(stats, data + i, size - i, popcount_u64_serial);
+}
+
+// The last line only counts towards the max once nothing follows it
+inline static void
+finish_text_stats(text_stats_t *stats)
+{
+	stats->max_line_length = MAX(stats->max_line_length, stats->line_length);
+}
+
+#if defined(ARCH_X64)
+
+TARGET_POPCNT static u64
+popcount_u64_hardware(u64 value)
+{
+	return _mm_popcnt_u64(value);
+}
+
+static void
+count_text_stats_sse2(text_stats_t *stats, u8 const *data, size_t size)
+{
+	__m128i newline_byte = _mm_set1_epi8('\n');
+	__m128i space_byte   = _mm_set1_epi8(' ');
+	__m128i tab_byte     = _mm_set1_epi8(9);
+	__m128i four         = _mm_set1_epi8(4);
+	__m128i top_bits     = _mm_set1_epi8((char) 0xC0);
+	__m128i continuation = _mm_set1_epi8((char) 0x80);
+
+	size_t i = 0;
+
+	for (; i + 64 <= size; i += 64)
+	{
+		u64 newline = 0, space = 0, start = 0;
+
+		for (u32 j = 0; j < 64; j += 16)
+		{
+			__m128i bytes   = _mm_loadu_si128((__m128i const *) (data + i + j));
+			__m128i control = _mm_sub_epi8(bytes, tab_byte);
+
+			// \t..\r are the bytes that land in 0..4 after subtracting 9
+			__m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(bytes, space_byte), _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+
+			newline |= (u64) (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline_byte)) << j;
+			space   |= (u64) (u32) _mm_movemask_epi8(is_space) << j;
+			start   |= (u64) (u32) (~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bytes, top_bits), continuation)) & 0xFFFF) << j;
+		}
+
+		accumulate_text_stats(stats, newline, space, start, 64, popcount_u64_serial);
+	}
+
+	count_text_stats_tail(stats, data + i, size - i, popcount_u64_serial);
+}
+
+TARGET_AVX2 static void
+count_text_stats_avx2(text_stats_t *stats, u8 const *data, size_t size)
+{
+	__m256i newline_byte = _mm256_set1_epi8('\n');
+	__m256i space_byte   = _mm256_set1_epi8(' ');
+	__m256i tab_byte     = _mm256_set1_epi8(9);
+	__m256i four         = _mm256_set1_epi8(4);
+	__m256i top_bits     = _mm256_set1_epi8((char) 0xC0);
+	__m256i continuation = _mm256_set1_epi8((char) 0x80);
+
+	size_t i = 0;
+
+	for (; i + 64 <= size; i += 64)
+	{
+		u64 newline = 0, space = 0, start = 0;
+
+		for (u32 j = 0; j < 64; j += 32)
+		{
+			__m256i bytes   = _mm256_loadu_si256((__m256i const *) (data + i + j));
+			__m256i control = _mm256_sub_epi8(bytes, tab_byte);
+
+			__m256i is_space = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, space_byte), _mm256_cmpeq_epi8(_mm256_min_epu8(control, four), control));
+
+			newline |= (u64) (u32) _mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline_byte)) << j;
+			space   |= (u64) (u32) _mm256_movemask_epi8(is_space) << j;
+			start   |= (u64) (u32) ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(bytes, top_bits), continuation)) << j;
+		}
+
+		accumulate_text_stats(stats, newline, space, start, 64, popcount_u64_hardware);
+	}
+
+	count_text_stats_tail(stats, data + i, size - i, popcount_u64_hardware);
+}
+
+TARGET_AVX512BW static void
+count_text_stats_avx512(text_stats_t *stats, u8 const *data, size_t size)
+{
+	__m512i newline_byte = _mm512_set1_epi8('\n');
+	__m512i space_byte   = _mm512_set1_epi8(' ');
+	__m512i tab_byte     = _mm512_set1_epi8(9);
+	__m512i four         = _mm512_set1_epi8(4);
+	__m512i top_bits     = _mm512_set1_epi8((char) 0xC0);
+	__m512i continuation = _mm512_set1_epi8((char) 0x80);
+
+	for (size_t i = 0; i < size; i += 64)
+	{
+		u32 count       = (u32) MIN(size - i, 64);
+		__mmask64 valid = (count == 64) ? ~(__mmask64) 0 : (((__mmask64) 1 << count) - 1);
+
+		__m512i bytes = _mm512_maskz_loadu_epi8(valid, data + i);
+
+		u64 newline = _mm512_mask_cmpeq_epi8_mask(valid, bytes, newline_byte);
+		u64 space   = _mm512_mask_cmpeq_epi8_mask(valid, bytes, space_byte) |
+		              _mm512_mask_cmple_epu8_mask(valid, _mm512_sub_epi8(bytes, tab_byte), four);
+		u64 start   = _mm512_mask_cmpneq_epi8_mask(valid, _mm512_and_si512(bytes, top_bits), continuation);
+
+		accumulate_text_stats(stats, newline, space, start, count, popcount_u64_hardware);
+	}
+}
+
+#endif
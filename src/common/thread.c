@@ -0,0 +1,177 @@
+//
+// Minimal threading primitives, just enough for the reader/worker stages
+//
+
+#if defined(PLATFORM_WIN32)
+
+typedef HANDLE thread_t;
+typedef HANDLE semaphore_t;
+
+#define THREAD_PROC(name) DWORD WINAPI name(LPVOID thread_param)
+
+typedef LPTHREAD_START_ROUTINE thread_proc_t;
+
+inline static bool
+create_thread(thread_t *thread, thread_proc_t proc, void *param)
+{
+	*thread = CreateThread(NULL, 0, proc, param, 0, NULL);
+
+	return *thread != NULL;
+}
+
+inline static void
+join_thread(thread_t thread)
+{
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+}
+
+inline static bool
+init_semaphore(semaphore_t *semaphore, u32 initial_count, u32 max_count)
+{
+	*semaphore = CreateSemaphoreA(NULL, initial_count, max_count, NULL);
+
+	return *semaphore != NULL;
+}
+
+inline static void
+wait_semaphore(semaphore_t *semaphore)
+{
+	WaitForSingleObject(*semaphore, INFINITE);
+}
+
+inline static bool
+try_wait_semaphore(semaphore_t *semaphore)
+{
+	return WaitForSingleObject(*semaphore, 0) == WAIT_OBJECT_0;
+}
+
+inline static void
+signal_semaphore(semaphore_t *semaphore)
+{
+	ReleaseSemaphore(*semaphore, 1, NULL);
+}
+
+inline static void
+destroy_semaphore(semaphore_t *semaphore)
+{
+	CloseHandle(*semaphore);
+}
+
+// Returns the value before the add
+inline static u64
+atomic_add_u64(volatile u64 *value, u64 amount)
+{
+	return (u64) InterlockedExchangeAdd64((volatile LONG64 *) value, (LONG64) amount);
+}
+
+inline static u32
+get_cpu_count()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+
+	return info.dwNumberOfProcessors;
+}
+
+#elif defined(PLATFORM_LINUX)
+
+typedef pthread_t thread_t;
+typedef sem_t     semaphore_t;
+
+#define THREAD_PROC(name) void *name(void *thread_param)
+
+typedef void *(*thread_proc_t)(void *);
+
+inline static bool
+create_thread(thread_t *thread, thread_proc_t proc, void *param)
+{
+	return pthread_create(thread, NULL, proc, param) == 0;
+}
+
+inline static void
+join_thread(thread_t thread)
+{
+	pthread_join(thread, NULL);
+}
+
+inline static bool
+init_semaphore(semaphore_t *semaphore, u32 initial_count, u32 max_count)
+{
+	(void) max_count;
+
+	return sem_init(semaphore, 0, initial_count) == 0;
+}
+
+inline static void
+wait_semaphore(semaphore_t *semaphore)
+{
+	while (sem_wait(semaphore) != 0 && errno == EINTR)
+	{
+	}
+}
+
+inline static bool
+try_wait_semaphore(semaphore_t *semaphore)
+{
+	return sem_trywait(semaphore) == 0;
+}
+
+inline static void
+signal_semaphore(semaphore_t *semaphore)
+{
+	sem_post(semaphore);
+}
+
+inline static void
+destroy_semaphore(semaphore_t *semaphore)
+{
+	sem_destroy(semaphore);
+}
+
+// Returns the value before the add
+inline static u64
+atomic_add_u64(volatile u64 *value, u64 amount)
+{
+	return __atomic_fetch_add(value, amount, __ATOMIC_RELAXED);
+}
+
+inline static u32
+get_cpu_count()
+{
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (count > 0) ? (u32) count : 1;
+}
+
+#endif
+
+//
+// Starts count threads on proc, thread i gets params + i * param_stride (a stride of 0 hands every thread the
+// same param). Stops at the first thread that fails to start and returns how many did, only those may be
+// joined
+//
+inline static u32
+start_threads(thread_t *threads, u32 count, thread_proc_t proc, void *params, size_t param_stride)
+{
+	u32 started = 0;
+
+	for (; started < count; ++started)
+	{
+		if (!create_thread(&threads[started], proc, (u8 *) params + started * param_stride))
+		{
+			break;
+		}
+	}
+
+	return started;
+}
+
+inline static void
+join_threads(thread_t *threads, u32 count)
+{
+	for (u32 i = 0; i < count; ++i)
+	{
+		join_thread(threads[i]);
+	}
+}
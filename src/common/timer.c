@@ -1,4 +1,12 @@
-inline static u64 
+typedef struct
+{
+	f64 cpu_seconds;
+	u64 page_faults;
+} process_usage_t;
+
+#if defined(PLATFORM_WIN32)
+
+inline static u64
 get_os_timer_freq()
 {
 	LARGE_INTEGER freq;
@@ -7,7 +15,7 @@ get_os_timer_freq()
 	return freq.QuadPart;
 }
 
-inline static u64 
+inline static u64
 read_os_timer()
 {
 	LARGE_INTEGER value;
@@ -15,3 +23,54 @@ read_os_timer()
 
 	return value.QuadPart;
 }
+
+// User + kernel time of the whole process, plus page faults (soft and hard, Win32 does not split them)
+inline static void
+read_process_usage(process_usage_t *usage)
+{
+	FILETIME creation_time, exit_time, kernel_time, user_time;
+	GetProcessTimes(GetCurrentProcess(), &creation_time, &exit_time, &kernel_time, &user_time);
+
+	u64 kernel = ((u64) kernel_time.dwHighDateTime << 32) | kernel_time.dwLowDateTime;
+	u64 user   = ((u64) user_time.dwHighDateTime << 32)   | user_time.dwLowDateTime;
+
+	// FILETIME ticks are 100ns
+	usage->cpu_seconds = (f64) (kernel + user) / 10000000.0;
+
+	PROCESS_MEMORY_COUNTERS counters = {0};
+	K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+	usage->page_faults = counters.PageFaultCount;
+}
+
+#elif defined(PLATFORM_LINUX)
+
+inline static u64
+get_os_timer_freq()
+{
+	return 1000000000ull;
+}
+
+inline static u64
+read_os_timer()
+{
+	struct timespec value;
+	clock_gettime(CLOCK_MONOTONIC, &value);
+
+	return ((u64) value.tv_sec * 1000000000ull) + (u64) value.tv_nsec;
+}
+
+// User + kernel time of the whole process, plus minor and major page faults
+inline static void
+read_process_usage(process_usage_t *usage)
+{
+	struct rusage info;
+	getrusage(RUSAGE_SELF, &info);
+
+	usage->cpu_seconds = (f64) info.ru_utime.tv_sec + (f64) info.ru_utime.tv_usec / 1000000.0 +
+	                     (f64) info.ru_stime.tv_sec + (f64) info.ru_stime.tv_usec / 1000000.0;
+
+	usage->page_faults = (u64) info.ru_minflt + (u64) info.ru_majflt;
+}
+
+#endif
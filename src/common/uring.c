@@ -0,0 +1,273 @@
+//
+// Bare io_uring wrapper over the raw syscalls, so we do not need liburing on the build box.
+// Only what the block reader needs: setup, buffer registration, submit and reap.
+//
+
+#if defined(PLATFORM_LINUX)
+
+typedef struct
+{
+	int fd;
+	bool sqpoll;
+
+	u32 *sq_head;
+	u32 *sq_tail;
+	u32 *sq_mask;
+	u32 *sq_flags;
+	u32 *sq_array;
+	struct io_uring_sqe *sqes;
+
+	u32 *cq_head;
+	u32 *cq_tail;
+	u32 *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	u32 sq_local_tail;
+
+	// io_uring_enter calls made, for the syscalls-per-GB figures in read_speed_test
+	u64 enter_count;
+
+	void  *sq_ring;
+	size_t sq_ring_size;
+	void  *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+} uring_t;
+
+inline static void
+destroy_uring(uring_t *ring)
+{
+	if (ring->sqes)
+	{
+		munmap(ring->sqes, ring->sqes_size);
+	}
+
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+	{
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+
+	if (ring->sq_ring)
+	{
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+
+	if (ring->fd >= 0)
+	{
+		close(ring->fd);
+	}
+
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+}
+
+inline static bool
+init_uring(uring_t *ring, u32 entries, bool sqpoll)
+{
+	memset(ring, 0, sizeof(*ring));
+
+	struct io_uring_params params = {0};
+
+	if (sqpoll)
+	{
+		params.flags         |= IORING_SETUP_SQPOLL;
+		params.sq_thread_idle = 1000;
+	}
+
+	ring->fd     = (int) syscall(__NR_io_uring_setup, entries, &params);
+	ring->sqpoll = sqpoll;
+
+	if (ring->fd < 0)
+	{
+		return false;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(u32));
+	ring->cq_ring_size = params.cq_off.cqes  + (params.cq_entries * sizeof(struct io_uring_cqe));
+
+	bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+
+	if (single_mmap)
+	{
+		ring->sq_ring_size = MAX(ring->sq_ring_size, ring->cq_ring_size);
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+	if (ring->sq_ring == MAP_FAILED)
+	{
+		ring->sq_ring = NULL;
+		destroy_uring(ring);
+
+		return false;
+	}
+
+	if (single_mmap)
+	{
+		ring->cq_ring = ring->sq_ring;
+	}
+	else
+	{
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+		if (ring->cq_ring == MAP_FAILED)
+		{
+			ring->cq_ring = NULL;
+			destroy_uring(ring);
+
+			return false;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes      = (struct io_uring_sqe *) mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if (ring->sqes == MAP_FAILED)
+	{
+		ring->sqes = NULL;
+		destroy_uring(ring);
+
+		return false;
+	}
+
+	u8 *sq = (u8 *) ring->sq_ring;
+	u8 *cq = (u8 *) ring->cq_ring;
+
+	ring->sq_head  = (u32 *) (sq + params.sq_off.head);
+	ring->sq_tail  = (u32 *) (sq + params.sq_off.tail);
+	ring->sq_mask  = (u32 *) (sq + params.sq_off.ring_mask);
+	ring->sq_flags = (u32 *) (sq + params.sq_off.flags);
+	ring->sq_array = (u32 *) (sq + params.sq_off.array);
+
+	ring->cq_head = (u32 *) (cq + params.cq_off.head);
+	ring->cq_tail = (u32 *) (cq + params.cq_off.tail);
+	ring->cq_mask = (u32 *) (cq + params.cq_off.ring_mask);
+	ring->cqes    = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+	ring->sq_local_tail = *ring->sq_tail;
+
+	return true;
+}
+
+inline static bool
+register_uring_buffers(uring_t *ring, struct iovec *buffers, u32 buffer_count)
+{
+	return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, buffers, buffer_count) == 0;
+}
+
+// Returns NULL when the submission queue is full
+inline static struct io_uring_sqe *
+get_uring_sqe(uring_t *ring)
+{
+	u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+	u32 mask = *ring->sq_mask;
+
+	if ((ring->sq_local_tail - head) > mask)
+	{
+		return NULL;
+	}
+
+	u32 index = ring->sq_local_tail & mask;
+	ring->sq_array[index] = index;
+	ring->sq_local_tail  += 1;
+
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+inline static void
+prep_uring_read(struct io_uring_sqe *sqe, int fd, void *buffer, u32 length, u64 offset, s32 fixed_buffer_index, u64 user_data)
+{
+	sqe->opcode    = (fixed_buffer_index >= 0) ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd        = fd;
+	sqe->addr      = (u64) (uintptr_t) buffer;
+	sqe->len       = length;
+	sqe->off       = offset;
+	sqe->user_data = user_data;
+
+	if (fixed_buffer_index >= 0)
+	{
+		sqe->buf_index = (u16) fixed_buffer_index;
+	}
+}
+
+//
+// Publishes every queued sqe and optionally blocks until at least wait_count completions are available
+//
+inline static bool
+submit_uring(uring_t *ring, u32 wait_count)
+{
+	__atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+	// Everything the kernel has not consumed yet, including what a failed or interrupted call left behind
+	u32 to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	u32 flags = 0;
+
+	if (ring->sqpoll)
+	{
+		if (__atomic_load_n(ring->sq_flags, __ATOMIC_ACQUIRE) & IORING_SQ_NEED_WAKEUP)
+		{
+			flags |= IORING_ENTER_SQ_WAKEUP;
+		}
+
+		to_submit = 0;
+	}
+
+	if (wait_count)
+	{
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	if (to_submit == 0 && flags == 0)
+	{
+		return true;
+	}
+
+	for (;;)
+	{
+		ring->enter_count += 1;
+
+		long result = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_count, flags, NULL, 0);
+
+		if (result >= 0)
+		{
+			return true;
+		}
+
+		if (errno != EINTR)
+		{
+			return false;
+		}
+
+		if (!ring->sqpoll)
+		{
+			to_submit = ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		}
+	}
+}
+
+inline static struct io_uring_cqe *
+peek_uring_cqe(uring_t *ring)
+{
+	u32 head = *ring->cq_head;
+	u32 tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+	{
+		return NULL;
+	}
+
+	return &ring->cqes[head & *ring->cq_mask];
+}
+
+inline static void
+advance_uring_cq(uring_t *ring)
+{
+	__atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
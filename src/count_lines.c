@@ -1,65 +1,1341 @@
 #include "common/common.c"
 
+#include <math.h>
+
 #define FILE_BUFFER_SIZE (MEGABYTES(5))
 
-static void
-print_about(const char **argv)
+// --estimate reads this much per sample
+#define ESTIMATE_BLOCK_SIZE (KILOBYTES(64))
+#define DEFAULT_ESTIMATE_SAMPLES (64)
+
+// Longest --count needle, matches across a block boundary are stitched from a carry this long
+#define MAX_NEEDLE_LENGTH (256)
+
+// --recursive claims up to this many files at a time, fewer as the list runs out so the last ones still spread
+#define TREE_MAX_BATCH (256)
+#define TREE_MAX_THREADS (64)
+
+// Refining stops sampling once it would have read this fraction of the file, a sequential count is cheaper from there
+#define ESTIMATE_MAX_SAMPLED_FRACTION (0.25)
+
+// Hashed at the end of the counted prefix to tell an append from a rewrite
+#define STATE_TAIL_SIZE (KILOBYTES(4))
+
+//
+// Non-overlapping occurrences of a needle in a stream of blocks, leftmost first like grep -o. carry holds the
+// stream's last length - 1 bytes, where a match that continues into the next block can start
+//
+typedef struct
+{
+	u8 needle[MAX_NEEDLE_LENGTH];
+	u32 length;
+
+	u8 carry[MAX_NEEDLE_LENGTH];
+	u32 carry_length;
+
+	// Matches never start before the end of the previous one
+	u64 next_start;
+} needle_counter_t;
+
+typedef struct
+{
+	volatile u64 line_count;
+
+	bool stats;
+	text_stats_t text_stats;
+
+	line_index_builder_t *index;
+	line_stats_t *lengths;
+
+	// Counts into line_count instead of newlines
+	needle_counter_t *needle;
+} count_context_t;
+
+// What --state remembers about the last count
+typedef struct
+{
+	u64 size;
+	file_identity_t identity;
+	u64 line_count;
+	u64 tail_hash;
+} count_state_t;
+
+static void
+print_about(const char **argv)
+{
+	printf("Invalid usage\n"
+		"%s: [options] file\n"
+		"  --threads=<n>         count n byte ranges in parallel, 0 for one per core\n"
+		"  --stats               also count words, UTF-8 chars, bytes and the longest line (in chars) like\n"
+		"                        wc -lwmcL, in the same pass\n"
+		"  --index=<file>        write the offset of every Kth line to file while counting\n"
+		"  --index-every=<K>     lines per index entry (default %u)\n"
+		"  --print-lines=<A..B>  print lines A to B (1 based, inclusive) instead of counting, seeking with\n"
+		"                        the --index=<file> written by an earlier count when given\n"
+		"  --state=<file>        remember the count, and on the next run only count what was appended since\n"
+		"  --lengths             line length histogram, min/max/mean and the longest lines with their offsets\n"
+		"  --top=<K>             longest lines to list with --lengths (default 10, at most %u)\n"
+		"  --estimate[=<S>]      estimate the count from S random %u KB blocks (default %u) with a 95%% interval\n"
+		"  --target-error=<pct>  keep doubling the samples until the interval is within pct%% of the estimate,\n"
+		"                        switching to an exact count once that would read a quarter of the file\n"
+		"  --seed=<n>            seed for the --estimate block order (default from the timer)\n"
+		"  --count=<needle>      count non-overlapping occurrences of needle instead of lines, \\n \\t \\r \\\\ and\n"
+		"                        \\xHH escapes allowed, at most %u bytes\n"
+		"  --recursive           count every file under the given folders (and files), one worker per core\n"
+		"                        unless --threads says otherwise\n"
+		"  --sort=<name|lines>   order of the --recursive per file counts (default walk order)\n"
+		BLOCK_READER_OPTIONS_HELP, argv[0], DEFAULT_LINE_INDEX_EVERY, LINE_STATS_MAX_TOP,
+		(u32) (ESTIMATE_BLOCK_SIZE / KILOBYTES(1)), DEFAULT_ESTIMATE_SAMPLES, MAX_NEEDLE_LENGTH);
+}
+
+u64
+handle_block(char *block, size_t block_size)
+{
+	return count_byte_in_block(block, block_size, "\n");
+}
+
+//
+// Single bytes go to the count kernel. Longer needles use simd.find, whose AVX2/AVX-512 backends only compare
+// whole needles where the first and last bytes already matched
+//
+static u64
+count_needle_in_block(needle_counter_t *counter, u8 const *block, size_t block_size, u64 block_offset)
+{
+	u32 length = counter->length;
+
+	if (length == 1)
+	{
+		return simd.count_byte(block, block_size, counter->needle[0]);
+	}
+
+	u64 count = 0;
+
+	// Starts inside the carry, joined with just enough of the block to finish them
+	if (counter->carry_length)
+	{
+		u8 joined[MAX_NEEDLE_LENGTH * 2];
+
+		u32 head          = (u32) MIN(block_size, length - 1);
+		u32 joined_length = counter->carry_length + head;
+		u64 joined_offset = block_offset - counter->carry_length;
+
+		memcpy(joined, counter->carry, counter->carry_length);
+		memcpy(joined + counter->carry_length, block, head);
+
+		for (u32 i = 0; i < counter->carry_length && i + length <= joined_length; ++i)
+		{
+			if (joined_offset + i >= counter->next_start && memcmp(joined + i, counter->needle, length) == 0)
+			{
+				count               += 1;
+				counter->next_start  = joined_offset + i + length;
+			}
+		}
+	}
+
+	// A start in the carry that could not finish means every later start cannot either, so this finds nothing then
+	size_t at = (counter->next_start > block_offset) ? (size_t) (counter->next_start - block_offset) : 0;
+
+	while (at + length <= block_size)
+	{
+		sz_cptr_t found = simd.find((sz_cptr_t) block + at, block_size - at, (sz_cptr_t) counter->needle, length);
+
+		if (found == NULL)
+		{
+			break;
+		}
+
+		at                  = (size_t) ((u8 const *) found - block) + length;
+		count              += 1;
+		counter->next_start = block_offset + at;
+	}
+
+	// Keep the last length - 1 bytes of the stream, some of them may still come from the old carry
+	u32 keep = length - 1;
+
+	if (block_size >= keep)
+	{
+		memcpy(counter->carry, block + block_size - keep, keep);
+		counter->carry_length = keep;
+	}
+	else
+	{
+		u32 from_carry = MIN(counter->carry_length, keep - (u32) block_size);
+
+		memmove(counter->carry, counter->carry + counter->carry_length - from_carry, from_carry);
+		memcpy(counter->carry + from_carry, block, block_size);
+		counter->carry_length = from_carry + (u32) block_size;
+	}
+
+	return count;
+}
+
+// \n \t \r \0 \\ and \xHH, so a needle can hold bytes a shell argument cannot
+static bool
+parse_needle(const char *text, needle_counter_t *counter)
+{
+	memset(counter, 0, sizeof(*counter));
+
+	while (*text)
+	{
+		if (counter->length == MAX_NEEDLE_LENGTH)
+		{
+			return false;
+		}
+
+		u8 byte = (u8) *text++;
+
+		if (byte == '\\')
+		{
+			char escape = *text++;
+
+			switch (escape)
+			{
+				case 'n':  byte = '\n'; break;
+				case 't':  byte = '\t'; break;
+				case 'r':  byte = '\r'; break;
+				case '0':  byte = 0;    break;
+				case '\\': byte = '\\'; break;
+
+				case 'x':
+				{
+					char hex[3] = { text[0], text[0] ? text[1] : 0, 0 };
+					char *end   = NULL;
+
+					byte  = (u8) strtoul(hex, &end, 16);
+					text += 2;
+
+					if (end != hex + 2)
+					{
+						return false;
+					}
+				} break;
+
+				default:
+				{
+					return false;
+				}
+			}
+		}
+
+		counter->needle[counter->length++] = byte;
+	}
+
+	return counter->length > 0;
+}
+
+//
+// Called from every thread with --threads, one atomic add per block. --stats, --index and --lengths carry state
+// from block to block, they read in order on one thread and line_count is then the count ahead of this block
+//
+static bool
+handle_block_callback(u8 *block, size_t block_size, u64 block_offset, void *user_data)
+{
+	count_context_t *context = (count_context_t *) user_data;
+
+	u64 lines_before = context->line_count;
+	u64 block_lines  = 0;
+
+	if (context->needle)
+	{
+		atomic_add_u64(&context->line_count, count_needle_in_block(context->needle, block, block_size, block_offset));
+	}
+	else if (context->stats)
+	{
+		simd.text_stats(&context->text_stats, block, block_size);
+
+		block_lines         = context->text_stats.lines - lines_before;
+		context->line_count = context->text_stats.lines;
+	}
+	else
+	{
+		block_lines = handle_block((char *) block, block_size);
+		atomic_add_u64(&context->line_count, block_lines);
+	}
+
+	if (context->index)
+	{
+		add_block_to_line_index(context->index, block, block_size, block_offset, lines_before, block_lines);
+	}
+
+	if (context->lengths)
+	{
+		simd.line_lengths(context->lengths, block, block_size, block_offset);
+	}
+
+	return true;
+}
+
+static void
+handle_pass_callback(void *user_data, bool is_final_pass)
+{
+	(void) is_final_pass;
+
+	count_context_t *context = (count_context_t *) user_data;
+
+	context->line_count = 0;
+	memset(&context->text_stats, 0, sizeof(context->text_stats));
+
+	if (context->index)
+	{
+		reset_line_index_builder(context->index);
+	}
+
+	if (context->lengths)
+	{
+		init_line_stats(context->lengths, context->lengths->top_capacity, context->lengths->long_threshold);
+	}
+
+	if (context->needle)
+	{
+		context->needle->carry_length = 0;
+		context->needle->next_start   = 0;
+	}
+}
+
+static void
+print_line_stats(line_stats_t *stats)
+{
+	f64 mean = stats->line_count ? (f64) stats->total_length / (f64) stats->line_count : 0;
+
+	printf("\nline lengths in bytes, newline excluded: min %zu, max %zu, mean %.1lf\n", stats->min_length, stats->max_length, mean);
+
+	for (u32 bucket = 0; bucket < sizeof(stats->histogram) / sizeof(stats->histogram[0]); ++bucket)
+	{
+		if (stats->histogram[bucket] == 0)
+		{
+			continue;
+		}
+
+		u64 low  = bucket ? (1ull << (bucket - 1)) : 0;
+		u64 high = bucket ? (low << 1) - 1 : 0;
+
+		printf("  %12zu .. %-12zu %12zu lines (%.2lf%%)\n", low, high, stats->histogram[bucket], (f64) stats->histogram[bucket] * 100.0 / (f64) stats->line_count);
+	}
+
+	printf("%zu lines longer than the %zu byte block size\n", stats->long_count, stats->long_threshold);
+
+	if (stats->top_count)
+	{
+		sort_longest_lines(stats);
+
+		printf("longest lines:\n");
+
+		for (u32 i = 0; i < stats->top_count; ++i)
+		{
+			printf("  %12zu bytes, line %zu at offset %zu\n", stats->top[i].length, stats->top[i].line_number, stats->top[i].offset);
+		}
+	}
+}
+
+// XXH64 of the STATE_TAIL_SIZE bytes before end
+static bool
+hash_file_tail(file_handle_t file, u64 end, u64 *hash)
+{
+	u8 buffer[STATE_TAIL_SIZE];
+
+	u64 start         = end - MIN(end, STATE_TAIL_SIZE);
+	size_t bytes_read = 0;
+
+	if (!read_file_at(file, buffer, (size_t) (end - start), start, &bytes_read) || bytes_read != end - start)
+	{
+		return false;
+	}
+
+	*hash = XXH64(buffer, bytes_read, 0);
+
+	return true;
+}
+
+static bool
+load_count_state(const char *path, count_state_t *state)
+{
+	memset(state, 0, sizeof(*state));
+
+	FILE *file = fopen(path, "rt");
+
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	const char *names[] = { "size", "device", "id", "modified_time", "lines", "tail_hash" };
+	u64 *fields[]       = { &state->size, &state->identity.device, &state->identity.id,
+	                        &state->identity.modified_time, &state->line_count, &state->tail_hash };
+
+	u32 field_count = sizeof(names) / sizeof(names[0]);
+	u32 found       = 0;
+
+	char name[64];
+	char value[64];
+
+	while (fscanf(file, "%63s %63s", name, value) == 2)
+	{
+		for (u32 i = 0; i < field_count; ++i)
+		{
+			if (strcmp(name, names[i]) == 0)
+			{
+				*fields[i] = strtoull(value, NULL, (fields[i] == &state->tail_hash) ? 16 : 10);
+				found     |= 1 << i;
+			}
+		}
+	}
+
+	fclose(file);
+
+	return found == (1u << field_count) - 1;
+}
+
+static bool
+save_count_state(const char *path, count_state_t *state)
+{
+	FILE *file = fopen(path, "wt");
+
+	if (file == NULL)
+	{
+		return false;
+	}
+
+	fprintf(file, "size %zu\ndevice %zu\nid %zu\nmodified_time %zu\nlines %zu\ntail_hash %016zx\n",
+	        state->size, state->identity.device, state->identity.id, state->identity.modified_time,
+	        state->line_count, state->tail_hash);
+
+	bool written = (ferror(file) == 0);
+	fclose(file);
+
+	return written;
+}
+
+inline static u64
+next_random(u64 *state)
+{
+	// xorshift64*
+	u64 x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+
+	return x * 0x2545F4914F6CDD1Dull;
+}
+
+inline static u64
+get_gcd(u64 a, u64 b)
+{
+	while (b)
+	{
+		u64 t = a % b;
+		a     = b;
+		b     = t;
+	}
+
+	return a;
+}
+
+typedef struct
+{
+	u64 path_offset;
+	u64 bytes;
+	u64 line_count;
+	bool failed;
+} tree_file_t;
+
+//
+// Every path lives in one arena and files refer to it by offset, both grow by doubling while walking. Once
+// the walk is done nothing moves and the workers only write to the files they claimed
+//
+typedef struct
+{
+	tree_file_t *files;
+	u64 file_count;
+	u64 file_capacity;
+
+	char *paths;
+	u64 paths_used;
+	u64 paths_capacity;
+
+	u32 thread_count;
+	volatile u64 next_file;
+} tree_count_t;
+
+typedef enum
+{
+	TREE_SORT_NONE,
+	TREE_SORT_NAME,
+	TREE_SORT_LINES,
+} tree_sort_t;
+
+typedef struct
+{
+	u64 samples;
+	u64 line_count;
+	u64 half_width;
+	bool exact;
+} line_estimate_t;
+
+//
+// Ratio estimate of the newline count from sampled blocks. Block i of the sample is (stride * i + shift) % N,
+// a permutation of all N blocks for a stride coprime to N, so refining never reads a block twice and sampling
+// every block gives the exact count. The interval is the usual 1.96 standard errors of a ratio estimator with
+// the finite population correction; blocks of a sorted or sectioned file are not independent, treat it as a
+// guide rather than a guarantee
+//
+static bool
+estimate_line_count(const char *file_path, u64 sample_count, f64 target_error, u64 seed, line_estimate_t *estimate)
+{
+	memset(estimate, 0, sizeof(*estimate));
+
+	file_handle_t file = open_file_for_read(file_path, 0);
+
+	if (!is_file_handle_valid(file))
+	{
+		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
+		return false;
+	}
+
+	u64 file_size   = get_file_size(file);
+	u64 block_count = (file_size + ESTIMATE_BLOCK_SIZE - 1) / ESTIMATE_BLOCK_SIZE;
+
+	printf("(file size is %lf GB, %zu blocks of %u KB)\n", (f64) file_size / (f64) GIGABYTES(1), block_count, (u32) (ESTIMATE_BLOCK_SIZE / KILOBYTES(1)));
+
+	u64 random = seed ? seed : 0x9E3779B97F4A7C15ull;
+	u64 stride = 1;
+	u64 shift  = 0;
+
+	if (block_count > 1)
+	{
+		do
+		{
+			stride = next_random(&random) % block_count;
+		} while (stride == 0 || get_gcd(stride, block_count) != 1);
+
+		shift = next_random(&random) % block_count;
+	}
+
+	u8 *buffer = (u8 *) alloc_pages(ESTIMATE_BLOCK_SIZE);
+
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "(fatal: could not allocate the sample buffer)\n");
+		close_file(file);
+		return false;
+	}
+
+	// Sums over samples of c (newlines), b (bytes) and their products, enough for the ratio and its variance
+	f64 sum_c  = 0;
+	f64 sum_b  = 0;
+	f64 sum_cc = 0;
+	f64 sum_cb = 0;
+	f64 sum_bb = 0;
+	u64 lines  = 0;
+
+	u64 start_time = read_os_timer();
+	u64 timer_freq = get_os_timer_freq();
+	u64 round_end  = MIN(sample_count, block_count);
+	u64 n          = 0;
+
+	for (;;)
+	{
+		for (; n < round_end; ++n)
+		{
+			u64 block         = (stride * n + shift) % block_count;
+			u64 offset        = block * ESTIMATE_BLOCK_SIZE;
+			size_t size       = (size_t) MIN(file_size - offset, ESTIMATE_BLOCK_SIZE);
+			size_t bytes_read = 0;
+
+			if (!read_file_at(file, buffer, size, offset, &bytes_read) || bytes_read != size)
+			{
+				fprintf(stderr, "(fatal: could not read %zu bytes at offset %zu)\n", size, offset);
+				free_pages(buffer, ESTIMATE_BLOCK_SIZE);
+				close_file(file);
+				return false;
+			}
+
+			u64 c = count_byte_in_block((char *) buffer, size, "\n");
+			f64 b = (f64) size;
+
+			lines  += c;
+			sum_c  += (f64) c;
+			sum_b  += b;
+			sum_cc += (f64) c * (f64) c;
+			sum_cb += (f64) c * b;
+			sum_bb += b * b;
+		}
+
+		estimate->samples = n;
+		estimate->exact   = (n == block_count);
+
+		f64 ratio      = sum_b > 0 ? sum_c / sum_b : 0;
+		f64 half_width = 0;
+
+		if (estimate->exact)
+		{
+			estimate->line_count = lines;
+		}
+		else
+		{
+			f64 residual = MAX(sum_cc - 2.0 * ratio * sum_cb + ratio * ratio * sum_bb, 0.0) / (f64) (n - 1);
+			f64 mean_b   = sum_b / (f64) n;
+			f64 fpc      = 1.0 - (f64) n / (f64) block_count;
+
+			estimate->line_count = (u64) (ratio * (f64) file_size + 0.5);
+			half_width           = 1.96 * (f64) file_size * sqrt(fpc * residual / (f64) n) / mean_b;
+		}
+
+		estimate->half_width = (u64) (half_width + 0.5);
+
+		f64 relative = estimate->line_count ? half_width * 100.0 / (f64) estimate->line_count : 0;
+
+		printf("(%zu of %zu blocks sampled, %zu lines +- %zu (%.3lf%%), %lf sec)\n", n, block_count, estimate->line_count,
+		       estimate->half_width, relative, (f64) (read_os_timer() - start_time) / (f64) timer_freq);
+
+		if (estimate->exact || target_error <= 0 || relative <= target_error)
+		{
+			break;
+		}
+
+		round_end = MIN(n * 2, block_count);
+
+		if (round_end < block_count && (f64) round_end * ESTIMATE_BLOCK_SIZE > ESTIMATE_MAX_SAMPLED_FRACTION * (f64) file_size)
+		{
+			break;
+		}
+	}
+
+	free_pages(buffer, ESTIMATE_BLOCK_SIZE);
+	close_file(file);
+
+	return true;
+}
+
+// Makes room for needed bytes after used, copying into a block twice as large when it does not fit
+static void *
+grow_pages(void *memory, u64 used, u64 *capacity, u64 needed)
+{
+	if (used + needed <= *capacity)
+	{
+		return memory;
+	}
+
+	u64 new_capacity = MAX(*capacity, KILOBYTES(64));
+
+	while (used + needed > new_capacity)
+	{
+		new_capacity *= 2;
+	}
+
+	void *grown = alloc_pages(new_capacity);
+
+	if (grown == NULL)
+	{
+		return NULL;
+	}
+
+	if (memory)
+	{
+		memcpy(grown, memory, used);
+		free_pages(memory, *capacity);
+	}
+
+	*capacity = new_capacity;
+
+	return grown;
+}
+
+static bool
+add_tree_path(tree_count_t *tree, const char *path, u64 *offset)
+{
+	u64 length  = strlen(path) + 1;
+	tree->paths = (char *) grow_pages(tree->paths, tree->paths_used, &tree->paths_capacity, length);
+
+	if (tree->paths == NULL)
+	{
+		return false;
+	}
+
+	memcpy(tree->paths + tree->paths_used, path, length);
+
+	*offset           = tree->paths_used;
+	tree->paths_used += length;
+
+	return true;
+}
+
+static bool
+add_tree_file(tree_count_t *tree, const char *path)
+{
+	u64 capacity_bytes = tree->file_capacity * sizeof(tree_file_t);
+	tree->files        = (tree_file_t *) grow_pages(tree->files, tree->file_count * sizeof(tree_file_t), &capacity_bytes, sizeof(tree_file_t));
+
+	if (tree->files == NULL)
+	{
+		return false;
+	}
+
+	tree->file_capacity = capacity_bytes / sizeof(tree_file_t);
+
+	tree_file_t *file = &tree->files[tree->file_count];
+	memset(file, 0, sizeof(*file));
+
+	if (!add_tree_path(tree, path, &file->path_offset))
+	{
+		return false;
+	}
+
+	tree->file_count += 1;
+
+	return true;
+}
+
+//
+// Depth first with an explicit stack of folder paths, so deep trees cannot run out of call stack. Links to
+// folders are not followed. Roots that are not folders are counted as files
+//
+static bool
+walk_tree(tree_count_t *tree, const char **roots, int root_count)
+{
+	dir_iter_t *dir_iter = (dir_iter_t *) alloc_pages(sizeof(dir_iter_t));
+
+	u64 *stack         = NULL;
+	u64 stack_count    = 0;
+	u64 stack_capacity = 0;
+	bool ok            = (dir_iter != NULL);
+
+	char folder_path[MAX_PATH_LENGTH + 1];
+	char full_path[MAX_PATH_LENGTH + 1];
+
+	for (int i = 0; ok && i < root_count; ++i)
+	{
+		if (!open_dir(roots[i], dir_iter))
+		{
+			ok = add_tree_file(tree, roots[i]);
+			continue;
+		}
+
+		close_dir(dir_iter);
+
+		stack = (u64 *) grow_pages(stack, stack_count * sizeof(u64), &stack_capacity, sizeof(u64));
+		ok    = (stack != NULL) && add_tree_path(tree, roots[i], &stack[stack_count++]);
+	}
+
+	while (ok && stack_count)
+	{
+		// The arena can move while this folder adds to it
+		snprintf(folder_path, sizeof(folder_path), "%s", tree->paths + stack[--stack_count]);
+
+		if (!open_dir(folder_path, dir_iter))
+		{
+			fprintf(stderr, "(could not open folder %s, skipping it)\n", folder_path);
+			continue;
+		}
+
+		dir_entry_t entry;
+
+		while (ok && next_dir_entry(dir_iter, &entry))
+		{
+			if (!entry.is_directory && !entry.is_regular)
+			{
+				continue;
+			}
+
+			if (!join_path(full_path, sizeof(full_path), folder_path, entry.name))
+			{
+				fprintf(stderr, "(fatal: path is too long, max supported length is %d)\n", MAX_PATH_LENGTH);
+				ok = false;
+				break;
+			}
+
+			if (entry.is_directory)
+			{
+				stack = (u64 *) grow_pages(stack, stack_count * sizeof(u64), &stack_capacity, sizeof(u64));
+				ok    = (stack != NULL) && add_tree_path(tree, full_path, &stack[stack_count++]);
+			}
+			else
+			{
+				ok = add_tree_file(tree, full_path);
+			}
+		}
+
+		close_dir(dir_iter);
+	}
+
+	free_pages(stack, stack_capacity);
+	free_pages(dir_iter, sizeof(dir_iter_t));
+
+	return ok;
+}
+
+//
+// Plain reads into the worker's buffer, one allocation per worker that every file it claims reuses, and no
+// block reader per file. A short read is the end of a regular file, so anything under FILE_BUFFER_SIZE costs
+// one open, one read and one close. Those three are not batched across files, only the claims are
+//
+static void
+count_tree_file(tree_file_t *file, const char *path, u8 *buffer)
+{
+	file_handle_t handle = open_file_for_read(path, 0);
+
+	if (!is_file_handle_valid(handle))
+	{
+		file->failed = true;
+		return;
+	}
+
+	for (;;)
+	{
+		size_t bytes_read = 0;
+
+		if (!read_file(handle, buffer, FILE_BUFFER_SIZE, &bytes_read))
+		{
+			file->failed = true;
+			break;
+		}
+
+		file->line_count += handle_block((char *) buffer, bytes_read);
+		file->bytes      += bytes_read;
+
+		if (bytes_read < FILE_BUFFER_SIZE)
+		{
+			break;
+		}
+	}
+
+	close_file(handle);
+}
+
+static THREAD_PROC(count_tree_thread)
+{
+	tree_count_t *tree = (tree_count_t *) thread_param;
+	u8 *buffer         = (u8 *) alloc_pages(FILE_BUFFER_SIZE);
+
+	while (buffer)
+	{
+		// Racy read, it only sizes the batch
+		u64 claimed   = tree->next_file;
+		u64 remaining = (claimed < tree->file_count) ? tree->file_count - claimed : 0;
+		u64 batch     = MIN(MAX(remaining / ((u64) tree->thread_count * 4), 1), TREE_MAX_BATCH);
+
+		u64 first = atomic_add_u64(&tree->next_file, batch);
+
+		if (first >= tree->file_count)
+		{
+			break;
+		}
+
+		u64 last = MIN(first + batch, tree->file_count);
+
+		for (u64 i = first; i < last; ++i)
+		{
+			count_tree_file(&tree->files[i], tree->paths + tree->files[i].path_offset, buffer);
+		}
+	}
+
+	free_pages(buffer, FILE_BUFFER_SIZE);
+
+	return 0;
+}
+
+// qsort has no user pointer, the comparators read the arena from here
+static char const *tree_sort_paths;
+
+static int
+compare_tree_files_by_name(const void *a, const void *b)
 {
-	printf("Invalid usage\n"
-		"%s: file\n", argv[0]);
+	return strcmp(tree_sort_paths + ((tree_file_t const *) a)->path_offset, tree_sort_paths + ((tree_file_t const *) b)->path_offset);
 }
 
-u64
-handle_block(char *block, size_t block_size)
+static int
+compare_tree_files_by_lines(const void *a, const void *b)
+{
+	u64 lines_a = ((tree_file_t const *) a)->line_count;
+	u64 lines_b = ((tree_file_t const *) b)->line_count;
+
+	return (lines_a < lines_b) - (lines_a > lines_b);
+}
+
+static bool
+count_tree(const char **roots, int root_count, u32 thread_count, tree_sort_t sort, const char *roofline_path)
+{
+	u64 start_time = read_os_timer();
+	u64 timer_freq = get_os_timer_freq();
+
+	tree_count_t tree = {0};
+
+	if (!walk_tree(&tree, roots, root_count))
+	{
+		return false;
+	}
+
+	f64 walk_sec      = (f64) (read_os_timer() - start_time) / (f64) timer_freq;
+	tree.thread_count = (u32) MAX(MIN(thread_count, tree.file_count), 1);
+
+	printf("(found %zu files in %lf sec, counting on %u threads)\n", tree.file_count, walk_sec, tree.thread_count);
+
+	thread_t threads[TREE_MAX_THREADS];
+
+	// Every thread pulls from the same queue
+	u32 started = start_threads(threads, tree.thread_count, count_tree_thread, &tree, 0);
+
+	join_threads(threads, started);
+
+	if (started < tree.thread_count)
+	{
+		fprintf(stderr, "(fatal: could not start counting thread %u of %u)\n", started + 1, tree.thread_count);
+
+		free_pages(tree.files, tree.file_capacity * sizeof(tree_file_t));
+		free_pages(tree.paths, tree.paths_capacity);
+
+		return false;
+	}
+
+	if (sort != TREE_SORT_NONE)
+	{
+		tree_sort_paths = tree.paths;
+		qsort(tree.files, tree.file_count, sizeof(tree_file_t), (sort == TREE_SORT_NAME) ? compare_tree_files_by_name : compare_tree_files_by_lines);
+	}
+
+	u64 total_lines = 0;
+	u64 total_bytes = 0;
+	u64 failed      = 0;
+
+	printf("\n");
+
+	for (u64 i = 0; i < tree.file_count; ++i)
+	{
+		tree_file_t *file = &tree.files[i];
+		const char *path  = tree.paths + file->path_offset;
+
+		if (file->failed)
+		{
+			fprintf(stderr, "(could not read file %s)\n", path);
+			failed += 1;
+			continue;
+		}
+
+		printf("%12zu %s\n", file->line_count, path);
+
+		total_lines += file->line_count;
+		total_bytes += file->bytes;
+	}
+
+	u64 total_time = read_os_timer() - start_time;
+	f64 total_sec  = (f64) total_time / (f64) timer_freq;
+
+	printf("\ncounted %zu lines in %zu files\n", total_lines, tree.file_count - failed);
+
+	if (failed)
+	{
+		printf("(%zu files could not be read)\n", failed);
+	}
+
+	f64 mb_per_sec = (f64) total_bytes / MEGABYTES(1) / total_sec;
+
+	printf("(took %lf sec @ average of %lf MB/s, %lf files/s)\n", total_sec, mb_per_sec, (f64) tree.file_count / total_sec);
+	print_roofline_percent(roofline_path, mb_per_sec, tree.thread_count);
+
+	free_pages(tree.files, tree.file_capacity * sizeof(tree_file_t));
+	free_pages(tree.paths, tree.paths_capacity);
+
+	return failed == 0;
+}
+
+// "A..B" or just "A", 1 based
+static bool
+parse_line_range(const char *text, u64 *first, u64 *last)
+{
+	char *end = NULL;
+	*first    = strtoull(text, &end, 10);
+
+	if (end == text || *first == 0)
+	{
+		return false;
+	}
+
+	*last = *first;
+
+	if (*end == '\0')
+	{
+		return true;
+	}
+
+	if (end[0] != '.' || end[1] != '.')
+	{
+		return false;
+	}
+
+	text  = end + 2;
+	*last = strtoull(text, &end, 10);
+
+	return (end != text) && (*end == '\0') && (*last >= *first);
+}
+
+//
+// Streams from the closest indexed line at or before first (or from the start without an index), skips to
+// first and writes lines up to last to stdout untouched. Status goes to stderr so the output can be piped
+//
+static bool
+print_lines(const char *file_path, const char *index_path, u64 first, u64 last)
 {
-	const char *newline_str = "\n";
+	file_handle_t file = open_file_for_read(file_path, FILE_OPEN_SEQUENTIAL);
+
+	if (!is_file_handle_valid(file))
+	{
+		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
+		return false;
+	}
+
+	u64 file_size = get_file_size(file);
+	u64 offset    = 0;
+	u64 skip      = first - 1;
+
+	if (index_path)
+	{
+		line_index_t index;
+
+		if (!open_line_index(index_path, &index))
+		{
+			fprintf(stderr, "(fatal: could not load line index %s)\n", index_path);
+			close_file(file);
+			return false;
+		}
+
+		if (index.header->file_size != file_size)
+		{
+			fprintf(stderr, "(fatal: line index %s was built for a %zu byte file, %s is %zu bytes)\n", index_path, index.header->file_size, file_path, file_size);
+			close_line_index(&index);
+			close_file(file);
+			return false;
+		}
+
+		// An index with no entries has no lines to seek to, and nothing to print
+		if (index.header->entry_count == 0)
+		{
+			close_line_index(&index);
+			close_file(file);
+			return true;
+		}
+
+		u64 entry = MIN((first - 1) / index.header->every, index.header->entry_count - 1);
+
+		offset = get_line_index_offset(&index, entry);
+		skip   = (first - 1) - entry * index.header->every;
+
+		fprintf(stderr, "(index entry %zu puts line %zu at byte %zu, skipping %zu lines from there)\n", entry, entry * index.header->every + 1, offset, skip);
+
+		close_line_index(&index);
+	}
 
-	size_t buf_remain = block_size;
-	sz_cptr_t buf     = block;
+	u8 *buffer    = (u8 *) alloc_pages(FILE_BUFFER_SIZE);
+	u64 remaining = last - first + 1;
 
-	u64 newline_count = 0;
+	if (buffer == NULL)
+	{
+		fprintf(stderr, "(fatal: could not allocate the read buffer)\n");
+		close_file(file);
+		return false;
+	}
 
-	while (buf_remain)
+	while (remaining && offset < file_size)
 	{
-		sz_cptr_t found_newline = sz_find_byte_avx2(buf, buf_remain, newline_str);
+		size_t bytes_read = 0;
 
-		if (found_newline == NULL)
+		if (!read_file_at(file, buffer, FILE_BUFFER_SIZE, offset, &bytes_read) || bytes_read == 0)
 		{
 			break;
 		}
 
-		newline_count += 1;
+		offset += bytes_read;
+
+		u8 *start   = buffer;
+		size_t size = bytes_read;
+
+		if (skip)
+		{
+			size_t at = find_nth_byte(start, size, '\n', skip);
+
+			if (at == size)
+			{
+				skip -= count_byte_in_block((char *) start, size, "\n");
+				continue;
+			}
+
+			skip   = 0;
+			start += at + 1;
+			size  -= at + 1;
+		}
+
+		size_t at = find_nth_byte(start, size, '\n', remaining);
 
-		buf = found_newline + 1;
-		buf_remain = block_size - (buf - block);
+		if (at < size)
+		{
+			fwrite(start, 1, at + 1, stdout);
+			remaining = 0;
+		}
+		else
+		{
+			fwrite(start, 1, size, stdout);
+			remaining -= count_byte_in_block((char *) start, size, "\n");
+		}
 	}
 
-	return newline_count;
+	free_pages(buffer, FILE_BUFFER_SIZE);
+	close_file(file);
+
+	return true;
 }
 
-int 
+int
 main(int argc, const char **argv)
 {
+	block_reader_config_t reader_config = default_block_reader_config(FILE_BUFFER_SIZE, "searched");
+	argc = strip_block_reader_options(argc, argv, &reader_config);
+
+	// Newline counts of disjoint ranges just add up, so the file can be split with no boundary fixups
+	int out                = 1;
+	bool stats             = false;
+	const char *index_path = NULL;
+	const char *state_path = NULL;
+	bool lengths           = false;
+	u64 top_count          = 10;
+	u64 index_every        = DEFAULT_LINE_INDEX_EVERY;
+	bool print_range       = false;
+	u64 first_line         = 0;
+	u64 last_line          = 0;
+	u64 estimate_samples   = 0;
+	f64 target_error       = 0;
+	u64 seed               = 0;
+	bool recursive         = false;
+	tree_sort_t sort       = TREE_SORT_NONE;
+	u32 tree_threads       = 0;
+	const char *needle     = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--stats") == 0)
+		{
+			stats = true;
+		}
+		else if (strncmp(argv[i], "--index=", 8) == 0)
+		{
+			index_path = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--lengths") == 0)
+		{
+			lengths = true;
+		}
+		else if (strncmp(argv[i], "--top=", 6) == 0)
+		{
+			if (!parse_size(argv[i] + 6, &top_count) || top_count > LINE_STATS_MAX_TOP)
+			{
+				fprintf(stderr, "(fatal: invalid top count %s)\n", argv[i] + 6);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--state=", 8) == 0)
+		{
+			state_path = argv[i] + 8;
+		}
+		else if (strncmp(argv[i], "--index-every=", 14) == 0)
+		{
+			if (!parse_size(argv[i] + 14, &index_every) || index_every == 0)
+			{
+				fprintf(stderr, "(fatal: invalid index interval %s)\n", argv[i] + 14);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--print-lines=", 14) == 0)
+		{
+			if (!parse_line_range(argv[i] + 14, &first_line, &last_line))
+			{
+				fprintf(stderr, "(fatal: invalid line range %s)\n", argv[i] + 14);
+				return 1;
+			}
+
+			print_range = true;
+		}
+		else if (strcmp(argv[i], "--estimate") == 0)
+		{
+			estimate_samples = DEFAULT_ESTIMATE_SAMPLES;
+		}
+		else if (strncmp(argv[i], "--estimate=", 11) == 0)
+		{
+			// At least two, the interval needs a sample variance
+			if (!parse_size(argv[i] + 11, &estimate_samples) || estimate_samples < 2)
+			{
+				fprintf(stderr, "(fatal: invalid sample count %s)\n", argv[i] + 11);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--target-error=", 15) == 0)
+		{
+			char *end    = NULL;
+			target_error = strtod(argv[i] + 15, &end);
+
+			if (end == argv[i] + 15 || *end != '\0' || !(target_error > 0))
+			{
+				fprintf(stderr, "(fatal: invalid target error %s)\n", argv[i] + 15);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--count=", 8) == 0)
+		{
+			needle = argv[i] + 8;
+		}
+		else if (strcmp(argv[i], "--recursive") == 0)
+		{
+			recursive = true;
+		}
+		else if (strncmp(argv[i], "--sort=", 7) == 0)
+		{
+			if (strcmp(argv[i] + 7, "name") == 0)
+			{
+				sort = TREE_SORT_NAME;
+			}
+			else if (strcmp(argv[i] + 7, "lines") == 0)
+			{
+				sort = TREE_SORT_LINES;
+			}
+			else
+			{
+				fprintf(stderr, "(fatal: unknown sort order %s, expected name or lines)\n", argv[i] + 7);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--seed=", 7) == 0)
+		{
+			if (!parse_size(argv[i] + 7, &seed))
+			{
+				fprintf(stderr, "(fatal: invalid seed %s)\n", argv[i] + 7);
+				return 1;
+			}
+		}
+		else if (strncmp(argv[i], "--threads=", 10) == 0)
+		{
+			u64 value = 0;
+
+			if (!parse_size(argv[i] + 10, &value) || value > BLOCK_READER_MAX_THREADS)
+			{
+				fprintf(stderr, "(fatal: invalid thread count %s)\n", argv[i] + 10);
+				return 1;
+			}
+
+			reader_config.thread_count = value ? (u32) value : MIN(get_cpu_count(), BLOCK_READER_MAX_THREADS);
+			tree_threads               = value ? (u32) MIN(value, TREE_MAX_THREADS) : 0;
+		}
+		else
+		{
+			argv[out++] = argv[i];
+		}
+	}
+
+	argc = out;
+
 	if (argc < 2)
 	{
 		print_about(argv);
 		return 1;
 	}
 
+	if (print_range)
+	{
+		return print_lines(argv[1], index_path, first_line, last_line) ? 0 : 1;
+	}
+
+	if (recursive)
+	{
+		if (stats || index_path || lengths || state_path || estimate_samples || target_error > 0 || needle)
+		{
+			fprintf(stderr, "(fatal: --recursive only counts lines and cannot be combined with --stats, --index, --lengths, --state, --estimate or --count)\n");
+			return 1;
+		}
+
+		u32 thread_count = tree_threads ? tree_threads : MIN(get_cpu_count(), TREE_MAX_THREADS);
+
+		return count_tree(argv + 1, argc - 1, thread_count, sort, reader_config.roofline_path) ? 0 : 1;
+	}
+
+	if ((stats || index_path || lengths) && reader_config.thread_count > 1)
+	{
+		fprintf(stderr, "(fatal: --stats, --index and --lengths read the file in order and cannot be combined with --threads)\n");
+		return 1;
+	}
+
+	if (state_path && (stats || index_path || lengths))
+	{
+		fprintf(stderr, "(fatal: --state only remembers the line count and cannot be combined with --stats, --index or --lengths)\n");
+		return 1;
+	}
+
+	needle_counter_t needle_counter;
+
+	if (needle)
+	{
+		if (!parse_needle(needle, &needle_counter))
+		{
+			fprintf(stderr, "(fatal: invalid needle %s, it has to be 1 to %u bytes after escapes)\n", needle, MAX_NEEDLE_LENGTH);
+			return 1;
+		}
+
+		if (stats || index_path || lengths || state_path || estimate_samples || target_error > 0)
+		{
+			fprintf(stderr, "(fatal: --count cannot be combined with --stats, --index, --lengths, --state or --estimate)\n");
+			return 1;
+		}
+
+		// Byte counts of disjoint ranges add up, longer needles need the bytes before each block
+		if (needle_counter.length > 1 && reader_config.thread_count > 1)
+		{
+			fprintf(stderr, "(fatal: --count with a needle longer than one byte reads the file in order and cannot be combined with --threads)\n");
+			return 1;
+		}
+	}
+
 	u64 program_start_time = read_os_timer();
 	u64 timer_freq         = get_os_timer_freq();
 
 	const char *file_path = argv[1];
 
-	HANDLE file_handle = CreateFileA(file_path,
-									 GENERIC_READ,
-									 FILE_SHARE_READ,
-									 NULL,
-									 OPEN_EXISTING,
-									 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-									 NULL);
+	if (target_error > 0 && estimate_samples == 0)
+	{
+		estimate_samples = DEFAULT_ESTIMATE_SAMPLES;
+	}
+
+	if (estimate_samples)
+	{
+		if (stats || index_path || lengths || state_path)
+		{
+			fprintf(stderr, "(fatal: --estimate only estimates the line count and cannot be combined with --stats, --index, --lengths or --state)\n");
+			return 1;
+		}
+
+		line_estimate_t estimate;
+
+		if (!estimate_line_count(file_path, estimate_samples, target_error, seed ? seed : program_start_time, &estimate))
+		{
+			return 1;
+		}
+
+		if (estimate.exact)
+		{
+			printf("\ncounted %zu lines\n", estimate.line_count);
+			return 0;
+		}
+
+		u64 low  = estimate.line_count - MIN(estimate.line_count, estimate.half_width);
+		u64 high = estimate.line_count + estimate.half_width;
+
+		printf("\nestimated %zu lines, 95%% interval %zu .. %zu\n", estimate.line_count, low, high);
+
+		if (target_error <= 0 || (f64) estimate.half_width * 100.0 <= target_error * (f64) estimate.line_count)
+		{
+			return 0;
+		}
+
+		printf("(interval is still wider than %.3lf%%, counting exactly)\n", target_error);
+	}
+
+	file_handle_t file_handle = open_file_for_block_reader(file_path, &reader_config);
 
-	if (file_handle == INVALID_HANDLE_VALUE)
+	if (!is_file_handle_valid(file_handle))
 	{
 		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
 		return 1;
@@ -68,83 +1344,178 @@ main(int argc, const char **argv)
 	u64 file_size = get_file_size(file_handle);
 	printf("(file size is %lf GB)\n", ((double) file_size / (double) GIGABYTES(1)));
 
-	char *buffer = (char*) VirtualAlloc(0, FILE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	//
+	// With --state, a file that is still the same file, no shorter, and unchanged in the last STATE_TAIL_SIZE
+	// bytes of the previous count is treated as appended to, and only the bytes after it are read
+	//
+	count_state_t state  = {0};
+	u64 base_line_count  = 0;
+	bool skip_scan       = false;
+	file_handle_t probe  = INVALID_FILE_HANDLE;
 
-	u64 line_count   = 0;
-	u64 bytes_parsed = 0;
-
-	u64 read_time  = 0;
-	u64 think_time = 0;
+	if (state_path)
+	{
+		probe = open_file_for_read(file_path, 0);
 
-	u64 print_bytes_parsed = 0;
-	u64 print_time_elapsed = 0;
+		file_identity_t identity = {0};
 
-	do
-	{
-		u64 block_start = read_os_timer();
+		if (!is_file_handle_valid(probe) || !get_file_identity(probe, &identity))
+		{
+			fprintf(stderr, "(fatal: could not stat file %s)\n", file_path);
+			return 1;
+		}
 
-		DWORD bytes_read = 0;
-		BOOL read_status = ReadFile(file_handle, buffer, FILE_BUFFER_SIZE, &bytes_read, NULL);
+		count_state_t previous;
+		u64 tail_hash = 0;
 
-		u64 read_end_time = read_os_timer();
+		if (!load_count_state(state_path, &previous))
+		{
+			printf("(no usable state in %s, counting from the start)\n", state_path);
+		}
+		else if (previous.identity.device != identity.device || previous.identity.id != identity.id || file_size < previous.size)
+		{
+			printf("(file was replaced or truncated since the last count, counting from the start)\n");
+		}
+		else if (file_size == previous.size && identity.modified_time == previous.identity.modified_time)
+		{
+			printf("(unchanged since the last count)\n");
 
-		if (!read_status)
+			base_line_count = previous.line_count;
+			skip_scan       = true;
+		}
+		else if (!hash_file_tail(probe, previous.size, &tail_hash) || tail_hash != previous.tail_hash)
+		{
+			printf("(file changed before the last counted byte, counting from the start)\n");
+		}
+		else
 		{
-			DWORD last_error = GetLastError();
-			// https://learn.microsoft.com/en-us/windows/win32/debug/system-error-codes
-			fprintf(stderr, "(fatal: could not read from file, system code %u)\n", last_error);
+			printf("(counting the %zu bytes appended after the %zu already counted)\n", file_size - previous.size, previous.size);
 
-			break;
+			base_line_count            = previous.line_count;
+			reader_config.start_offset = previous.size;
 		}
 
-		line_count += handle_block(buffer, bytes_read);
+		state.identity = identity;
+	}
+
+	count_context_t context = {0};
+	context.stats           = stats;
+	context.needle          = needle ? &needle_counter : NULL;
 
-		bytes_parsed       += bytes_read;
-		print_bytes_parsed += bytes_read;
+	line_index_builder_t index_builder;
+	line_stats_t *line_stats = NULL;
 
-		u64 block_end     = read_os_timer();
-		u64 block_elapsed = block_end - block_start;
+	if (lengths)
+	{
+		line_stats = (line_stats_t *) alloc_pages(sizeof(line_stats_t));
+
+		if (line_stats == NULL)
+		{
+			fprintf(stderr, "(fatal: could not allocate the line length stats)\n");
+			return 1;
+		}
 
-		print_time_elapsed += block_elapsed;
+		init_line_stats(line_stats, (u32) top_count, reader_config.block_size);
+		context.lengths = line_stats;
+	}
 
-		if (print_time_elapsed >= (timer_freq / 5))
+	if (index_path)
+	{
+		if (!init_line_index_builder(&index_builder, index_every, file_size))
 		{
-			double mb_per_sec  = ((double) print_bytes_parsed / (double) MEGABYTES(1)) / (print_time_elapsed               / (double) timer_freq);
-			double total_speed = ((double) bytes_parsed       / (double) MEGABYTES(1)) / ((block_end - program_start_time) / (double) timer_freq);
+			fprintf(stderr, "(fatal: could not allocate the line index)\n");
+			return 1;
+		}
+
+		context.index = &index_builder;
+	}
 
-			double eta_in_sec  = ((double) (file_size - bytes_parsed) / (double) MEGABYTES(1)) / mb_per_sec;
+	block_reader_stats_t reader_stats = {0};
 
-			double gb_parsed = ((double) bytes_parsed / (double) GIGABYTES(1));
-			double read_precent = ((double) bytes_parsed / (double) file_size) * 100;
+	if (!skip_scan)
+	{
+		// A partial scan would print a short count, the reader has already said why it failed
+		if (!run_block_reader_passes(file_handle, file_size, reader_config, handle_pass_callback, handle_block_callback, &context, &reader_stats))
+		{
+			fprintf(stderr, "(fatal: could not count %s)\n", file_path);
+			return 1;
+		}
+	}
 
-			u64 read_elpased = (read_end_time - block_start);
+	u64 line_count = base_line_count + context.line_count;
 
-			read_time  += read_elpased;
-			think_time += (block_elapsed - read_elpased);
+	if (needle)
+	{
+		printf("\ncounted %zu occurrences of %s\n", line_count, needle);
+	}
+	else
+	{
+		printf("\ncounted %zu lines\n", line_count);
+	}
 
-			double read_process_ratio = ((double) read_time / (double) think_time);
+	if (state_path)
+	{
+		// The streaming reader keeps going past file_size when the file grows under it, what was counted is what
+		// counts. --threads ranges only make a prefix of the file once every one of them was read in full, which
+		// is when their bytes add up to file_size
+		u64 counted_end  = skip_scan ? file_size : reader_config.start_offset + reader_stats.bytes_parsed;
+		bool is_complete = skip_scan || (!reader_stats.stopped && counted_end >= file_size);
 
-			// printf("\033[2K\r(searched %lf GB, current speed %lf MB/s, overall average %lf MB/s, eta in %.02lfs)", ((double) bytes_parsed / (double) GIGABYTES(1)), mb_per_sec, total_speed, eta_in_sec);
-			printf("\033[2K\r(searched %lf GB (%.02lf%%), current %lf MB/s, average %lf MB/s, eta in %.00lfs, read/process ratio %.02lf)", gb_parsed, read_precent, mb_per_sec, total_speed, eta_in_sec, read_process_ratio);
+		if (!is_complete)
+		{
+			fprintf(stderr, "(the scan ended before the end of the file, state %s left as it was)\n", state_path);
+		}
+		else
+		{
+			state.size       = counted_end;
+			state.line_count = line_count;
 
-			print_time_elapsed = 0;
-			print_bytes_parsed = 0;
+			if (!hash_file_tail(probe, state.size, &state.tail_hash) || !save_count_state(state_path, &state))
+			{
+				fprintf(stderr, "(fatal: could not write state %s)\n", state_path);
+				return 1;
+			}
 		}
 
-	} while (bytes_parsed < file_size);
+		close_file(probe);
+	}
+
+	if (stats)
+	{
+		finish_text_stats(&context.text_stats);
+
+		printf("%zu words\n%zu chars\n%zu bytes\n%zu chars in the longest line\n", context.text_stats.words, context.text_stats.chars, context.text_stats.bytes, context.text_stats.max_line_length);
+	}
+
+	if (lengths)
+	{
+		finish_line_stats(line_stats, reader_config.start_offset + reader_stats.bytes_parsed);
+		print_line_stats(line_stats);
+
+		free_pages(line_stats, sizeof(line_stats_t));
+	}
+
+	if (index_path)
+	{
+		if (!save_line_index(index_path, &index_builder, context.line_count, file_size))
+		{
+			fprintf(stderr, "(fatal: could not write line index %s)\n", index_path);
+			return 1;
+		}
 
-	printf("\ncounted %zu lines\n", line_count);
+		printf("(wrote %zu index entries, one every %zu lines, to %s)\n", index_builder.count, index_every, index_path);
+		free_line_index_builder(&index_builder);
+	}
 
 	u64 total_time               = read_os_timer() - program_start_time;
 	double total_sec             = (double) total_time / (double) timer_freq;
-	double total_file_size_in_mb = (double) file_size / MEGABYTES(1);
+	double total_file_size_in_mb = (double) reader_stats.bytes_parsed / MEGABYTES(1);
 	double mb_per_sec            = total_file_size_in_mb / (total_time / (double) timer_freq);
 
 	printf("(took %lf sec @ average of %lf MB/s)\n", total_sec, mb_per_sec);
+	print_roofline_percent(reader_config.roofline_path, mb_per_sec, reader_config.thread_count);
 
-	VirtualFree(buffer, 0, MEM_RELEASE);
-
-	CloseHandle(file_handle);
+	close_file(file_handle);
 
 	return 0;
 }
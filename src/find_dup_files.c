@@ -19,7 +19,8 @@ inline static void
 print_about(const char **argv)
 {
 	printf("Invalid usage\n"
-		"%s: file\n", argv[0]);
+		"%s: [options] folder\n"
+		BLOCK_READER_OPTIONS_HELP, argv[0]);
 }
 
 inline static bool
@@ -31,37 +32,33 @@ hash_buffer(u8 *start, size_t length, XXH64_state_t *hash_state)
 int 
 main(int argc, const char **argv)
 {
+	block_reader_config_t reader_config = default_block_reader_config(FILE_BUFFER_SIZE, NULL);
+	argc = strip_block_reader_options(argc, argv, &reader_config);
+
 	if (argc < 2)
 	{
 		print_about(argv);
 		return 1;
 	} 
 
-	const char *folder_path_raw         = argv[1];
-	size_t      folder_path_length_raw  = strlen(folder_path_raw);
-
-	if (folder_path_length_raw > (MAX_PATH - 3))
-	{
-		fprintf(stderr, "(fatal: folder path is too long, max supported length is %d)\n", MAX_PATH - 3);
-		return 1;
-	}
-
-	const char *slash_star = "\\\\*";
+#if defined(TIMER)
+	u64 program_start_time = read_os_timer();
+	u64 timer_freq         = get_os_timer_freq();
+#endif
 
-	char folder_path[MAX_PATH + 1];
-	sz_copy_avx2(folder_path, folder_path_raw, folder_path_length_raw);
-	sz_copy_avx2(folder_path + folder_path_length_raw, slash_star, strlen(slash_star) + 1);
+	const char *folder_path_raw = argv[1];
 
-	WIN32_FIND_DATA find_data;
-	HANDLE find = FindFirstFile(folder_path, &find_data);
+	dir_iter_t *dir_iter = (dir_iter_t*) alloc_pages(sizeof(dir_iter_t));
 
-	if (find == INVALID_HANDLE_VALUE)
+	if (!open_dir(folder_path_raw, dir_iter))
 	{
-		fprintf(stderr, "(fatal: FindFirstFile failed)\n");
+		fprintf(stderr, "(fatal: could not open folder %s)\n", folder_path_raw);
 		return 1;
 	}
 
-	u8 *buffer = (u8*) VirtualAlloc(0, FILE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	char folder_path[MAX_PATH_LENGTH + 1];
+
+	u8 *buffer = (u8*) alloc_pages(FILE_BUFFER_SIZE);
 
 	XXH64_state_t * const hash_state = XXH64_createState();
 	if (hash_state == NULL)
@@ -74,37 +71,35 @@ main(int argc, const char **argv)
 
 	file_hash_t *file_hash_map = NULL;
 
-	do
+	u64 total_bytes_parsed = 0;
+
+	dir_entry_t entry;
+
+	while (next_dir_entry(dir_iter, &entry))
 	{
-		if (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		if (entry.is_directory)
 		{
 			// Is a dir
 			continue;
 		}
 		else
 		{
-			sz_copy_avx2(folder_path + folder_path_length_raw + 1, find_data.cFileName, strlen(find_data.cFileName) + 1);
+			if (!join_path(folder_path, sizeof(folder_path), folder_path_raw, entry.name))
+			{
+				fprintf(stderr, "(fatal: path is too long, max supported length is %d)\n", MAX_PATH_LENGTH);
+				return 1;
+			}
 
-			HANDLE file_handle = CreateFileA(folder_path, 
-								 GENERIC_READ,
-								 FILE_SHARE_READ,
-								 NULL,
-								 OPEN_EXISTING,
-								 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-								 NULL);
+			file_handle_t file_handle = open_file_for_block_reader(folder_path, &reader_config);
 
-			if (file_handle == INVALID_HANDLE_VALUE)
+			if (!is_file_handle_valid(file_handle))
 			{
 				fprintf(stderr, "(fatal: could not open file %s)\n", folder_path);
 				return 1;
 			}
 
-			LARGE_INTEGER _file_size;
-			_file_size.LowPart  = find_data.nFileSizeLow;
-			_file_size.HighPart = find_data.nFileSizeHigh;
-
-			u64 file_size = _file_size.QuadPart;
-			// printf("Found %s with size %zu bytes\n", find_data.cFileName, file_size);
+			u64 file_size = get_file_size(file_handle);
+			// printf("Found %s with size %zu bytes\n", entry.name, file_size);
 
 			XXH64_hash_t const hash_seed = HASH_SEED_VALUE;
 		    if (XXH64_reset(hash_state, hash_seed) == XXH_ERROR)
@@ -117,31 +112,39 @@ main(int argc, const char **argv)
 
 			do
 			{
-				DWORD bytes_read = 0;
-				BOOL read_status = ReadFile(file_handle, buffer, FILE_BUFFER_SIZE, &bytes_read, NULL);
+				size_t bytes_read = 0;
+				bool read_status  = read_file(file_handle, buffer, FILE_BUFFER_SIZE, &bytes_read);
 
 				if (!read_status)
 				{
-					DWORD last_error = GetLastError();
-					// https://learn.microsoft.com/en-us/windows/win32/debug/system-error-codes
-					fprintf(stderr, "(fatal: could not read from file, system code %u)\n", last_error);
-					CloseHandle(file_handle);
+					fprintf(stderr, "(fatal: could not read from file, system code %u)\n", get_last_os_error());
 
 					break;
 				}
 
+				if (reader_config.drop_cache)
+				{
+					drop_file_cache(file_handle, bytes_parsed, bytes_read);
+				}
+
 				if (hash_buffer(buffer, bytes_read, hash_state))
 				{
 					fprintf(stderr, "(fatal: hashing error)\n");
-					CloseHandle(file_handle);
 
 					break;
 				}
 
 				bytes_parsed += bytes_read;
 
+				if (bytes_read == 0)
+				{
+					break;
+				}
+
 			} while (bytes_parsed < file_size);
 
+			total_bytes_parsed += bytes_parsed;
+
 			XXH64_hash_t const hash = XXH64_digest(hash_state);
 
 			char *match = hmget(file_hash_map, hash);
@@ -152,8 +155,8 @@ main(int argc, const char **argv)
 			}
 			else
 			{
-				char *entry_path = (char*) VirtualAlloc(0, MAX_PATH, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-				sz_copy_avx2(entry_path, folder_path, MAX_PATH);
+				char *entry_path = (char*) alloc_pages(MAX_PATH_LENGTH + 1);
+				simd.copy(entry_path, folder_path, MAX_PATH_LENGTH + 1);
 
 				hmput(file_hash_map, hash, entry_path);
 
@@ -166,19 +169,29 @@ main(int argc, const char **argv)
 				
 			}
 			
-			CloseHandle(file_handle);
+			close_file(file_handle);
 		}
-	} while (FindNextFile(find, &find_data) != 0);
+	}
 
 	for (u32 i = 0; i < hmlen(file_hash_map); ++i)
 	{
-		VirtualFree(file_hash_map[i].value, 0, MEM_RELEASE);
+		free_pages(file_hash_map[i].value, MAX_PATH_LENGTH + 1);
 	}
 
 	hmfree(file_hash_map);
 
-	FindClose(find);
-	VirtualFree(buffer, 0, MEM_RELEASE);
+#if defined(TIMER)
+	u64 total_time    = read_os_timer() - program_start_time;
+	double total_sec  = (double) total_time / (double) timer_freq;
+	double mb_per_sec = ((double) total_bytes_parsed / MEGABYTES(1)) / total_sec;
+
+	printf("(took %lf sec @ %lf MB/s)\n", total_sec, mb_per_sec);
+	print_roofline_percent(reader_config.roofline_path, mb_per_sec, 1);
+#endif
+
+	close_dir(dir_iter);
+	free_pages(dir_iter, sizeof(dir_iter_t));
+	free_pages(buffer, FILE_BUFFER_SIZE);
 	XXH64_freeState(hash_state);
 
 	return 0;
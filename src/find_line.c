@@ -8,88 +8,479 @@ typedef struct
 	size_t length;
 } phrase_t;
 
+typedef struct
+{
+	phrase_t *phrases;
+	size_t phrase_count;
+
+	// Finds every phrase in one pass when there is more than one
+	multi_pattern_t *matcher;
+
+	// --patterns and -v look every line up here instead, phrases are then only in the set
+	line_set_t *line_set;
+	bool invert;
+
+	// --substring matches phrases anywhere in a line, -i ignores ASCII case (phrases are stored lowered)
+	bool substring;
+	bool fold_case;
+
+	// --regex searches for the pattern's required literals as substrings and confirms each line they hit here
+	regex_t *regex;
+
+	u64 file_size;
+
+	char *leftover_buffer;
+	size_t leftover_capacity;
+	size_t leftover_block_size;
+
+	u64 line_count;
+
+	// -n, and the newline count up to cursor inside the current buffer so each match only counts from the last
+	bool number_lines;
+	char *cursor;
+	u64 cursor_lines;
+
+	// Off for the cold pass of --bench so matches are only printed once
+	bool print_matches;
+} search_context_t;
+
 static void
 print_about(const char **argv)
 {
 	printf("Invalid usage\n"
-		"%s: file <phrases>\nMust supply at least one phrase", argv[0]);
+		"%s: [options] file <phrases>\nMust supply at least one phrase, or --patterns\n"
+		"  --patterns=<file>     also match every line of file, one hash lookup per searched line however many\n"
+		"                        lines it has\n"
+		"  -v                    report the lines that match no phrase instead\n"
+		"  -n                    report the line number of every match\n"
+		"  --substring           match phrases anywhere in a line and report the whole line\n"
+		"  -i                    ignore ASCII case when matching phrases\n"
+		"  --regex               phrases are extended regular expressions, matched anywhere in a line\n"
+		BLOCK_READER_OPTIONS_HELP, argv[0]);
+}
+
+static void
+print_line_match(search_context_t *context, char *line, size_t line_length, u64 line_number)
+{
+	if (context->number_lines)
+	{
+		printf("\nMATCH! '%.*s' on line %zu\n", (int) line_length, line, line_number);
+	}
+	else
+	{
+		printf("\nMATCH! '%.*s'\n", (int) line_length, line);
+	}
+}
+
+//
+// line_start points into the buffer handed to handle_block_match_whole_line, whose first carried bytes are the
+// end of the previous block. Every newline before the block is already in context->line_count, the ones after
+// it are counted from the cursor left by the previous match, so a block with many matches is counted once
+//
+static void
+report_whole_line_match(search_context_t *context, char *block, char *line_start, size_t line_length)
+{
+	if (!context->print_matches)
+	{
+		return;
+	}
+
+	if (!context->number_lines)
+	{
+		print_line_match(context, line_start, line_length, 0);
+		return;
+	}
+
+	char *target = (line_start > block) ? line_start : block;
+
+	// Patterns that span lines can report a match that starts before the previous one
+	if (target >= context->cursor)
+	{
+		context->cursor_lines += count_byte_in_block(context->cursor, target - context->cursor, "\n");
+	}
+	else
+	{
+		context->cursor_lines -= count_byte_in_block(target, context->cursor - target, "\n");
+	}
+
+	context->cursor = target;
+
+	print_line_match(context, line_start, line_length, context->cursor_lines + 1);
+}
+
+//
+// Copies everything from the last newline on into the end of the overflow buffer, for the next block to finish.
+// The first line of the file has no newline in front, while it is unfinished it is carried behind a made up
+// one so the next block sees it like any other line, if it fits. A line longer than the buffer loses its start
+// and is not matched
+//
+static size_t
+carry_last_line(char *start, size_t length, char *overflow_start, size_t overflow_length, bool is_file_start)
+{
+	size_t leftover_size = 0;
+
+	sz_cptr_t last_newline = simd.rfind_byte(start, length, "\n");
+
+	if (last_newline != NULL)
+	{
+		leftover_size = (start + length) - last_newline;
+		leftover_size = leftover_size > overflow_length ? overflow_length : leftover_size;
+
+		simd.copy(overflow_start + overflow_length - leftover_size, last_newline, leftover_size);
+	}
+	else if (is_file_start && length && length < overflow_length)
+	{
+		leftover_size = length + 1;
+
+		overflow_start[overflow_length - leftover_size] = '\n';
+		simd.copy(overflow_start + overflow_length - length, start, length);
+	}
+
+	return leftover_size;
 }
 
+//
+// Walks the newlines and looks up every complete line, a line only counts as complete from the newline before
+// it (or the start of the file). Line numbers come from the same walk
+//
 size_t
-handle_block_match_whole_line(char *start, size_t length, 
+handle_block_match_line_set(char *start, size_t length, size_t carried,
 			 char *overflow_start, size_t overflow_length,
-	         phrase_t *phrases, size_t num_phrases, 
-	         u64 starting_line_count)
+			 search_context_t *context, bool is_file_start, bool is_file_end)
 {
-	const char *newline_str = "\n";
+	char *block = start + carried;
+	char *end   = start + length;
+
+	u64 lines_before = context->line_count;
+	char *line       = is_file_start ? start : NULL;
+	char *at         = start;
+
+	for (;;)
+	{
+		sz_cptr_t newline = simd.find_byte(at, end - at, "\n");
+
+		// With no newline after it, the last line of the file still counts
+		if (newline == NULL && !(is_file_end && line && line < end))
+		{
+			break;
+		}
+
+		char *line_end = newline ? (char *) newline : end;
+
+		if (line && context->print_matches && is_in_line_set(context->line_set, (u8 const *) line, line_end - line) != context->invert)
+		{
+			print_line_match(context, line, line_end - line, lines_before + 1);
+		}
+
+		if (newline == NULL)
+		{
+			break;
+		}
+
+		// The carried newline is already in line_count
+		lines_before += (line_end >= block);
+
+		line = line_end + 1;
+		at   = line;
+	}
+
+	return carry_last_line(start, length, overflow_start, overflow_length, is_file_start);
+}
 
-	for (u32 i = 0; i < num_phrases; ++i)
+inline static sz_cptr_t
+find_phrase(search_context_t *context, sz_cptr_t haystack, size_t length, sz_cptr_t phrase, size_t phrase_length)
+{
+	return context->fold_case ? simd.find_case(haystack, length, phrase, phrase_length) :
+	                            simd.find(haystack, length, phrase, phrase_length);
+}
+
+//
+// Phrases are stored as '\n' phrase '\n', so a hit is always a whole line. The first line of the file has no
+// newline in front, it is matched as if there was one
+//
+size_t
+handle_block_match_whole_line(char *start, size_t length, size_t carried,
+			 char *overflow_start, size_t overflow_length,
+			 search_context_t *context, bool is_file_start)
+{
+	char *block = start + carried;
+
+	context->cursor       = block;
+	context->cursor_lines = context->line_count;
+
+	if (context->matcher)
 	{
-		const char *phrase   = phrases[i].phrase;
-		size_t phrase_length = phrases[i].length;
+		multi_pattern_scan_t scan;
+		init_multi_pattern_scan(&scan, is_file_start ? step_multi_pattern(context->matcher, 0, '\n') : 0);
+
+		while (find_next_multi_pattern(context->matcher, (u8 const *) start, length, &scan))
+		{
+			phrase_t *phrase = &context->phrases[scan.pattern];
+
+			report_whole_line_match(context, block, start + scan.end - phrase->length + 1, phrase->length - 2);
+		}
+	}
+	else
+	{
+		const char *phrase   = context->phrases[0].phrase;
+		size_t phrase_length = context->phrases[0].length;
+
+		if (is_file_start && length >= phrase_length - 1 && find_phrase(context, start, phrase_length - 1, phrase + 1, phrase_length - 1) == start)
+		{
+			report_whole_line_match(context, block, start, phrase_length - 2);
+		}
 
 		size_t buf_remain = length;
 		sz_cptr_t buf     = start;
 
-		while (buf_remain)
+		while (buf_remain >= phrase_length)
 		{
-			sz_cptr_t phrase_start = sz_find_avx2(buf, buf_remain, phrase, phrase_length);
+			sz_cptr_t phrase_start = find_phrase(context, buf, buf_remain, phrase, phrase_length);
 
 			if (phrase_start == NULL)
 			{
 				break;
 			}
 
-			sz_cptr_t line_end = sz_find_byte_avx2(phrase_start + 1, length - (phrase_start - start), newline_str);
-			size_t line_length = line_end - phrase_start;
+			report_whole_line_match(context, block, (char *) phrase_start + 1, phrase_length - 2);
 
-			size_t up_to_line_count = count_byte_in_block(start, line_end - buf + 1, newline_str);
-
-			printf("\nMATCH! '%.*s' on line %zu\n", (int) line_length - 1, phrase_start + 1, starting_line_count + up_to_line_count);
-			
-			buf = line_end;
+			// The closing newline can open the next matching line
+			buf        = phrase_start + phrase_length - 1;
 			buf_remain = length - (buf - start);
 		}
 	}
 
-	size_t leftover_size = 0;
+	return carry_last_line(start, length, overflow_start, overflow_length, is_file_start);
+}
+
+//
+// Reports the line around the hit at match, if the regex (when there is one) agrees, and returns its end.
+// Everything after the last newline is carried to the next block, so the caller only searches up to it unless
+// the file ends here
+//
+static char *
+report_substring_match(search_context_t *context, char *start, char *block, char *end, sz_cptr_t match)
+{
+	sz_cptr_t line_newline = simd.rfind_byte(start, match - start, "\n");
+	sz_cptr_t end_newline  = simd.find_byte(match, end - match, "\n");
 
-	sz_cptr_t last_newline = sz_rfind_byte_avx2(start, length, newline_str);
+	char *line_start = line_newline ? (char *) line_newline + 1 : start;
+	char *line_end   = end_newline ? (char *) end_newline : end;
 
-	if (last_newline != NULL)
+	if (context->regex == NULL || match_regex_line(context->regex, (u8 const *) line_start, line_end - line_start))
 	{
-		leftover_size = (start + length) - last_newline;
-		leftover_size = leftover_size > overflow_length ? overflow_length : leftover_size;
+		report_whole_line_match(context, block, line_start, line_end - line_start);
+	}
+
+	return line_end;
+}
+
+//
+// Phrases are searched for without their newlines, a line with several hits is reported once and the search
+// resumes on the next line
+//
+size_t
+handle_block_match_substring(char *start, size_t length, size_t carried,
+			 char *overflow_start, size_t overflow_length,
+			 search_context_t *context, bool is_file_start, bool is_file_end)
+{
+	char *block = start + carried;
+	char *end   = start + length;
+	char *limit = end;
+
+	context->cursor       = block;
+	context->cursor_lines = context->line_count;
+
+	size_t leftover_size = carry_last_line(start, length, overflow_start, overflow_length, is_file_start);
+
+	if (!is_file_end)
+	{
+		// A block with no newline at all is only carried as the start of the file, otherwise search what there
+		// is of the line
+		sz_cptr_t last_newline = simd.rfind_byte(start, length, "\n");
+		limit                  = last_newline ? (char *) last_newline : leftover_size ? start : end;
+	}
+
+	if (context->matcher)
+	{
+		multi_pattern_scan_t scan;
+		init_multi_pattern_scan(&scan, 0);
+
+		while (find_next_multi_pattern(context->matcher, (u8 const *) start, limit - start, &scan))
+		{
+			sz_cptr_t match = start + scan.end - (context->phrases[scan.pattern].length - 2);
+			char *line_end  = report_substring_match(context, start, block, end, match);
+
+			// Skip the rest of the line, the root state is right at a line start
+			init_multi_pattern_scan(&scan, 0);
+			scan.offset = MIN((size_t) (line_end - start), (size_t) (limit - start));
+		}
+	}
+	else if (context->phrase_count)
+	{
+		const char *phrase   = context->phrases[0].phrase + 1;
+		size_t phrase_length = context->phrases[0].length - 2;
 
-		sz_copy_avx2(overflow_start + overflow_length - leftover_size, last_newline, leftover_size);
+		char *at = start;
+
+		while (at < limit)
+		{
+			sz_cptr_t match = find_phrase(context, at, limit - at, phrase, phrase_length);
+
+			if (match == NULL)
+			{
+				break;
+			}
+
+			at = report_substring_match(context, start, block, end, match) + 1;
+		}
+	}
+	else
+	{
+		// A regex with no required literal, every line goes through it. Lines run up to and including the last
+		// newline, the next block gets that newline back in front of its carried line and skips it
+		char *lines_end = (limit < end && *limit == '\n') ? limit + 1 : limit;
+
+		for (char *at = start + (carried && *start == '\n'); at < lines_end;)
+		{
+			at = report_substring_match(context, start, block, end, at) + 1;
+		}
 	}
 
 	return leftover_size;
 }
 
+static bool
+handle_block_callback(u8 *block, size_t block_size, u64 block_offset, void *user_data)
+{
+	const char *newline_str = "\n";
+
+	search_context_t *context = (search_context_t *) user_data;
+
+	char *buffer         = (char *) block;
+	char *virtual_buffer = buffer - context->leftover_block_size;
+
+	// A mapped file arrives as one block, there is no next block to carry a dangling line into
+	bool is_whole_file = (block_offset == 0) && (block_size == context->file_size);
+
+	// The reader's closing empty block, only now is the carried line known to be the last one
+	bool is_file_end = is_whole_file || (block_size == 0);
+
+	size_t leftover_capacity = is_whole_file ? 0 : context->leftover_capacity;
+
+	simd.copy(virtual_buffer, context->leftover_buffer + context->leftover_capacity - context->leftover_block_size, context->leftover_block_size);
+
+	if (context->line_set)
+	{
+		context->leftover_block_size = handle_block_match_line_set(virtual_buffer, block_size + context->leftover_block_size,
+		                                                           context->leftover_block_size,
+		                                                           context->leftover_buffer, leftover_capacity,
+		                                                           context, block_offset == 0, is_file_end);
+	}
+	else if (context->substring)
+	{
+		context->leftover_block_size = handle_block_match_substring(virtual_buffer, block_size + context->leftover_block_size,
+		                                                            context->leftover_block_size,
+		                                                            context->leftover_buffer, leftover_capacity,
+		                                                            context, block_offset == 0, is_file_end);
+	}
+	else
+	{
+		context->leftover_block_size = handle_block_match_whole_line(virtual_buffer, block_size + context->leftover_block_size,
+		                                                             context->leftover_block_size,
+		                                                             context->leftover_buffer, leftover_capacity,
+		                                                             context, block_offset == 0);
+	}
+
+	context->line_count += count_byte_in_block(buffer, block_size, newline_str);
+
+	return true;
+}
+
+static void
+handle_pass_callback(void *user_data, bool is_final_pass)
+{
+	search_context_t *context = (search_context_t *) user_data;
+
+	context->leftover_block_size = 0;
+	context->line_count          = 0;
+	context->print_matches       = is_final_pass;
+}
+
 int 
 main(int argc, const char **argv)
 {
-	if (argc < 3)
+	block_reader_config_t reader_config = default_block_reader_config(FILE_BUFFER_SIZE, "searched");
+	reader_config.allow_mmap            = true;
+	reader_config.end_with_empty_block  = true;
+
+	argc = strip_block_reader_options(argc, argv, &reader_config);
+
+	int out                  = 1;
+	const char *pattern_path = NULL;
+	bool invert              = false;
+	bool number_lines        = false;
+	bool substring           = false;
+	bool fold_case           = false;
+	bool regex_mode          = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], "--patterns=", 11) == 0)
+		{
+			pattern_path = argv[i] + 11;
+		}
+		else if (strcmp(argv[i], "-v") == 0)
+		{
+			invert = true;
+		}
+		else if (strcmp(argv[i], "-n") == 0)
+		{
+			number_lines = true;
+		}
+		else if (strcmp(argv[i], "--substring") == 0)
+		{
+			substring = true;
+		}
+		else if (strcmp(argv[i], "-i") == 0)
+		{
+			fold_case = true;
+		}
+		else if (strcmp(argv[i], "--regex") == 0)
+		{
+			regex_mode = true;
+		}
+		else
+		{
+			argv[out++] = argv[i];
+		}
+	}
+
+	argc = out;
+
+	if (argc < (pattern_path ? 2 : 3))
 	{
 		print_about(argv);
 		return 1;
 	}
 
+	if ((substring || fold_case || regex_mode) && (pattern_path || invert))
+	{
+		fprintf(stderr, "(fatal: --substring, -i and --regex cannot be combined with --patterns or -v)\n");
+		return 1;
+	}
+
+	// A regex is always searched for anywhere in the line, ^ and $ pin it to the ends
+	substring = substring || regex_mode;
+
 	u64 program_start_time = read_os_timer();
 	u64 timer_freq         = get_os_timer_freq();
 
 	const char *file_path  = argv[1];
 
-	HANDLE file_handle = CreateFileA(file_path,
-									 GENERIC_READ,
-									 FILE_SHARE_READ,
-									 NULL,
-									 OPEN_EXISTING,
-									 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-									 NULL);
+	file_handle_t file_handle = open_file_for_block_reader(file_path, &reader_config);
 
-	if (file_handle == INVALID_HANDLE_VALUE)
+	if (!is_file_handle_valid(file_handle))
 	{
 		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
 		return 1;
@@ -99,127 +490,213 @@ main(int argc, const char **argv)
 	u64 file_size = get_file_size(file_handle);
 	printf("(file size is %lf GB)\n", ((double) file_size / (double) GIGABYTES(1)));
 
+	//
+	// Compile the regex, its required literals become the phrases
+	//
+	regex_t regex;
+
+	if (regex_mode)
+	{
+		for (int i = 2; i < argc; ++i)
+		{
+			printf("(searching for regex %s)\n", argv[i]);
+		}
+
+		if (!init_regex(&regex, argv + 2, (u32) (argc - 2), fold_case))
+		{
+			fprintf(stderr, "(fatal: bad regex %s: %s)\n", argv[2 + regex.error_pattern], regex.error);
+			return 1;
+		}
+
+		if (regex.literal_count == 0)
+		{
+			printf("(no literal is common to every match, every line goes through the regex)\n");
+		}
+	}
+
 	//
 	// Assemble phrases
 	//
-	size_t phrase_count = argc - 2;
-	phrase_t *phrases   = (phrase_t*) VirtualAlloc(0, sizeof(phrase_t) * phrase_count, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	size_t phrase_count = regex_mode ? regex.literal_count : (size_t) (argc - 2);
+	phrase_t *phrases   = (phrase_t*) alloc_pages(sizeof(phrase_t) * phrase_count);
 
 	for (u32 i = 0; i < phrase_count; ++i)
 	{
-		const char *phrase_raw = argv[2 + i];
-		phrases[i].length      = strlen(phrase_raw);
+		const char *phrase_raw = regex_mode ? (const char *) regex.literals[i].data : argv[2 + i];
+		phrases[i].length      = regex_mode ? regex.literals[i].length : strlen(phrase_raw);
 
-		printf("(searching for %s)\n", phrase_raw);
+		printf(regex_mode ? "(prefiltering on %.*s)\n" : "(searching for %.*s)\n", (int) phrases[i].length, phrase_raw);
 
-		phrases[i].phrase = (char*) VirtualAlloc(0, phrases[i].length + 2, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-		sz_copy_avx2(phrases[i].phrase + 1, phrase_raw, phrases[i].length);
+		phrases[i].phrase = (char*) alloc_pages(phrases[i].length + 2);
+		simd.copy(phrases[i].phrase + 1, phrase_raw, phrases[i].length);
 
 		phrases[i].phrase[0]                     = '\n';
 		phrases[i].phrase[phrases[i].length + 1] = '\n';
 
+		if (fold_case)
+		{
+			lower_ascii_case(phrases[i].phrase + 1, phrases[i].length);
+		}
+
 		phrases[i].length += 2;
 	}
 
 	//
-	// Alloc buffer
-	// The second half of the buffer is used to hold our current file read. The first half contains the dangingling
-	// last line of the previous buffer
+	// Alloc leftover buffer
+	// Holds the dangling last line of the previous block, it gets copied into the headroom in front of the next
+	// block so the line can be matched as a whole
 	//
-	char *buffer_real     = (char*) VirtualAlloc(0, FILE_BUFFER_SIZE * 2, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-	char *buffer          = buffer_real + FILE_BUFFER_SIZE;
-	char *leftover_buffer = buffer_real;
+	search_context_t context = {0};
+	context.phrases           = phrases;
+	context.phrase_count      = phrase_count;
+	context.number_lines      = number_lines;
+	context.substring         = substring;
+	context.fold_case         = fold_case;
+	context.regex             = regex_mode ? &regex : NULL;
 
-	const char *newline_str = "\n";
+	multi_pattern_t matcher;
+	line_set_t line_set;
 
-	u64 line_count   = 0;
-	u64 bytes_parsed = 0;
+	file_handle_t pattern_file = INVALID_FILE_HANDLE;
+	mapped_file_t pattern_map  = {0};
 
-	u64 read_time  = 0;
-	u64 think_time = 0;
+	if (pattern_path || invert)
+	{
+		u64 pattern_size  = 0;
+		u64 pattern_lines = 0;
 
-	u64 print_bytes_parsed = 0;
-	u64 print_time_elapsed = 0;
+		if (pattern_path)
+		{
+			pattern_file = open_file_for_read(pattern_path, 0);
+			pattern_size = is_file_handle_valid(pattern_file) ? get_file_size(pattern_file) : 0;
 
-	size_t leftover_block_size = 0;
+			if (!is_file_handle_valid(pattern_file) || (pattern_size && !map_file(pattern_file, pattern_size, true, &pattern_map)))
+			{
+				fprintf(stderr, "(fatal: could not load patterns from %s)\n", pattern_path);
+				return 1;
+			}
 
-	do
-	{
-		u64 block_start = read_os_timer();
+			// One more for a last line with no newline
+			pattern_lines = count_byte_in_block((char *) pattern_map.data, (size_t) pattern_size, "\n") + 1;
+		}
 
-		DWORD bytes_read = 0;
-		BOOL read_status = ReadFile(file_handle, buffer, FILE_BUFFER_SIZE, &bytes_read, NULL);
+		if (!init_line_set(&line_set, pattern_lines + phrase_count))
+		{
+			fprintf(stderr, "(fatal: could not allocate the pattern set)\n");
+			return 1;
+		}
 
-		u64 read_end_time = read_os_timer();
+		u8 const *at  = pattern_map.data;
+		u8 const *end = pattern_map.data + pattern_size;
 
-		if (!read_status)
+		while (at < end)
 		{
-			DWORD last_error = GetLastError();
-			// https://learn.microsoft.com/en-us/windows/win32/debug/system-error-codes
-			fprintf(stderr, "(fatal: could not read from file, system code %u)\n", last_error);
+			sz_cptr_t newline  = simd.find_byte((sz_cptr_t) at, end - at, "\n");
+			u8 const *line_end = newline ? (u8 const *) newline : end;
 
-			break;
+			add_to_line_set(&line_set, at, line_end - at);
+
+			at = line_end + 1;
 		}
 
-		char *virtual_buffer = buffer - leftover_block_size;
+		// The phrases without their newlines
+		for (u32 i = 0; i < phrase_count; ++i)
+		{
+			add_to_line_set(&line_set, (u8 const *) phrases[i].phrase + 1, phrases[i].length - 2);
+		}
 
-		leftover_block_size = handle_block_match_whole_line(virtual_buffer, bytes_read + leftover_block_size, 
-			                                                leftover_buffer, FILE_BUFFER_SIZE,
-			                                                phrases, phrase_count, 
-			                                                line_count);
+		printf("(matching %zu distinct lines with one lookup per line%s)\n", line_set.count, invert ? ", reporting the lines that match none" : "");
 
-		line_count += count_byte_in_block(buffer, bytes_read, newline_str);
+		context.line_set = &line_set;
+		context.invert   = invert;
+	}
+	else if (phrase_count > 1)
+	{
+		const char **patterns = (const char **) alloc_pages(sizeof(const char *) * phrase_count);
+		size_t *lengths       = (size_t *) alloc_pages(sizeof(size_t) * phrase_count);
 
-		bytes_parsed       += bytes_read;
-		print_bytes_parsed += bytes_read;
+		// Substring phrases go in without their newlines
+		for (u32 i = 0; i < phrase_count; ++i)
+		{
+			patterns[i] = phrases[i].phrase + (substring ? 1 : 0);
+			lengths[i]  = phrases[i].length - (substring ? 2 : 0);
+		}
 
-		u64 block_end     = read_os_timer();
-		u64 block_elapsed = block_end - block_start;
+		bool built = init_multi_pattern(&matcher, patterns, lengths, (u32) phrase_count, fold_case);
 
-		print_time_elapsed += block_elapsed;
-		if (print_time_elapsed >= (timer_freq / 5))
-		{
-			double mb_per_sec  = ((double) print_bytes_parsed / (double) MEGABYTES(1)) / (print_time_elapsed               / (double) timer_freq);
-			double total_speed = ((double) bytes_parsed       / (double) MEGABYTES(1)) / ((block_end - program_start_time) / (double) timer_freq);
+		free_pages(patterns, sizeof(const char *) * phrase_count);
+		free_pages(lengths, sizeof(size_t) * phrase_count);
 
-			double eta_in_sec  = ((double) (file_size - bytes_parsed) / (double) MEGABYTES(1)) / mb_per_sec;
+		if (!built)
+		{
+			fprintf(stderr, "(fatal: could not build the matcher for %zu phrases)\n", phrase_count);
+			return 1;
+		}
 
-			double gb_parsed = ((double) bytes_parsed / (double) GIGABYTES(1));
-			double read_precent = ((double) bytes_parsed / (double) file_size) * 100;
+		printf("(matching %zu phrases in one pass, %u states)\n", phrase_count, matcher.state_count);
 
-			u64 read_elpased = (read_end_time - block_start);
+		context.matcher = &matcher;
+	}
 
-			read_time  += read_elpased;
-			think_time += (block_elapsed - read_elpased);
+	context.file_size         = file_size;
+	context.leftover_capacity = reader_config.block_size;
+	context.leftover_buffer   = (char*) alloc_pages(context.leftover_capacity);
 
-			double read_process_ratio = ((double) read_time / (double) think_time);
+	reader_config.block_headroom = context.leftover_capacity;
 
-			// printf("\033[2K\r(searched %lf GB, current speed %lf MB/s, overall average %lf MB/s, eta in %.02lfs)", ((double) bytes_parsed / (double) GIGABYTES(1)), mb_per_sec, total_speed, eta_in_sec);
-			printf("\033[2K\r(searched %lf GB (%.02lf%%), current %lf MB/s, average %lf MB/s, eta in %.00lfs, read/process ratio %.02lf)", gb_parsed, read_precent, mb_per_sec, total_speed, eta_in_sec, read_process_ratio);
+	run_block_reader_passes(file_handle, file_size, reader_config, handle_pass_callback, handle_block_callback, &context, NULL);
 
-			print_time_elapsed = 0;
-			print_bytes_parsed = 0;
-		}
-	} while (bytes_parsed < file_size);
+	u64 line_count = context.line_count;
 
 	printf("\nsearched %zu lines\n", line_count);
 
+	if (context.regex && context.regex->flush_count)
+	{
+		printf("(the regex dfa outgrew its %u MB cache %zu times)\n", (u32) (REGEX_DFA_CACHE_SIZE / MEGABYTES(1)), context.regex->flush_count);
+	}
+
 	u64 total_time               = read_os_timer() - program_start_time;
 	double total_sec             = (double) total_time / (double) timer_freq;
 	double total_file_size_in_mb = (double) file_size / MEGABYTES(1);
 	double mb_per_sec            = total_file_size_in_mb / (total_time / (double) timer_freq);
 
 	printf("(took %lf sec @ average of %lf MB/s)\n", total_sec, mb_per_sec);
+	print_roofline_percent(reader_config.roofline_path, mb_per_sec, 1);
 
-	VirtualFree(buffer_real, 0, MEM_RELEASE);
+	free_pages(context.leftover_buffer, context.leftover_capacity);
+
+	if (context.matcher)
+	{
+		free_multi_pattern(context.matcher);
+	}
+
+	if (context.line_set)
+	{
+		free_line_set(context.line_set);
+	}
+
+	if (context.regex)
+	{
+		free_regex(context.regex);
+	}
+
+	if (pattern_map.data)
+	{
+		unmap_file(&pattern_map);
+	}
+
+	if (is_file_handle_valid(pattern_file))
+	{
+		close_file(pattern_file);
+	}
 
 	for (u32 i = 0; i < phrase_count; ++i)
 	{
-		VirtualFree(phrases[i].phrase, 0, MEM_RELEASE);
+		free_pages(phrases[i].phrase, phrases[i].length);
 	}
-	VirtualFree(phrases, 0, MEM_RELEASE);
+	free_pages(phrases, sizeof(phrase_t) * phrase_count);
 
-	CloseHandle(file_handle);
+	close_file(file_handle);
 
 	return 0;
 }
@@ -1,117 +1,2092 @@
 #include "common/common.c"
 
-#define FILE_BUFFER_SIZE (MEGABYTES(5))
+#include <math.h>
+
+//
+// Read benchmark matrix. Sweeps access method x block size x queue depth x thread count over one file and
+// prints a row per cell, so the read strategy for a storage tier comes from measurements instead of guessing
+// FILE_BUFFER_SIZE. --random switches to small random reads and reports IOPS and latency percentiles instead,
+// --scaling reads a set of files with a growing thread count to find where aggregate bandwidth saturates.
+// --roofline skips the disk and measures the memory ceilings the tools are compared against.
+//
+
+#define MAX_SWEEP_VALUES (32)
+#define MAX_THREADS      (256)
+
+typedef enum
+{
+	BENCH_METHOD_READ,
+	BENCH_METHOD_PREAD,
+	BENCH_METHOD_MMAP,
+	BENCH_METHOD_DIRECT,
+	BENCH_METHOD_URING,
+	BENCH_METHOD_URING_DIRECT,
+
+	BENCH_METHOD_COUNT
+} bench_method_t;
+
+static const char *bench_method_names[BENCH_METHOD_COUNT] =
+{
+	"read",
+	"pread",
+	"mmap",
+	"direct",
+	"uring",
+	"uring_direct",
+};
+
+typedef enum
+{
+	OUTPUT_FORMAT_CSV,
+	OUTPUT_FORMAT_JSON,
+} output_format_t;
+
+typedef enum
+{
+	OFFSET_DISTRIBUTION_UNIFORM,
+	OFFSET_DISTRIBUTION_ZIPF,
+} offset_distribution_t;
+
+// Warm leaves the page cache alone, cold evicts the file(s) before every cell, both runs each cell cold then warm
+typedef enum
+{
+	CACHE_MODE_WARM,
+	CACHE_MODE_COLD,
+	CACHE_MODE_BOTH,
+} cache_mode_t;
+
+typedef struct
+{
+	u64 values[MAX_SWEEP_VALUES];
+	u32 count;
+} sweep_t;
+
+typedef struct
+{
+	bool methods[BENCH_METHOD_COUNT];
+
+	sweep_t block_sizes;
+	sweep_t queue_depths;
+	sweep_t thread_counts;
+
+	output_format_t format;
+	cache_mode_t cache_mode;
+
+	// Random read mode, block_sizes become the io sizes and thread_counts the number of outstanding reads
+	bool random;
+	offset_distribution_t distribution;
+	f64 zipf_theta;
+	f64 duration_seconds;
+	u64 max_ops;
+
+	// Scaling mode, thread_counts is the sweep and files are shared out between the threads
+	bool scaling;
+
+	bool roofline;
+	const char *roofline_save_path;
+} bench_options_t;
+
+typedef struct
+{
+	bench_method_t method;
+	size_t block_size;
+	u32    queue_depth;
+	u32    thread_count;
+
+	bool cold;
+	f64  resident_percent;
+
+	bool skipped;
+
+	u64 bytes;
+	u64 syscalls;
+	u64 page_faults;
+	f64 wall_seconds;
+	f64 cpu_seconds;
+} bench_result_t;
+
+typedef struct
+{
+	file_handle_t file;
+	u8 *mapping;
+
+	u64 range_start;
+	u64 range_end;
+
+	size_t block_size;
+	u8    *buffer;
+
+	u64 bytes;
+	u64 syscalls;
+	u64 checksum;
+
+	bool failed;
+} bench_worker_t;
 
 static void
 print_about(const char **argv)
 {
 	printf("Invalid usage\n"
-		"%s: file\n", argv[0]);
+		"%s: [options] file\n"
+		"%s: --scaling [options] file|folder...\n"
+		"%s: --roofline [--save=<file>] [--format=<csv|json>]\n"
+		"  --methods=<list>       any of read,pread,mmap,direct,uring,uring_direct (default all)\n"
+		"  --block-sizes=<list>   e.g. 64K,1M,16M (default 64K to 64M in powers of 4)\n"
+		"  --queue-depths=<list>  io_uring depths (default 1,4,16)\n"
+		"  --threads=<list>       threads for pread/mmap/direct (default 1 and the core count)\n"
+		"  --format=<csv|json>    output format (default csv)\n"
+		"  --cache=<warm|cold|both>  evict the file from the page cache before each cell, both prints\n"
+		"                         a cold row followed by a warm one (default warm, sequential and scaling)\n"
+		"\n"
+		"  --random               random reads, reports IOPS and p50/p99/p99.9 latency\n"
+		"                         methods pread,direct, block sizes 4K,64K,1M and threads 1,4,16 unless given\n"
+		"  --distribution=<uniform|zipf>  offset distribution (default uniform)\n"
+		"  --zipf-theta=<value>   skew for zipf, 0 < theta < 1 (default 0.99)\n"
+		"  --duration=<seconds>   time per cell (default 2)\n"
+		"  --ops=<count>          stop a cell early after this many reads\n"
+		"\n"
+		"  --scaling              read every file given (folders are read like find_dup_files does) with\n"
+		"                         1, 2, 4 .. core count threads, methods pread,direct and 1M blocks unless given\n"
+		"\n"
+		"  --roofline             L1/L2/L3 scan, DRAM read and memcpy bandwidth on one and all cores\n"
+		"  --save=<file>          write the ceilings for the tools' --roofline=<file> option\n"
+		"  --simd=<level>         scan kernel level, serial, sse2, avx2, avx512 or neon (default: widest supported)\n", argv[0], argv[0], argv[0]);
 }
 
-int 
-main(int argc, const char **argv)
+inline static bool
+parse_sweep(const char *text, sweep_t *sweep)
 {
-	if (argc < 2)
+	sweep->count = 0;
+
+	char value[64];
+
+	while (*text)
 	{
-		print_about(argv);
-		return 1;
-	}
+		const char *comma = strchr(text, ',');
+		size_t length     = comma ? (size_t) (comma - text) : strlen(text);
+
+		if (length == 0 || length >= sizeof(value) || sweep->count == MAX_SWEEP_VALUES)
+		{
+			return false;
+		}
 
-	u64 program_start_time = read_os_timer();
-	u64 timer_freq         = get_os_timer_freq();
+		memcpy(value, text, length);
+		value[length] = 0;
+
+		if (!parse_size(value, &sweep->values[sweep->count]) || sweep->values[sweep->count] == 0)
+		{
+			return false;
+		}
 
-	const char *file_path = argv[1];
+		sweep->count += 1;
+		text         += length + (comma ? 1 : 0);
+	}
 
-	HANDLE file_handle = CreateFileA(file_path,
-									 GENERIC_READ,
-									 FILE_SHARE_READ,
-									 NULL,
-									 OPEN_EXISTING,
-									 FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
-									 NULL);
+	return sweep->count > 0;
+}
 
-	if (file_handle == INVALID_HANDLE_VALUE)
+inline static bool
+parse_methods(const char *text, bool methods[BENCH_METHOD_COUNT])
+{
+	for (u32 i = 0; i < BENCH_METHOD_COUNT; ++i)
 	{
-		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
-		return 1;
+		methods[i] = false;
 	}
 
-	u64 file_size = get_file_size(file_handle);
-	printf("(file size is %lf GB)\n", ((double) file_size / (double) GIGABYTES(1)));
+	while (*text)
+	{
+		const char *comma = strchr(text, ',');
+		size_t length     = comma ? (size_t) (comma - text) : strlen(text);
+
+		bool found = false;
+
+		for (u32 i = 0; i < BENCH_METHOD_COUNT; ++i)
+		{
+			if (strlen(bench_method_names[i]) == length && strncmp(text, bench_method_names[i], length) == 0)
+			{
+				methods[i] = true;
+				found      = true;
+			}
+		}
 
-	char *buffer = (char*) VirtualAlloc(0, FILE_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+		if (!found)
+		{
+			return false;
+		}
+
+		text += length + (comma ? 1 : 0);
+	}
 
-	u64 line_count   = 0;
-	u64 bytes_parsed = 0;
+	return true;
+}
 
-	u64 print_bytes_parsed = 0;
-	u64 print_time_elapsed = 0;
+static THREAD_PROC(bench_worker_thread)
+{
+	bench_worker_t *worker = (bench_worker_t *) thread_param;
 
-	do
+	if (worker->mapping)
 	{
-		u64 block_start = read_os_timer();
+		// Touch one byte per page, that is all a read() would have guaranteed to fault in
+		size_t page_size = get_page_size();
+		u64 checksum     = 0;
+
+		for (u64 offset = worker->range_start; offset < worker->range_end; offset += page_size)
+		{
+			checksum += worker->mapping[offset];
+		}
+
+		worker->checksum = checksum;
+		worker->bytes    = worker->range_end - worker->range_start;
+
+		return 0;
+	}
 
-		DWORD bytes_read = 0;
-		BOOL read_status = ReadFile(file_handle, buffer, FILE_BUFFER_SIZE, &bytes_read, NULL);
+	for (u64 offset = worker->range_start; offset < worker->range_end;)
+	{
+		size_t bytes_read = 0;
+		bool read_status  = read_file_at(worker->file, worker->buffer, worker->block_size, offset, &bytes_read);
 
-		u64 read_end_time = read_os_timer();
+		worker->syscalls += 1;
 
 		if (!read_status)
 		{
-			DWORD last_error = GetLastError();
-			// https://learn.microsoft.com/en-us/windows/win32/debug/system-error-codes
-			fprintf(stderr, "(fatal: could not read from file, system code %u)\n", last_error);
+			worker->failed = true;
+			break;
+		}
 
+		if (bytes_read == 0)
+		{
 			break;
 		}
 
-		// line_count += handle_block(buffer, bytes_read);
+		worker->bytes += MIN(bytes_read, worker->range_end - offset);
+		offset        += bytes_read;
+	}
+
+	return 0;
+}
+
+static bool
+bench_noop_handler(u8 *block, size_t block_size, u64 block_offset, void *user_data)
+{
+	(void) block;
+	(void) block_size;
+	(void) block_offset;
+	(void) user_data;
+
+	return true;
+}
+
+//
+// pread, mmap and direct split the file into contiguous block-aligned ranges, one per thread
+//
+static bool
+run_partitioned_cell(const char *file_path, u64 file_size, bench_result_t *result)
+{
+	u32 open_flags = FILE_OPEN_SEQUENTIAL;
+
+	if (result->method == BENCH_METHOD_DIRECT)
+	{
+		open_flags |= FILE_OPEN_UNBUFFERED;
+	}
+
+	file_handle_t file = open_file_for_read(file_path, open_flags);
+
+	if (!is_file_handle_valid(file))
+	{
+		return false;
+	}
+
+	mapped_file_t mapped = {0};
+
+	if (result->method == BENCH_METHOD_MMAP)
+	{
+		if (!map_file(file, file_size, false, &mapped))
+		{
+			close_file(file);
+			return false;
+		}
+
+		// mmap + madvise x2 + munmap
+		result->syscalls += 4;
+	}
+
+	bench_worker_t workers[MAX_THREADS] = {0};
+	thread_t threads[MAX_THREADS];
+
+	u32 thread_count = result->thread_count;
+	u64 block_count  = (file_size + result->block_size - 1) / result->block_size;
+
+	bool ok = true;
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		bench_worker_t *worker = &workers[i];
+
+		worker->file        = file;
+		worker->mapping     = mapped.data;
+		worker->block_size  = result->block_size;
+		worker->range_start = MIN(file_size, ((block_count * i) / thread_count) * result->block_size);
+		worker->range_end   = MIN(file_size, ((block_count * (i + 1)) / thread_count) * result->block_size);
+
+		if (!worker->mapping)
+		{
+			worker->buffer = (u8 *) alloc_aligned_pages(result->block_size, get_file_io_alignment(file));
+
+			if (worker->buffer == NULL)
+			{
+				ok = false;
+			}
+		}
+	}
+
+	if (ok)
+	{
+		u32 started = start_threads(threads, thread_count, bench_worker_thread, workers, sizeof(workers[0]));
+
+		// A range without a thread goes unread, skip the cell rather than report it short
+		ok = (started == thread_count);
+
+		join_threads(threads, started);
+
+		for (u32 i = 0; i < started; ++i)
+		{
+			result->bytes    += workers[i].bytes;
+			result->syscalls += workers[i].syscalls;
+
+			ok = ok && !workers[i].failed;
+		}
+	}
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		free_pages(workers[i].buffer, result->block_size);
+	}
+
+	if (mapped.data)
+	{
+		unmap_file(&mapped);
+	}
+
+	close_file(file);
+
+	return ok;
+}
+
+static bool
+run_bench_cell(const char *file_path, u64 file_size, bench_result_t *result)
+{
+	process_usage_t usage_start, usage_end;
+	read_process_usage(&usage_start);
+
+	u64 timer_freq = get_os_timer_freq();
+	u64 start_time = read_os_timer();
+
+	bool ok = false;
+
+	switch (result->method)
+	{
+		case BENCH_METHOD_READ:
+		{
+			file_handle_t file = open_file_for_read(file_path, FILE_OPEN_SEQUENTIAL);
+			u8 *buffer         = (u8 *) alloc_pages(result->block_size);
+
+			if (is_file_handle_valid(file) && buffer)
+			{
+				ok = true;
+
+				for (;;)
+				{
+					size_t bytes_read = 0;
+					bool read_status  = read_file(file, buffer, result->block_size, &bytes_read);
+
+					result->syscalls += 1;
+
+					if (!read_status)
+					{
+						ok = false;
+						break;
+					}
+
+					if (bytes_read == 0)
+					{
+						break;
+					}
+
+					result->bytes += bytes_read;
+				}
+			}
+
+			free_pages(buffer, result->block_size);
+
+			if (is_file_handle_valid(file))
+			{
+				close_file(file);
+			}
+		} break;
+
+		case BENCH_METHOD_PREAD:
+		case BENCH_METHOD_MMAP:
+		case BENCH_METHOD_DIRECT:
+		{
+			ok = run_partitioned_cell(file_path, file_size, result);
+		} break;
+
+		case BENCH_METHOD_URING:
+		case BENCH_METHOD_URING_DIRECT:
+		{
+#if defined(PLATFORM_LINUX)
+			block_reader_config_t config = default_block_reader_config(result->block_size, NULL);
+			config.queue_depth           = result->queue_depth;
+			config.unbuffered            = (result->method == BENCH_METHOD_URING_DIRECT);
+
+			file_handle_t file = open_file_for_block_reader(file_path, &config);
+
+			if (is_file_handle_valid(file))
+			{
+				block_reader_stats_t stats;
+				ok = run_block_reader(file, file_size, config, bench_noop_handler, NULL, &stats);
+
+				// Only count the cell when it really went through the ring, unbuffered
+				ok = ok && stats.used_io_uring && (config.unbuffered == (result->method == BENCH_METHOD_URING_DIRECT));
+
+				result->bytes    = stats.bytes_parsed;
+				result->syscalls = stats.syscall_count;
+
+				close_file(file);
+			}
+#endif
+		} break;
+
+		default: break;
+	}
+
+	u64 end_time = read_os_timer();
+	read_process_usage(&usage_end);
+
+	result->wall_seconds = (f64) (end_time - start_time) / (f64) timer_freq;
+	result->cpu_seconds  = usage_end.cpu_seconds - usage_start.cpu_seconds;
+	result->page_faults  = usage_end.page_faults - usage_start.page_faults;
+	result->skipped      = !ok;
+
+	return ok;
+}
+
+//
+// Evicts path first when cold, then returns the percentage of it in the page cache, -1 when the platform cannot
+// tell. resident_bytes accumulates for file sets
+//
+static f64
+prepare_file_cache(const char *path, bool cold, u64 *resident_bytes, u64 *file_bytes)
+{
+	if (cold && !evict_file_from_cache(path))
+	{
+		fprintf(stderr, "(could not evict %s from the page cache, system code %u)\n", path, get_last_os_error());
+	}
+
+	file_handle_t file = open_file_for_read(path, 0);
+
+	if (!is_file_handle_valid(file))
+	{
+		return -1;
+	}
+
+	u64 size     = get_file_size(file);
+	u64 resident = 0;
+
+	bool known = get_file_resident_bytes(file, size, &resident);
+
+	close_file(file);
+
+	*resident_bytes += resident;
+	*file_bytes     += size;
+
+	if (!known)
+	{
+		return -1;
+	}
+
+	return size ? ((f64) resident / (f64) size) * 100 : 100;
+}
+
+static void
+print_result(output_format_t format, bench_result_t *result, bool is_first)
+{
+	f64 gb         = (f64) result->bytes / (f64) GIGABYTES(1);
+	f64 mb_per_sec = result->wall_seconds > 0 ? ((f64) result->bytes / (f64) MEGABYTES(1)) / result->wall_seconds : 0;
+
+	f64 syscalls_per_gb    = gb > 0 ? (f64) result->syscalls    / gb : 0;
+	f64 cpu_seconds_per_gb = gb > 0 ? result->cpu_seconds        / gb : 0;
+	f64 faults_per_gb      = gb > 0 ? (f64) result->page_faults / gb : 0;
+
+	const char *method = bench_method_names[result->method];
+
+	if (format == OUTPUT_FORMAT_CSV)
+	{
+		if (is_first)
+		{
+			printf("method,block_size,queue_depth,threads,cache,resident_pct,status,bytes,seconds,mb_per_sec,syscalls_per_gb,cpu_sec_per_gb,faults_per_gb\n");
+		}
+
+		printf("%s,%zu,%u,%u,%s,%.1f,%s,%llu,%.6f,%.2f,%.1f,%.6f,%.1f\n",
+		       method, result->block_size, result->queue_depth, result->thread_count,
+		       result->cold ? "cold" : "warm", result->resident_percent,
+		       result->skipped ? "skipped" : "ok", (unsigned long long) result->bytes, result->wall_seconds,
+		       mb_per_sec, syscalls_per_gb, cpu_seconds_per_gb, faults_per_gb);
+	}
+	else
+	{
+		printf("%s\n  {\"method\": \"%s\", \"block_size\": %zu, \"queue_depth\": %u, \"threads\": %u, "
+		       "\"cache\": \"%s\", \"resident_pct\": %.1f, \"status\": \"%s\", "
+		       "\"bytes\": %llu, \"seconds\": %.6f, \"mb_per_sec\": %.2f, \"syscalls_per_gb\": %.1f, "
+		       "\"cpu_sec_per_gb\": %.6f, \"faults_per_gb\": %.1f}",
+		       is_first ? "[" : ",",
+		       method, result->block_size, result->queue_depth, result->thread_count,
+		       result->cold ? "cold" : "warm", result->resident_percent,
+		       result->skipped ? "skipped" : "ok", (unsigned long long) result->bytes, result->wall_seconds,
+		       mb_per_sec, syscalls_per_gb, cpu_seconds_per_gb, faults_per_gb);
+	}
+
+	fflush(stdout);
+}
+
+static void
+run_sequential_matrix(const char *file_path, u64 file_size, bench_options_t *options)
+{
+	bool is_first = true;
 
-		bytes_parsed       += bytes_read;
-		print_bytes_parsed += bytes_read;
+	// Pass 0 is cold, pass 1 warm
+	u32 first_cache_pass = (options->cache_mode == CACHE_MODE_WARM) ? 1 : 0;
+	u32 last_cache_pass  = (options->cache_mode == CACHE_MODE_COLD) ? 0 : 1;
+
+	for (u32 method = 0; method < BENCH_METHOD_COUNT; ++method)
+	{
+		if (!options->methods[method])
+		{
+			continue;
+		}
 
-		u64 block_end     = read_os_timer();
-		u64 block_elapsed = block_end - block_start;
+		bool is_uring     = (method == BENCH_METHOD_URING) || (method == BENCH_METHOD_URING_DIRECT);
+		bool is_threaded  = (method == BENCH_METHOD_PREAD) || (method == BENCH_METHOD_MMAP) || (method == BENCH_METHOD_DIRECT);
 
-		print_time_elapsed += block_elapsed;
+		// A mapping has no block size, run it once per thread count
+		u32 block_size_count  = (method == BENCH_METHOD_MMAP) ? 1 : options->block_sizes.count;
+		u32 queue_depth_count = is_uring    ? options->queue_depths.count  : 1;
+		u32 thread_count      = is_threaded ? options->thread_counts.count : 1;
 
-		if (print_time_elapsed >= (timer_freq / 5))
+		for (u32 b = 0; b < block_size_count; ++b)
 		{
-			double mb_per_sec  = ((double) print_bytes_parsed / (double) MEGABYTES(1)) / (print_time_elapsed               / (double) timer_freq);
-			double total_speed = ((double) bytes_parsed       / (double) MEGABYTES(1)) / ((block_end - program_start_time) / (double) timer_freq);
+			for (u32 q = 0; q < queue_depth_count; ++q)
+			{
+				for (u32 t = 0; t < thread_count; ++t)
+				{
+					for (u32 cache = first_cache_pass; cache <= last_cache_pass; ++cache)
+					{
+						bench_result_t result = {0};
+						result.method       = (bench_method_t) method;
+						result.block_size   = (method == BENCH_METHOD_MMAP) ? get_page_size() : (size_t) options->block_sizes.values[b];
+						result.queue_depth  = is_uring    ? (u32) options->queue_depths.values[q]  : 1;
+						result.thread_count = is_threaded ? (u32) options->thread_counts.values[t] : 1;
+						result.cold         = (cache == 0);
+
+						u64 resident_bytes = 0;
+						u64 file_bytes     = 0;
+
+						result.resident_percent = prepare_file_cache(file_path, result.cold, &resident_bytes, &file_bytes);
+
+						fprintf(stderr, "\033[2K\r(running %s, block %zu, depth %u, threads %u, %s)",
+						        bench_method_names[method], result.block_size, result.queue_depth, result.thread_count,
+						        result.cold ? "cold" : "warm");
+
+						run_bench_cell(file_path, file_size, &result);
+
+						fprintf(stderr, "\033[2K\r");
+
+						print_result(options->format, &result, is_first);
+						is_first = false;
+					}
+				}
+			}
+		}
+	}
+
+	if (options->format == OUTPUT_FORMAT_JSON)
+	{
+		printf(is_first ? "[]\n" : "\n]\n");
+	}
+}
+
+//
+// Random read mode. Every thread issues synchronous preads of io_size at uniform or Zipf distributed
+// io_size-aligned offsets, each one timed with read_os_timer into a log-linear latency histogram.
+//
+
+// 16 linear sub-buckets per power of two, ~6% resolution from 16ns up to ~1000s
+#define LATENCY_SUB_BUCKET_BITS  (4)
+#define LATENCY_SUB_BUCKET_COUNT (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKET_COUNT     ((40 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKET_COUNT)
+
+typedef struct
+{
+	u64 counts[LATENCY_BUCKET_COUNT];
+	u64 total;
+	u64 max;
+} latency_histogram_t;
+
+inline static u32
+get_latency_bucket(u64 nanoseconds)
+{
+	if (nanoseconds < LATENCY_SUB_BUCKET_COUNT)
+	{
+		return (u32) nanoseconds;
+	}
+
+	u32 power = 63 - (u32) sz_u64_clz(nanoseconds);
+	u32 sub   = (u32) (nanoseconds >> (power - LATENCY_SUB_BUCKET_BITS)) & (LATENCY_SUB_BUCKET_COUNT - 1);
+	u32 index = ((power - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKET_COUNT) + sub;
+
+	return MIN(index, LATENCY_BUCKET_COUNT - 1);
+}
+
+// Lower bound of the bucket in nanoseconds
+inline static u64
+get_latency_bucket_value(u32 index)
+{
+	if (index < LATENCY_SUB_BUCKET_COUNT)
+	{
+		return index;
+	}
+
+	u32 power = (index / LATENCY_SUB_BUCKET_COUNT) + LATENCY_SUB_BUCKET_BITS - 1;
+	u64 sub   = index % LATENCY_SUB_BUCKET_COUNT;
+
+	return (1ull << power) | (sub << (power - LATENCY_SUB_BUCKET_BITS));
+}
 
-			double eta_in_sec  = ((double) (file_size - bytes_parsed) / (double) MEGABYTES(1)) / mb_per_sec;
+inline static void
+record_latency(latency_histogram_t *histogram, u64 nanoseconds)
+{
+	histogram->counts[get_latency_bucket(nanoseconds)] += 1;
+	histogram->total += 1;
+	histogram->max    = MAX(histogram->max, nanoseconds);
+}
+
+inline static void
+merge_latency_histogram(latency_histogram_t *target, latency_histogram_t const *source)
+{
+	for (u32 i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+	{
+		target->counts[i] += source->counts[i];
+	}
 
-			double gb_parsed = ((double) bytes_parsed / (double) GIGABYTES(1));
-			double read_precent = ((double) bytes_parsed / (double) file_size) * 100;
+	target->total += source->total;
+	target->max    = MAX(target->max, source->max);
+}
 
-			u64 read_elpased    = read_end_time - block_start;
-			u64 process_elapsed = block_elapsed - read_elpased;
+inline static f64
+get_latency_percentile_us(latency_histogram_t const *histogram, f64 percentile)
+{
+	if (histogram->total == 0)
+	{
+		return 0;
+	}
 
-			double read_process_ratio = ((double) read_elpased / (double) process_elapsed);
+	u64 rank = (u64) ((percentile / 100.0) * (f64) histogram->total);
+	u64 seen = 0;
 
-			// printf("\033[2K\r(searched %lf GB, current speed %lf MB/s, overall average %lf MB/s, eta in %.02lfs)", ((double) bytes_parsed / (double) GIGABYTES(1)), mb_per_sec, total_speed, eta_in_sec);
-			printf("\033[2K\r(searched %lf GB (%.02lf%%), current %lf MB/s, average %lf MB/s, eta in %.00lfs, read/process ratio %.02lf)", gb_parsed, read_precent, mb_per_sec, total_speed, eta_in_sec, read_process_ratio);
+	for (u32 i = 0; i < LATENCY_BUCKET_COUNT; ++i)
+	{
+		seen += histogram->counts[i];
 
-			print_time_elapsed = 0;
-			print_bytes_parsed = 0;
+		if (seen > rank)
+		{
+			return (f64) MIN(get_latency_bucket_value(i), histogram->max) / 1000.0;
 		}
+	}
+
+	return (f64) histogram->max / 1000.0;
+}
+
+//
+// Zipf over [0, n) following Gray et al, "Quickly Generating Billion-Record Synthetic Databases". Ranks are
+// hashed so the hot blocks are scattered over the file instead of all sitting at the front.
+//
+typedef struct
+{
+	u64 n;
+	f64 theta;
+	f64 alpha;
+	f64 zetan;
+	f64 eta;
+	f64 half_pow_theta;
+} zipf_t;
+
+// Exact for the first million terms, Euler-Maclaurin tail after that so huge files do not stall startup
+inline static f64
+get_zeta(u64 n, f64 theta)
+{
+	u64 exact_terms = MIN(n, 1000000);
+	f64 sum         = 0;
+
+	for (u64 i = 1; i <= exact_terms; ++i)
+	{
+		sum += 1.0 / pow((f64) i, theta);
+	}
+
+	if (n > exact_terms)
+	{
+		f64 a = (f64) exact_terms + 0.5;
+		f64 b = (f64) n + 0.5;
 
-	} while (bytes_parsed < file_size);
+		sum += (pow(b, 1.0 - theta) - pow(a, 1.0 - theta)) / (1.0 - theta);
+	}
+
+	return sum;
+}
 
-	printf("\ncounted %zu lines\n", line_count);
+inline static void
+init_zipf(zipf_t *zipf, u64 n, f64 theta)
+{
+	f64 zeta2 = get_zeta(2, theta);
 
-	u64 total_time               = read_os_timer() - program_start_time;
-	double total_sec             = (double) total_time / (double) timer_freq;
-	double total_file_size_in_mb = (double) file_size / MEGABYTES(1);
-	double mb_per_sec            = total_file_size_in_mb / (total_time / (double) timer_freq);
+	zipf->n              = n;
+	zipf->theta          = theta;
+	zipf->alpha          = 1.0 / (1.0 - theta);
+	zipf->zetan          = get_zeta(n, theta);
+	zipf->eta            = (1.0 - pow(2.0 / (f64) n, 1.0 - theta)) / (1.0 - zeta2 / zipf->zetan);
+	zipf->half_pow_theta = 1.0 + pow(0.5, theta);
+}
 
-	printf("(took %lf sec @ average of %lf MB/s)\n", total_sec, mb_per_sec);
+inline static u64
+next_random(u64 *state)
+{
+	// xorshift64*
+	u64 x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
 
-	VirtualFree(buffer, 0, MEM_RELEASE);
+	return x * 0x2545F4914F6CDD1Dull;
+}
 
-	CloseHandle(file_handle);
+inline static f64
+next_random_unit(u64 *state)
+{
+	return (f64) (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+inline static u64
+next_zipf(zipf_t const *zipf, u64 *state)
+{
+	f64 u  = next_random_unit(state);
+	f64 uz = u * zipf->zetan;
+
+	u64 rank;
+
+	if (uz < 1.0)
+	{
+		rank = 0;
+	}
+	else if (uz < zipf->half_pow_theta)
+	{
+		rank = 1;
+	}
+	else
+	{
+		rank = (u64) ((f64) zipf->n * pow(zipf->eta * u - zipf->eta + 1.0, zipf->alpha));
+	}
+
+	rank = MIN(rank, zipf->n - 1);
+
+	// Scatter, FNV-1a style mix of the rank
+	u64 hash = 0xcbf29ce484222325ull;
+	for (u32 i = 0; i < 8; ++i)
+	{
+		hash ^= (rank >> (i * 8)) & 0xFF;
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash % zipf->n;
+}
+
+typedef struct
+{
+	file_handle_t file;
+	u8 *buffer;
+
+	size_t io_size;
+	u64 block_count;
+
+	offset_distribution_t distribution;
+	zipf_t const *zipf;
+	u64 random_state;
+
+	u64 deadline;
+	u64 max_ops;
+
+	u64 ops;
+	u64 bytes;
+	bool failed;
+
+	latency_histogram_t histogram;
+} random_worker_t;
+
+static THREAD_PROC(random_worker_thread)
+{
+	random_worker_t *worker = (random_worker_t *) thread_param;
+
+	u64 ns_per_tick_num = 1000000000ull;
+	u64 timer_freq      = get_os_timer_freq();
+
+	while (worker->ops < worker->max_ops)
+	{
+		u64 block = (worker->distribution == OFFSET_DISTRIBUTION_ZIPF) ?
+		            next_zipf(worker->zipf, &worker->random_state) :
+		            next_random(&worker->random_state) % worker->block_count;
+
+		u64 start = read_os_timer();
+
+		size_t bytes_read = 0;
+		bool read_status  = read_file_at(worker->file, worker->buffer, worker->io_size, block * worker->io_size, &bytes_read);
+
+		u64 end = read_os_timer();
+
+		if (!read_status)
+		{
+			worker->failed = true;
+			break;
+		}
+
+		record_latency(&worker->histogram, ((end - start) * ns_per_tick_num) / timer_freq);
+
+		worker->ops   += 1;
+		worker->bytes += bytes_read;
+
+		if (end >= worker->deadline)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+typedef struct
+{
+	bench_method_t method;
+	size_t io_size;
+	u32 thread_count;
+	offset_distribution_t distribution;
+
+	bool skipped;
+
+	u64 ops;
+	u64 bytes;
+	f64 wall_seconds;
+
+	latency_histogram_t histogram;
+} random_result_t;
+
+static bool
+run_random_cell(const char *file_path, u64 file_size, bench_options_t *options, random_result_t *result)
+{
+	u32 open_flags = (result->method == BENCH_METHOD_DIRECT) ? FILE_OPEN_UNBUFFERED : 0;
+
+	file_handle_t file = open_file_for_read(file_path, open_flags);
+
+	if (!is_file_handle_valid(file))
+	{
+		return false;
+	}
+
+	u64 block_count = file_size / result->io_size;
+
+	if (block_count == 0)
+	{
+		close_file(file);
+		return false;
+	}
+
+	zipf_t zipf;
+
+	if (result->distribution == OFFSET_DISTRIBUTION_ZIPF)
+	{
+		init_zipf(&zipf, block_count, options->zipf_theta);
+	}
+
+	u32 thread_count = result->thread_count;
+
+	random_worker_t *workers = (random_worker_t *) alloc_pages(sizeof(random_worker_t) * thread_count);
+	thread_t threads[MAX_THREADS];
+
+	u64 timer_freq = get_os_timer_freq();
+	u64 start_time = read_os_timer();
+	u64 deadline   = start_time + (u64) (options->duration_seconds * (f64) timer_freq);
+
+	bool ok = (workers != NULL);
+
+	for (u32 i = 0; ok && i < thread_count; ++i)
+	{
+		random_worker_t *worker = &workers[i];
+
+		worker->file         = file;
+		worker->io_size      = result->io_size;
+		worker->block_count  = block_count;
+		worker->distribution = result->distribution;
+		worker->zipf         = &zipf;
+		worker->random_state = 0x9E3779B97F4A7C15ull * (i + 1);
+		worker->deadline     = deadline;
+		worker->max_ops      = options->max_ops ? (options->max_ops + thread_count - 1) / thread_count : UINT64_MAX;
+		worker->buffer       = (u8 *) alloc_aligned_pages(result->io_size, get_file_io_alignment(file));
+
+		ok = (worker->buffer != NULL);
+	}
+
+	if (ok)
+	{
+		u32 started = start_threads(threads, thread_count, random_worker_thread, workers, sizeof(workers[0]));
+
+		ok = (started == thread_count);
+
+		join_threads(threads, started);
+
+		for (u32 i = 0; i < started; ++i)
+		{
+			result->ops   += workers[i].ops;
+			result->bytes += workers[i].bytes;
+
+			merge_latency_histogram(&result->histogram, &workers[i].histogram);
+
+			ok = ok && !workers[i].failed;
+		}
+	}
+
+	result->wall_seconds = (f64) (read_os_timer() - start_time) / (f64) timer_freq;
+
+	if (workers)
+	{
+		for (u32 i = 0; i < thread_count; ++i)
+		{
+			free_pages(workers[i].buffer, result->io_size);
+		}
+
+		free_pages(workers, sizeof(random_worker_t) * thread_count);
+	}
+
+	close_file(file);
+
+	return ok;
+}
+
+static void
+print_random_result(output_format_t format, random_result_t *result, bool is_first)
+{
+	f64 iops       = result->wall_seconds > 0 ? (f64) result->ops / result->wall_seconds : 0;
+	f64 mb_per_sec = result->wall_seconds > 0 ? ((f64) result->bytes / (f64) MEGABYTES(1)) / result->wall_seconds : 0;
+
+	f64 p50  = get_latency_percentile_us(&result->histogram, 50.0);
+	f64 p99  = get_latency_percentile_us(&result->histogram, 99.0);
+	f64 p999 = get_latency_percentile_us(&result->histogram, 99.9);
+	f64 max  = (f64) result->histogram.max / 1000.0;
+
+	const char *method       = bench_method_names[result->method];
+	const char *distribution = (result->distribution == OFFSET_DISTRIBUTION_ZIPF) ? "zipf" : "uniform";
+	const char *status       = result->skipped ? "skipped" : "ok";
+
+	if (format == OUTPUT_FORMAT_CSV)
+	{
+		if (is_first)
+		{
+			printf("method,io_size,distribution,threads,status,ops,seconds,iops,mb_per_sec,p50_us,p99_us,p999_us,max_us\n");
+		}
+
+		printf("%s,%zu,%s,%u,%s,%llu,%.6f,%.1f,%.2f,%.2f,%.2f,%.2f,%.2f\n",
+		       method, result->io_size, distribution, result->thread_count, status,
+		       (unsigned long long) result->ops, result->wall_seconds, iops, mb_per_sec, p50, p99, p999, max);
+	}
+	else
+	{
+		printf("%s\n  {\"method\": \"%s\", \"io_size\": %zu, \"distribution\": \"%s\", \"threads\": %u, \"status\": \"%s\", "
+		       "\"ops\": %llu, \"seconds\": %.6f, \"iops\": %.1f, \"mb_per_sec\": %.2f, "
+		       "\"p50_us\": %.2f, \"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f}",
+		       is_first ? "[" : ",",
+		       method, result->io_size, distribution, result->thread_count, status,
+		       (unsigned long long) result->ops, result->wall_seconds, iops, mb_per_sec, p50, p99, p999, max);
+	}
+
+	fflush(stdout);
+}
+
+static void
+run_random_matrix(const char *file_path, u64 file_size, bench_options_t *options)
+{
+	bool is_first = true;
+
+	for (u32 method = 0; method < BENCH_METHOD_COUNT; ++method)
+	{
+		if (!options->methods[method])
+		{
+			continue;
+		}
+
+		if (method != BENCH_METHOD_PREAD && method != BENCH_METHOD_DIRECT)
+		{
+			fprintf(stderr, "(random mode only supports pread and direct, skipping %s)\n", bench_method_names[method]);
+			continue;
+		}
+
+		for (u32 b = 0; b < options->block_sizes.count; ++b)
+		{
+			for (u32 t = 0; t < options->thread_counts.count; ++t)
+			{
+				random_result_t *result = (random_result_t *) alloc_pages(sizeof(random_result_t));
+				result->method          = (bench_method_t) method;
+				result->io_size         = (size_t) options->block_sizes.values[b];
+				result->thread_count    = (u32) options->thread_counts.values[t];
+				result->distribution    = options->distribution;
+
+				fprintf(stderr, "\033[2K\r(running random %s, io size %zu, threads %u)",
+				        bench_method_names[method], result->io_size, result->thread_count);
+
+				result->skipped = !run_random_cell(file_path, file_size, options, result);
+
+				fprintf(stderr, "\033[2K\r");
+
+				print_random_result(options->format, result, is_first);
+				is_first = false;
+
+				free_pages(result, sizeof(random_result_t));
+			}
+		}
+	}
+
+	if (options->format == OUTPUT_FORMAT_JSON)
+	{
+		printf(is_first ? "[]\n" : "\n]\n");
+	}
+}
+
+//
+// Scaling mode. The file set is cut into work units, a whole file for small files and chunks of large ones, and threads pull units off a shared counter. Each unit opens, reads and closes its
+// file, which is the same per-file cost find_dup_files pays, so one big file and a folder of small files are
+// measured the same way.
+//
+
+#define SCALING_MAX_CHUNK_SIZE (MEGABYTES(64))
+#define SCALING_MIN_CHUNK_SIZE (MEGABYTES(1))
+
+typedef struct
+{
+	const char *path;
+	u64 size;
+} scaling_file_t;
+
+typedef struct
+{
+	u32 file_index;
+	u64 offset;
+	u64 length;
+} scaling_unit_t;
+
+typedef struct
+{
+	scaling_file_t *files;
+	u32 file_count;
+
+	scaling_unit_t *units;
+	u64 unit_count;
+
+	u64 total_bytes;
+	u64 chunk_size;
+
+	// Backing memory for the paths of files found in folders
+	char *path_arena;
+	size_t path_arena_size;
+} scaling_set_t;
+
+typedef struct
+{
+	scaling_set_t *set;
+	volatile u64 *next_unit;
+
+	u32 open_flags;
+	size_t block_size;
+	u8 *buffer;
+
+	u64 bytes;
+	u64 files_opened;
+	bool failed;
+} scaling_worker_t;
+
+typedef struct
+{
+	bench_method_t method;
+	size_t block_size;
+	u32 thread_count;
+
+	bool cold;
+	f64 resident_percent;
+
+	bool skipped;
+
+	u64 bytes;
+	u64 files_opened;
+	f64 wall_seconds;
+
+	f64 mb_per_sec;
+	f64 speedup;
+	f64 efficiency;
+} scaling_result_t;
+
+inline static bool
+add_scaling_file(scaling_set_t *set, const char *path)
+{
+	file_handle_t file = open_file_for_read(path, 0);
+
+	if (!is_file_handle_valid(file))
+	{
+		fprintf(stderr, "(fatal: could not open file %s)\n", path);
+		return false;
+	}
+
+	scaling_file_t *entry = &set->files[set->file_count++];
+	entry->path           = path;
+	entry->size           = get_file_size(file);
+
+	close_file(file);
+
+	set->total_bytes += entry->size;
+
+	return true;
+}
+
+//
+// Two passes, the first sizes the file table and path arena, the second fills them in
+//
+static bool
+build_scaling_set(const char **paths, u32 path_count, u32 max_threads, scaling_set_t *set)
+{
+	dir_iter_t *dir_iter = (dir_iter_t *) alloc_pages(sizeof(dir_iter_t));
+	char full_path[MAX_PATH_LENGTH + 1];
+
+	u32 file_capacity = 0;
+	size_t arena_size = 0;
+
+	for (u32 i = 0; i < path_count; ++i)
+	{
+		if (!open_dir(paths[i], dir_iter))
+		{
+			file_capacity += 1;
+			continue;
+		}
+
+		dir_entry_t entry;
+
+		while (next_dir_entry(dir_iter, &entry))
+		{
+			if (!entry.is_directory)
+			{
+				file_capacity += 1;
+				arena_size    += strlen(paths[i]) + strlen(entry.name) + 2;
+			}
+		}
+
+		close_dir(dir_iter);
+	}
+
+	set->files           = (scaling_file_t *) alloc_pages(sizeof(scaling_file_t) * MAX(file_capacity, 1));
+	set->path_arena_size = MAX(arena_size, 1);
+	set->path_arena      = (char *) alloc_pages(set->path_arena_size);
+
+	size_t arena_used = 0;
+	bool ok           = true;
+
+	for (u32 i = 0; ok && i < path_count; ++i)
+	{
+		if (!open_dir(paths[i], dir_iter))
+		{
+			ok = add_scaling_file(set, paths[i]);
+			continue;
+		}
+
+		dir_entry_t entry;
+
+		// The folder can change between the passes, never go past what the first pass sized
+		while (ok && set->file_count < file_capacity && next_dir_entry(dir_iter, &entry))
+		{
+			if (entry.is_directory)
+			{
+				continue;
+			}
+
+			if (!join_path(full_path, sizeof(full_path), paths[i], entry.name))
+			{
+				fprintf(stderr, "(fatal: path is too long, max supported length is %d)\n", MAX_PATH_LENGTH);
+				ok = false;
+				break;
+			}
+
+			size_t length = strlen(full_path) + 1;
+
+			if (arena_used + length > set->path_arena_size)
+			{
+				break;
+			}
+
+			char *stored = set->path_arena + arena_used;
+			memcpy(stored, full_path, length);
+			arena_used += length;
+
+			ok = add_scaling_file(set, stored);
+		}
+
+		close_dir(dir_iter);
+	}
+
+	free_pages(dir_iter, sizeof(dir_iter_t));
+
+	if (!ok)
+	{
+		return false;
+	}
+
+	// Smaller chunks until every thread gets a few units, so a single large file still spreads over the sweep
+	set->chunk_size = SCALING_MAX_CHUNK_SIZE;
+
+	while (set->chunk_size > SCALING_MIN_CHUNK_SIZE && (set->total_bytes / set->chunk_size) < (u64) max_threads * 4)
+	{
+		set->chunk_size /= 2;
+	}
+
+	u64 unit_count = 0;
+
+	for (u32 i = 0; i < set->file_count; ++i)
+	{
+		unit_count += MAX(1, (set->files[i].size + set->chunk_size - 1) / set->chunk_size);
+	}
+
+	set->units = (scaling_unit_t *) alloc_pages(sizeof(scaling_unit_t) * MAX(unit_count, 1));
+
+	for (u32 i = 0; i < set->file_count; ++i)
+	{
+		u64 offset = 0;
+
+		do
+		{
+			scaling_unit_t *unit = &set->units[set->unit_count++];
+			unit->file_index     = i;
+			unit->offset         = offset;
+			unit->length         = MIN(set->chunk_size, set->files[i].size - offset);
+
+			offset += unit->length;
+		} while (offset < set->files[i].size);
+	}
+
+	return set->file_count > 0;
+}
+
+static THREAD_PROC(scaling_worker_thread)
+{
+	scaling_worker_t *worker = (scaling_worker_t *) thread_param;
+	scaling_set_t *set       = worker->set;
+
+	for (;;)
+	{
+		u64 unit_index = atomic_add_u64(worker->next_unit, 1);
+
+		if (unit_index >= set->unit_count)
+		{
+			break;
+		}
+
+		scaling_unit_t *unit = &set->units[unit_index];
+		file_handle_t file   = open_file_for_read(set->files[unit->file_index].path, worker->open_flags);
+
+		if (!is_file_handle_valid(file))
+		{
+			worker->failed = true;
+			break;
+		}
+
+		worker->files_opened += 1;
+
+		u64 end = unit->offset + unit->length;
+
+		for (u64 offset = unit->offset; offset < end;)
+		{
+			// Stop at the end of the unit, rounded up so unbuffered reads stay aligned
+			size_t read_size  = (size_t) MIN(worker->block_size, align_up(end - offset, DEFAULT_IO_ALIGNMENT));
+			size_t bytes_read = 0;
+			bool read_status  = read_file_at(file, worker->buffer, read_size, offset, &bytes_read);
+
+			if (!read_status)
+			{
+				worker->failed = true;
+				break;
+			}
+
+			if (bytes_read == 0)
+			{
+				break;
+			}
+
+			worker->bytes += MIN(bytes_read, end - offset);
+			offset        += bytes_read;
+		}
+
+		close_file(file);
+
+		if (worker->failed)
+		{
+			break;
+		}
+	}
+
+	return 0;
+}
+
+static bool
+run_scaling_cell(scaling_set_t *set, scaling_result_t *result)
+{
+	u32 open_flags = FILE_OPEN_SEQUENTIAL;
+
+	if (result->method == BENCH_METHOD_DIRECT)
+	{
+		open_flags |= FILE_OPEN_UNBUFFERED;
+	}
+
+	scaling_worker_t workers[MAX_THREADS] = {0};
+	thread_t threads[MAX_THREADS];
+
+	volatile u64 next_unit = 0;
+
+	u32 thread_count = result->thread_count;
+	bool ok          = true;
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		scaling_worker_t *worker = &workers[i];
+
+		worker->set        = set;
+		worker->next_unit  = &next_unit;
+		worker->open_flags = open_flags;
+		worker->block_size = result->block_size;
+		worker->buffer     = (u8 *) alloc_aligned_pages(result->block_size, DEFAULT_IO_ALIGNMENT);
+
+		if (worker->buffer == NULL)
+		{
+			ok = false;
+		}
+	}
+
+	u64 timer_freq = get_os_timer_freq();
+	u64 start_time = read_os_timer();
+
+	if (ok)
+	{
+		u32 started = start_threads(threads, thread_count, scaling_worker_thread, workers, sizeof(workers[0]));
+
+		ok = (started == thread_count);
+
+		join_threads(threads, started);
+
+		for (u32 i = 0; i < started; ++i)
+		{
+			result->bytes        += workers[i].bytes;
+			result->files_opened += workers[i].files_opened;
+
+			ok = ok && !workers[i].failed;
+		}
+	}
+
+	result->wall_seconds = (f64) (read_os_timer() - start_time) / (f64) timer_freq;
+	result->mb_per_sec   = result->wall_seconds > 0 ? ((f64) result->bytes / (f64) MEGABYTES(1)) / result->wall_seconds : 0;
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		free_pages(workers[i].buffer, result->block_size);
+	}
+
+	return ok;
+}
+
+static void
+print_scaling_result(output_format_t format, scaling_set_t *set, scaling_result_t *result, bool is_first)
+{
+	const char *method = bench_method_names[result->method];
+	const char *status = result->skipped ? "skipped" : "ok";
+
+	f64 files_per_sec = result->wall_seconds > 0 ? (f64) result->files_opened / result->wall_seconds : 0;
+
+	if (format == OUTPUT_FORMAT_CSV)
+	{
+		if (is_first)
+		{
+			printf("method,files,total_bytes,block_size,threads,cache,resident_pct,status,seconds,mb_per_sec,opens_per_sec,speedup,efficiency\n");
+		}
+
+		printf("%s,%u,%llu,%zu,%u,%s,%.1f,%s,%.6f,%.2f,%.1f,%.2f,%.2f\n",
+		       method, set->file_count, (unsigned long long) set->total_bytes, result->block_size, result->thread_count,
+		       result->cold ? "cold" : "warm", result->resident_percent, status,
+		       result->wall_seconds, result->mb_per_sec, files_per_sec, result->speedup, result->efficiency);
+	}
+	else
+	{
+		printf("%s\n  {\"method\": \"%s\", \"files\": %u, \"total_bytes\": %llu, \"block_size\": %zu, \"threads\": %u, "
+		       "\"cache\": \"%s\", \"resident_pct\": %.1f, \"status\": \"%s\", \"seconds\": %.6f, \"mb_per_sec\": %.2f, "
+		       "\"opens_per_sec\": %.1f, \"speedup\": %.2f, \"efficiency\": %.2f}",
+		       is_first ? "[" : ",",
+		       method, set->file_count, (unsigned long long) set->total_bytes, result->block_size, result->thread_count,
+		       result->cold ? "cold" : "warm", result->resident_percent, status, result->wall_seconds, result->mb_per_sec, files_per_sec, result->speedup, result->efficiency);
+	}
+
+	fflush(stdout);
+}
+
+static bool
+run_scaling_matrix(const char **paths, u32 path_count, bench_options_t *options)
+{
+	u32 max_threads = 1;
+
+	for (u32 t = 0; t < options->thread_counts.count; ++t)
+	{
+		max_threads = MAX(max_threads, (u32) options->thread_counts.values[t]);
+	}
+
+	scaling_set_t set = {0};
+
+	if (!build_scaling_set(paths, path_count, max_threads, &set))
+	{
+		fprintf(stderr, "(fatal: no files to read)\n");
+		return false;
+	}
+
+	fprintf(stderr, "(%u files, %llu work units, %lf GB total)\n", set.file_count, (unsigned long long) set.unit_count,
+	        ((double) set.total_bytes / (double) GIGABYTES(1)));
+
+	bool is_first = true;
+
+	// Pass 0 is cold, pass 1 warm
+	u32 first_cache_pass = (options->cache_mode == CACHE_MODE_WARM) ? 1 : 0;
+	u32 last_cache_pass  = (options->cache_mode == CACHE_MODE_COLD) ? 0 : 1;
+
+	for (u32 method = 0; method < BENCH_METHOD_COUNT; ++method)
+	{
+		if (!options->methods[method])
+		{
+			continue;
+		}
+
+		if (method != BENCH_METHOD_PREAD && method != BENCH_METHOD_DIRECT)
+		{
+			fprintf(stderr, "(scaling mode only supports pread and direct, skipping %s)\n", bench_method_names[method]);
+			continue;
+		}
+
+		for (u32 b = 0; b < options->block_sizes.count; ++b)
+		{
+			for (u32 cache = first_cache_pass; cache <= last_cache_pass; ++cache)
+			{
+				scaling_result_t results[MAX_SWEEP_VALUES] = {0};
+
+				f64 best_mb_per_sec = 0;
+
+				for (u32 t = 0; t < options->thread_counts.count; ++t)
+				{
+					scaling_result_t *result = &results[t];
+					result->method           = (bench_method_t) method;
+					result->block_size       = (size_t) options->block_sizes.values[b];
+					result->thread_count     = (u32) options->thread_counts.values[t];
+					result->cold             = (cache == 0);
+
+					u64 resident_bytes = 0;
+					u64 file_bytes     = 0;
+					bool known         = true;
+
+					for (u32 f = 0; f < set.file_count; ++f)
+					{
+						known = (prepare_file_cache(set.files[f].path, result->cold, &resident_bytes, &file_bytes) >= 0) && known;
+					}
+
+					result->resident_percent = !known ? -1 : file_bytes ? ((f64) resident_bytes / (f64) file_bytes) * 100 : 100;
+
+					fprintf(stderr, "\033[2K\r(running scaling %s, block %zu, threads %u, %s)",
+					        bench_method_names[method], result->block_size, result->thread_count, result->cold ? "cold" : "warm");
+
+					result->skipped = !run_scaling_cell(&set, result);
+
+					fprintf(stderr, "\033[2K\r");
+
+					// Relative to the first thread count in the sweep, 1 unless --threads says otherwise
+					if (results[0].mb_per_sec > 0)
+					{
+						result->speedup    = result->mb_per_sec / results[0].mb_per_sec;
+						result->efficiency = result->speedup / ((f64) result->thread_count / (f64) results[0].thread_count);
+					}
+
+					best_mb_per_sec = MAX(best_mb_per_sec, result->mb_per_sec);
+
+					print_scaling_result(options->format, &set, result, is_first);
+					is_first = false;
+				}
+
+				// Saturated once we are within 10% of the best aggregate, more threads past that only add contention
+				for (u32 t = 0; t < options->thread_counts.count; ++t)
+				{
+					if (!results[t].skipped && results[t].mb_per_sec >= best_mb_per_sec * 0.9)
+					{
+						fprintf(stderr, "(%s, block %zu, %s: saturates at %u threads, %.2f MB/s, best %.2f MB/s)\n",
+						        bench_method_names[method], results[t].block_size, results[t].cold ? "cold" : "warm",
+						        results[t].thread_count, results[t].mb_per_sec, best_mb_per_sec);
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	if (options->format == OUTPUT_FORMAT_JSON)
+	{
+		printf(is_first ? "[]\n" : "\n]\n");
+	}
+
+	return true;
+}
+
+//
+// Roofline mode. Scans a working set sized to sit in each cache level, then one far bigger than any cache
+// for DRAM, and memcpy between two DRAM sized buffers. The DRAM tests run on one core and on every core, each
+// thread on its own slice, since a single core usually cannot saturate the memory controllers on its own.
+//
+
+#define ROOFLINE_DRAM_SIZE       (GIGABYTES(1ull))
+#define ROOFLINE_BYTES_PER_CELL  (GIGABYTES(8ull))
+
+typedef struct
+{
+	u8 *source;
+	u8 *target;
+	size_t size;
+	u64 repeats;
+
+	u64 checksum;
+} roofline_worker_t;
+
+// 4 independent accumulators so the loads are not serialised behind one add chain
+static u64
+scan_block_serial(u8 const *data, size_t size)
+{
+	u64 const *words = (u64 const *) data;
+	u64 acc0 = 0, acc1 = 0, acc2 = 0, acc3 = 0;
+
+	for (size_t i = 0; i + 4 <= size / sizeof(u64); i += 4)
+	{
+		acc0 += words[i];
+		acc1 += words[i + 1];
+		acc2 += words[i + 2];
+		acc3 += words[i + 3];
+	}
+
+	return acc0 + acc1 + acc2 + acc3;
+}
+
+#if defined(ARCH_X64)
+
+TARGET_AVX2 static u64
+scan_block_avx2(u8 const *data, size_t size)
+{
+	__m256i acc0 = _mm256_setzero_si256();
+	__m256i acc1 = _mm256_setzero_si256();
+	__m256i acc2 = _mm256_setzero_si256();
+	__m256i acc3 = _mm256_setzero_si256();
+
+	for (size_t i = 0; i + 128 <= size; i += 128)
+	{
+		acc0 = _mm256_add_epi64(acc0, _mm256_load_si256((__m256i const *) (data + i)));
+		acc1 = _mm256_add_epi64(acc1, _mm256_load_si256((__m256i const *) (data + i + 32)));
+		acc2 = _mm256_add_epi64(acc2, _mm256_load_si256((__m256i const *) (data + i + 64)));
+		acc3 = _mm256_add_epi64(acc3, _mm256_load_si256((__m256i const *) (data + i + 96)));
+	}
+
+	__m256i sum = _mm256_add_epi64(_mm256_add_epi64(acc0, acc1), _mm256_add_epi64(acc2, acc3));
+
+	return (u64) _mm256_extract_epi64(sum, 0) + (u64) _mm256_extract_epi64(sum, 1) +
+	       (u64) _mm256_extract_epi64(sum, 2) + (u64) _mm256_extract_epi64(sum, 3);
+}
+
+#endif
+
+inline static u64
+scan_block(u8 const *data, size_t size)
+{
+#if defined(ARCH_X64)
+	if (simd.level == SIMD_LEVEL_AVX2 || simd.level == SIMD_LEVEL_AVX512)
+	{
+		return scan_block_avx2(data, size);
+	}
+#endif
+
+	return scan_block_serial(data, size);
+}
+
+static THREAD_PROC(roofline_worker_thread)
+{
+	roofline_worker_t *worker = (roofline_worker_t *) thread_param;
+
+	for (u64 r = 0; r < worker->repeats; ++r)
+	{
+		if (worker->target)
+		{
+			memcpy(worker->target, worker->source, worker->size);
+		}
+		else
+		{
+			worker->checksum += scan_block(worker->source, worker->size);
+		}
+	}
+
+	return 0;
+}
+
+//
+// Each thread gets working_set bytes of buffer (twice that for memcpy). Returns MB/s, counting the bytes
+// scanned or the bytes copied, not read plus written
+//
+static f64
+measure_roofline(u8 *memory, size_t working_set, u32 thread_count, bool copy, f64 *seconds_out, u64 *bytes_out)
+{
+	roofline_worker_t workers[MAX_THREADS] = {0};
+	thread_t threads[MAX_THREADS];
+
+	u64 repeats = MAX(1, ROOFLINE_BYTES_PER_CELL / ((u64) working_set * thread_count));
+
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		u8 *slice = memory + ((size_t) i * working_set * (copy ? 2 : 1));
+
+		workers[i].source  = slice;
+		workers[i].target  = copy ? slice + working_set : NULL;
+		workers[i].size    = working_set;
+		workers[i].repeats = repeats;
+	}
+
+	// Warm the caches and TLB once before timing
+	for (u32 i = 0; i < thread_count; ++i)
+	{
+		scan_block(workers[i].source, working_set);
+	}
+
+	u64 timer_freq = get_os_timer_freq();
+	u64 start_time = read_os_timer();
+
+	u32 started = start_threads(threads, thread_count, roofline_worker_thread, workers, sizeof(workers[0]));
+
+	join_threads(threads, started);
+
+	u64 checksum = 0;
+
+	for (u32 i = 0; i < started; ++i)
+	{
+		checksum += workers[i].checksum;
+	}
+
+	f64 seconds = (f64) (read_os_timer() - start_time) / (f64) timer_freq;
+	u64 bytes   = (u64) working_set * repeats * thread_count;
+
+	// A ceiling of 0 reads as not measured, better than one timed on fewer threads than it claims
+	if (started < thread_count)
+	{
+		fprintf(stderr, "(could not start roofline thread %u of %u, ceiling left out)\n", started + 1, thread_count);
+
+		seconds = 0;
+		bytes   = 0;
+	}
+
+	// Keeps the scans from being optimised out
+	if (checksum == 1)
+	{
+		fprintf(stderr, "\n");
+	}
+
+	*seconds_out = seconds;
+	*bytes_out   = bytes;
+
+	return seconds > 0 ? ((f64) bytes / (f64) MEGABYTES(1)) / seconds : 0;
+}
+
+static void
+print_roofline_result(output_format_t format, roofline_ceiling_t ceiling, u32 thread_count, size_t working_set,
+                      u64 bytes, f64 seconds, f64 mb_per_sec, bool is_first)
+{
+	const char *name = roofline_names[ceiling];
+
+	if (format == OUTPUT_FORMAT_CSV)
+	{
+		if (is_first)
+		{
+			printf("test,threads,working_set,bytes,seconds,mb_per_sec\n");
+		}
+
+		printf("%s,%u,%zu,%llu,%.6f,%.2f\n", name, thread_count, working_set, (unsigned long long) bytes, seconds, mb_per_sec);
+	}
+	else
+	{
+		printf("%s\n  {\"test\": \"%s\", \"threads\": %u, \"working_set\": %zu, \"bytes\": %llu, \"seconds\": %.6f, \"mb_per_sec\": %.2f}",
+		       is_first ? "[" : ",", name, thread_count, working_set, (unsigned long long) bytes, seconds, mb_per_sec);
+	}
+
+	fflush(stdout);
+}
+
+static bool
+run_roofline(bench_options_t *options)
+{
+#if defined(DEBUG)
+	fprintf(stderr, "(debug build, build release for meaningful ceilings)\n");
+#endif
+
+	u32 cpu_count = MIN(get_cpu_count(), MAX_THREADS);
+
+	size_t cache_sizes[3];
+	get_cpu_cache_sizes(cache_sizes);
+
+	// Half of each level leaves room for the stack, page tables and the other hyperthread
+	static const size_t fallback_cache_sizes[3] = { KILOBYTES(32), MEGABYTES(1), MEGABYTES(8) };
+
+	size_t dram_size = ROOFLINE_DRAM_SIZE;
+	u8 *memory       = (u8 *) alloc_pages(dram_size);
+
+	if (memory == NULL)
+	{
+		dram_size = ROOFLINE_DRAM_SIZE / 4;
+		memory    = (u8 *) alloc_pages(dram_size);
+	}
+
+	if (memory == NULL)
+	{
+		fprintf(stderr, "(fatal: could not allocate %zu bytes for the DRAM tests)\n", dram_size);
+		return false;
+	}
+
+	// Fault every page in up front
+	memset(memory, 1, dram_size);
+
+	fprintf(stderr, "(L1 %zu, L2 %zu, L3 %zu bytes, %u cores, %zu MB DRAM buffer)\n",
+	        cache_sizes[0], cache_sizes[1], cache_sizes[2], cpu_count, dram_size / MEGABYTES(1));
+
+	roofline_t roofline = {0};
+	bool is_first       = true;
+
+	for (u32 ceiling = 0; ceiling < ROOFLINE_COUNT; ++ceiling)
+	{
+		size_t working_set = 0;
+		u32 thread_count   = 1;
+		bool copy          = false;
+
+		switch ((roofline_ceiling_t) ceiling)
+		{
+			case ROOFLINE_L1_SCAN:
+			case ROOFLINE_L2_SCAN:
+			case ROOFLINE_L3_SCAN:
+			{
+				size_t cache_size = cache_sizes[ceiling] ? cache_sizes[ceiling] : fallback_cache_sizes[ceiling];
+				working_set       = (size_t) align_up(cache_size / 2, 128);
+			} break;
+
+			case ROOFLINE_DRAM_READ_SINGLE:
+			{
+				working_set = dram_size;
+			} break;
+
+			case ROOFLINE_DRAM_READ_ALL:
+			{
+				thread_count = cpu_count;
+				working_set  = dram_size / thread_count;
+			} break;
+
+			case ROOFLINE_MEMCPY_SINGLE:
+			{
+				copy        = true;
+				working_set = dram_size / 2;
+			} break;
+
+			case ROOFLINE_MEMCPY_ALL:
+			{
+				copy         = true;
+				thread_count = cpu_count;
+				working_set  = dram_size / (2 * thread_count);
+			} break;
+
+			default:
+			{
+			} break;
+		}
+
+		// Keep the slices a whole number of scan iterations
+		working_set &= ~(size_t) 127;
+
+		fprintf(stderr, "\033[2K\r(running %s, threads %u, working set %zu)", roofline_names[ceiling], thread_count, working_set);
+
+		f64 seconds = 0;
+		u64 bytes   = 0;
+
+		roofline.mb_per_sec[ceiling] = measure_roofline(memory, working_set, thread_count, copy, &seconds, &bytes);
+
+		fprintf(stderr, "\033[2K\r");
+
+		print_roofline_result(options->format, (roofline_ceiling_t) ceiling, thread_count, working_set,
+		                      bytes, seconds, roofline.mb_per_sec[ceiling], is_first);
+		is_first = false;
+	}
+
+	if (options->format == OUTPUT_FORMAT_JSON)
+	{
+		printf("\n]\n");
+	}
+
+	free_pages(memory, dram_size);
+
+	if (options->roofline_save_path)
+	{
+		if (!save_roofline(options->roofline_save_path, &roofline))
+		{
+			fprintf(stderr, "(fatal: could not write %s)\n", options->roofline_save_path);
+			return false;
+		}
+
+		fprintf(stderr, "(saved ceilings to %s)\n", options->roofline_save_path);
+	}
+
+	return true;
+}
+
+int
+main(int argc, const char **argv)
+{
+	bench_options_t options = {0};
+
+	for (u32 i = 0; i < BENCH_METHOD_COUNT; ++i)
+	{
+		options.methods[i] = true;
+	}
+
+	parse_sweep("64K,256K,1M,4M,16M,64M", &options.block_sizes);
+	parse_sweep("1,4,16", &options.queue_depths);
+
+	u32 cpu_count = MIN(get_cpu_count(), MAX_THREADS);
+
+	options.thread_counts.values[options.thread_counts.count++] = 1;
+
+	if (cpu_count > 1)
+	{
+		options.thread_counts.values[options.thread_counts.count++] = cpu_count;
+	}
+
+	options.distribution     = OFFSET_DISTRIBUTION_UNIFORM;
+	options.zipf_theta       = 0.99;
+	options.duration_seconds = 2.0;
+
+	bool methods_set       = false;
+	bool block_sizes_set   = false;
+	bool thread_counts_set = false;
+
+	const char **paths     = (const char **) alloc_pages(sizeof(const char *) * argc);
+	u32 path_count         = 0;
+	const char *simd_level = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *arg = argv[i];
+		bool valid      = true;
+
+		if (strncmp(arg, "--methods=", 10) == 0)
+		{
+			valid       = parse_methods(arg + 10, options.methods);
+			methods_set = true;
+		}
+		else if (strncmp(arg, "--block-sizes=", 14) == 0)
+		{
+			valid           = parse_sweep(arg + 14, &options.block_sizes);
+			block_sizes_set = true;
+		}
+		else if (strncmp(arg, "--queue-depths=", 15) == 0)
+		{
+			valid = parse_sweep(arg + 15, &options.queue_depths);
+		}
+		else if (strncmp(arg, "--threads=", 10) == 0)
+		{
+			valid             = parse_sweep(arg + 10, &options.thread_counts);
+			thread_counts_set = true;
+
+			for (u32 t = 0; valid && t < options.thread_counts.count; ++t)
+			{
+				valid = options.thread_counts.values[t] <= MAX_THREADS;
+			}
+		}
+		else if (strcmp(arg, "--format=csv") == 0)
+		{
+			options.format = OUTPUT_FORMAT_CSV;
+		}
+		else if (strcmp(arg, "--format=json") == 0)
+		{
+			options.format = OUTPUT_FORMAT_JSON;
+		}
+		else if (strcmp(arg, "--cache=warm") == 0)
+		{
+			options.cache_mode = CACHE_MODE_WARM;
+		}
+		else if (strcmp(arg, "--cache=cold") == 0)
+		{
+			options.cache_mode = CACHE_MODE_COLD;
+		}
+		else if (strcmp(arg, "--cache=both") == 0)
+		{
+			options.cache_mode = CACHE_MODE_BOTH;
+		}
+		else if (strcmp(arg, "--random") == 0)
+		{
+			options.random = true;
+		}
+		else if (strcmp(arg, "--distribution=uniform") == 0)
+		{
+			options.distribution = OFFSET_DISTRIBUTION_UNIFORM;
+		}
+		else if (strcmp(arg, "--distribution=zipf") == 0)
+		{
+			options.distribution = OFFSET_DISTRIBUTION_ZIPF;
+		}
+		else if (strncmp(arg, "--zipf-theta=", 13) == 0)
+		{
+			options.zipf_theta = atof(arg + 13);
+			valid              = options.zipf_theta > 0.0 && options.zipf_theta < 1.0;
+		}
+		else if (strncmp(arg, "--duration=", 11) == 0)
+		{
+			options.duration_seconds = atof(arg + 11);
+			valid                    = options.duration_seconds > 0.0;
+		}
+		else if (strncmp(arg, "--ops=", 6) == 0)
+		{
+			valid = parse_size(arg + 6, &options.max_ops) && options.max_ops > 0;
+		}
+		else if (strcmp(arg, "--scaling") == 0)
+		{
+			options.scaling = true;
+		}
+		else if (strcmp(arg, "--roofline") == 0)
+		{
+			options.roofline = true;
+		}
+		else if (strncmp(arg, "--save=", 7) == 0)
+		{
+			options.roofline_save_path = arg + 7;
+		}
+		else if (strncmp(arg, "--simd=", 7) == 0)
+		{
+			simd_level = arg + 7;
+		}
+		else if (arg[0] == '-' && arg[1] == '-')
+		{
+			valid = false;
+		}
+		else
+		{
+			paths[path_count++] = arg;
+		}
+
+		if (!valid)
+		{
+			fprintf(stderr, "(fatal: invalid option %s)\n", arg);
+			return 1;
+		}
+	}
+
+	if (!init_simd_dispatch(simd_level))
+	{
+		return 1;
+	}
+
+	if (options.roofline)
+	{
+		return run_roofline(&options) ? 0 : 1;
+	}
+
+	if (path_count == 0 || (path_count > 1 && !options.scaling) || (options.scaling && options.random))
+	{
+		print_about(argv);
+		return 1;
+	}
+
+	if (options.random)
+	{
+		if (!methods_set)
+		{
+			parse_methods("pread,direct", options.methods);
+		}
+
+		if (!block_sizes_set)
+		{
+			parse_sweep("4K,64K,1M", &options.block_sizes);
+		}
+
+		if (!thread_counts_set)
+		{
+			parse_sweep("1,4,16", &options.thread_counts);
+		}
+	}
+
+	if (options.scaling)
+	{
+		if (!methods_set)
+		{
+			parse_methods("pread,direct", options.methods);
+		}
+
+		if (!block_sizes_set)
+		{
+			parse_sweep("1M", &options.block_sizes);
+		}
+
+		if (!thread_counts_set)
+		{
+			options.thread_counts.count = 0;
+
+			for (u32 count = 1; count < cpu_count && options.thread_counts.count < MAX_SWEEP_VALUES - 1; count *= 2)
+			{
+				options.thread_counts.values[options.thread_counts.count++] = count;
+			}
+
+			options.thread_counts.values[options.thread_counts.count++] = cpu_count;
+		}
+
+		return run_scaling_matrix(paths, path_count, &options) ? 0 : 1;
+	}
+
+	const char *file_path = paths[0];
+
+	file_handle_t file_handle = open_file_for_read(file_path, 0);
+
+	if (!is_file_handle_valid(file_handle))
+	{
+		fprintf(stderr, "(fatal: could not open file %s)\n", file_path);
+		return 1;
+	}
+
+	u64 file_size = get_file_size(file_handle);
+	close_file(file_handle);
+
+	// Keep stdout clean for the CSV/JSON, chatter goes to stderr
+	fprintf(stderr, "(file size is %lf GB)\n", ((double) file_size / (double) GIGABYTES(1)));
+
+	if (options.random)
+	{
+		run_random_matrix(file_path, file_size, &options);
+	}
+	else
+	{
+		run_sequential_matrix(file_path, file_size, &options);
+	}
 
 	return 0;
 }
@@ -0,0 +1,56 @@
+#!/bin/sh
+#
+# Compares count_lines --recursive against wc -l file by file. Run from the repo root after ./build.sh
+#
+
+count_lines=${COUNT_LINES:-build/count_lines}
+
+export LC_ALL=C
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+failed=0
+
+# A tree of many small files across nested folders, plus the edge cases: empty, no trailing newline, and one
+# bigger than the 5 MB read buffer
+mkdir -p "$work/tree/a/b/c" "$work/tree/d" "$work/tree/empty_dir"
+
+i=0
+while [ $i -lt 300 ]; do
+	case $((i % 3)) in
+		0) dir="$work/tree" ;;
+		1) dir="$work/tree/a/b" ;;
+		*) dir="$work/tree/a/b/c" ;;
+	esac
+
+	seq 1 $((i % 17)) > "$dir/file_$i.txt"
+	i=$((i + 1))
+done
+
+: > "$work/tree/d/empty.txt"
+printf 'one\ntwo\nno newline' > "$work/tree/d/unterminated.txt"
+seq 1 1500000 > "$work/tree/d/big.txt"
+
+expected=$(cd "$work/tree" && find . -type f | sed 's|^\./||' | sort | while read -r path; do
+	printf '%s %s\n' "$(wc -l < "$path" | tr -d ' ')" "$path"
+done)
+
+expected_lines=$(printf '%s\n' "$expected" | awk '{ total += $1 } END { print total }')
+expected_files=$(printf '%s\n' "$expected" | wc -l | tr -d ' ')
+
+for threads in 1 4; do
+	output=$("$count_lines" --recursive --threads=$threads --sort=name "$work/tree")
+
+	actual=$(printf '%s\n' "$output" | awk -v root="$work/tree/" '/^ *[0-9]+ / { sub("^" root, "", $2); print $1, $2 }')
+	totals=$(printf '%s\n' "$output" | grep '^counted')
+
+	if [ "$actual" = "$expected" ] && [ "$totals" = "counted $expected_lines lines in $expected_files files" ]; then
+		echo "ok   recursive, $threads threads"
+	else
+		echo "FAIL recursive, $threads threads: expected $expected_lines lines in $expected_files files, got '$totals'"
+		failed=1
+	fi
+done
+
+exit $failed
@@ -0,0 +1,58 @@
+#!/bin/sh
+#
+# Compares find_line match counts against grep. Run from the repo root after ./build.sh
+#
+
+find_line=${FIND_LINE:-build/find_line}
+
+export LC_ALL=C
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+failed=0
+
+# expect <name> <expected count> <find_line args...>, reads the searched text from stdin when it is piped
+expect()
+{
+	name=$1
+	expected=$2
+	shift 2
+
+	actual=$("$find_line" "$@" | grep -c '^MATCH')
+
+	if [ "$actual" = "$expected" ]; then
+		echo "ok   $name"
+	else
+		echo "FAIL $name: expected $expected, got $actual"
+		failed=1
+	fi
+}
+
+seq 1 20000 | sed 's/$/ line/' > "$work/lines.txt"
+awk 'NR % 7 == 0' "$work/lines.txt" > "$work/patterns.txt"
+
+# A pipe reports a size of 0, the end of the stream must come from the reader and not the stat size
+cat "$work/lines.txt" | expect "patterns, pipe" \
+	"$(grep -cxF -f "$work/patterns.txt" "$work/lines.txt")" \
+	--patterns="$work/patterns.txt" /dev/stdin
+cat "$work/lines.txt" | expect "patterns -v, pipe" \
+	"$(grep -cvxF -f "$work/patterns.txt" "$work/lines.txt")" \
+	--patterns="$work/patterns.txt" -v /dev/stdin
+printf '70 line' | expect "patterns, pipe, one unterminated line" 1 \
+	--patterns="$work/patterns.txt" /dev/stdin
+cat "$work/lines.txt" | expect "substring, pipe" \
+	"$(grep -cF -e 77 -e '9 l' "$work/lines.txt")" \
+	--substring --block-size=4K /dev/stdin 77 '9 l'
+cat "$work/lines.txt" | expect "substring -i, pipe" \
+	"$(grep -ciF -e 77 -e '9 LI' "$work/lines.txt")" \
+	--substring -i --block-size=4K /dev/stdin 77 '9 LI'
+
+# A regex with no literal to look for goes line by line, the carried newline must not read as an empty line
+seq 1 5000 > "$work/numbers.txt"
+expect "regex, no literal, empty lines" 0 \
+	--regex --no-mmap --block-size=4K "$work/numbers.txt" '^$'
+expect "regex, no literal, anchored" 5000 \
+	--regex --no-mmap --block-size=4K "$work/numbers.txt" '^[0-9]*$'
+
+exit $failed